@@ -135,13 +135,16 @@ void BBCoverage::instrumentFunction(Function &function, DIBuilder &debugBuilder)
   BasicBlock &entryBlock = function.getEntryBlock();
   BasicBlock::iterator entryInst = entryBlock.getFirstInsertionPt();
 
-  const CoverageArrays arrays = prepareFunction(function, arraySize, options.silentInternal, debugBuilder);
+  const CoverageArrays arrays = prepareFunction(function, arraySize, options, debugBuilder);
   
-  // instrument each site
+  // instrument each site, numbering sites in the function's block order
+  // so that each index names the same block in every replica
   unsigned int curIdx = 0;
-  for (set<BasicBlock*>::iterator i = fBBs.begin(), e = fBBs.end(); i != e; ++i)
+  for (Function::iterator i = function.begin(), e = function.end(); i != e; ++i)
     {
-      BasicBlock &block = **i;
+      BasicBlock &block = *i;
+      if (!fBBs.count(&block))
+        continue;
 
       // find a suitable insertion point; if the entry basic block, we
       // need to be after the array declaration
@@ -164,5 +167,5 @@ void BBCoverage::instrumentFunction(Function &function, DIBuilder &debugBuilder)
 
 bool BBCoverage::runOnModule(Module &module){
   static bool runBefore;
-  return runOnModuleOnce(module, options.infoFile, runBefore);
+  return runOnModuleOnce(module, options, runBefore);
 }
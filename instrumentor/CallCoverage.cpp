@@ -30,6 +30,7 @@
 #include <llvm/Support/Debug.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include "llvm_proxy/CommandLine.h"
 #include "llvm_proxy/InstIterator.h"
 #include "llvm_proxy/IntrinsicInst.h"
 #include "llvm_proxy/Module.h"
@@ -51,6 +52,11 @@ CallCoverage::Options CallCoverage::options(
    "multiple calls within a single basic block"
 );
 
+static cl::opt<bool> TailCalls("cc-tail-calls", cl::desc("Mark calls in tail "
+                               "position as covered before the call rather "
+                               "than after it returns, so they stay tail "
+                               "calls"));
+
 // Register call coverage as a pass
 char CallCoverage::ID = 0;
 static RegisterPass<CallCoverage> X("call-coverage",
@@ -172,7 +178,7 @@ void CallCoverage::instrumentFunction(Function &function, DIBuilder &debugBuilde
 
   const CoverageArrays arrays = prepareFunction(function,
                                                 arraySize,
-                                                options.silentInternal,
+                                                options,
                                                 debugBuilder);
   
   // instrument each site
@@ -183,8 +189,10 @@ void CallCoverage::instrumentFunction(Function &function, DIBuilder &debugBuilde
       assert(!call.getCalledFunction() ||
              !call.getCalledFunction()->isIntrinsic());
 
-      // add instrumentation to set local and global coverage bits
-      IRBuilder<> builder(&*nextInst(&call));
+      // add instrumentation to set local and global coverage bits (before a
+      // tail call, which must stay immediately before its return)
+      const bool beforeCall = TailCalls && &call == tailCall(*call.getParent());
+      IRBuilder<> builder(beforeCall ? &call : &*nextInst(&call));
       insertArrayStoreInsts(arrays, curIdx, builder);
     
       // write out the instrumentation site's static location details
@@ -201,5 +209,5 @@ void CallCoverage::instrumentFunction(Function &function, DIBuilder &debugBuilde
 
 bool CallCoverage::runOnModule(Module &module){
   static bool runBefore;
-  return runOnModuleOnce(module, options.infoFile, runBefore);
+  return runOnModuleOnce(module, options, runBefore);
 }
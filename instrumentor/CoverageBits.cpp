@@ -0,0 +1,121 @@
+//===--------------------------- CoverageBits.cpp -------------------------===//
+//
+// This module pass turns the branch-free updates of packed global coverage
+// bits into branches, once all coverage instrumentation is done.
+//
+//===----------------------------------------------------------------------===//
+//
+// Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+#define DEBUG_TYPE "coverage-bits"
+
+#include "CoverageBits.h"
+#include "Utils.hpp"
+
+#include <llvm/Support/Debug.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "llvm_proxy/InstIterator.h"
+#include "llvm_proxy/Instructions.h"
+#include "llvm_proxy/Module.h"
+
+#include <set>
+#include <vector>
+
+using namespace csi_inst;
+using namespace llvm;
+using namespace std;
+
+char LowerCoverageBits::ID = 0;
+static RegisterPass<LowerCoverageBits> X("csi-lower-coverage-bits",
+                "Branch around packed coverage bits that are already set",
+                false, false);
+
+// Whether value is one of the coverage passes' bit sinks
+static bool isBitSink(const Value &value){
+  const AllocaInst* alloca = dyn_cast<AllocaInst>(&value);
+  return(alloca && alloca->getName().startswith("__") &&
+         alloca->getName().endswith("_sink"));
+}
+
+// The select of a packed coverage update, if update is one: an atomic "or"
+// into either a bit sink (if the bit is set) or a global coverage array
+static SelectInst* getSinkSelect(AtomicRMWInst &update){
+  if(update.getOperation() != AtomicRMWInst::Or)
+    return(NULL);
+  SelectInst* select = dyn_cast<SelectInst>(update.getPointerOperand());
+  if(!select || !isBitSink(*select->getTrueValue()))
+    return(NULL);
+  GlobalVariable* global =
+    dyn_cast<GlobalVariable>(underlyingObject(select->getFalseValue()));
+  if(!global || !isCoverageGlobal(*global))
+    return(NULL);
+  return(select);
+}
+
+bool LowerCoverageBits::runOnModule(Module &M){
+  bool changed = false;
+  for(Module::iterator F = M.begin(), E = M.end(); F != E; ++F){
+    if(F->isDeclaration())
+      continue;
+
+    vector<AtomicRMWInst*> updates;
+    for(inst_iterator i = inst_begin(*F), e = inst_end(*F); i != e; ++i)
+      if(AtomicRMWInst* update = dyn_cast<AtomicRMWInst>(&*i))
+        if(getSinkSelect(*update))
+          updates.push_back(update);
+
+    set<Instruction*> sinks;
+    for(vector<AtomicRMWInst*>::iterator i = updates.begin(), e = updates.end(); i != e; ++i){
+      AtomicRMWInst* update = *i;
+      SelectInst* select = getSinkSelect(*update);
+      sinks.insert(cast<Instruction>(select->getTrueValue()));
+
+      // head: ...; br alreadySet, done, set
+      // set:  atomicrmw or entry, bit; br done
+      // done: ...
+      BasicBlock* head = update->getParent();
+      BasicBlock* done = head->splitBasicBlock(BasicBlock::iterator(update),
+                                               "coverageDone");
+      BasicBlock* setBits = BasicBlock::Create(M.getContext(), "coverageSet",
+                                           &*F, done);
+      BranchInst* toDone = BranchInst::Create(done, setBits);
+      update->moveBefore(toDone);
+      update->setOperand(update->getPointerOperandIndex(),
+                         select->getFalseValue());
+
+      Instruction* oldBranch = head->getTerminator();
+      BranchInst* branch = BranchInst::Create(done, setBits,
+                                              select->getCondition(),
+                                              oldBranch);
+      branch->setDebugLoc(DebugLoc());
+      toDone->setDebugLoc(DebugLoc());
+      oldBranch->eraseFromParent();
+      if(select->use_empty())
+        select->eraseFromParent();
+    }
+
+    for(set<Instruction*>::iterator i = sinks.begin(), e = sinks.end(); i != e; ++i)
+      if((*i)->use_empty())
+        (*i)->eraseFromParent();
+
+    DEBUG(if(!updates.empty())
+            dbgs() << "Function " << F->getName() << ": branched around "
+                   << updates.size() << " coverage bits\n");
+    changed |= !updates.empty();
+  }
+
+  return(changed);
+}
@@ -0,0 +1,54 @@
+//===---------------------------- CoverageBits.h --------------------------===//
+//
+// This module pass turns the branch-free updates of packed global coverage
+// bits into branches, once all coverage instrumentation is done.
+//
+//===----------------------------------------------------------------------===//
+//
+// Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+#ifndef CSI_COVERAGE_BITS_H
+#define CSI_COVERAGE_BITS_H
+
+#include "PassName.h"
+
+#include <llvm/Pass.h>
+
+namespace csi_inst {
+
+// ---------------------------------------------------------------------------
+// LowerCoverageBits is a module pass that must run after all coverage
+// instrumentation (and thus after path tracing).  With -<pass>-global-bits,
+// the coverage passes send each atomic "or" of a bit that is already set to
+// a private sink, chosen by a select, because a branch would add blocks that
+// later coverage passes would instrument.  This pass splits each such site
+// into a branch around the "or", so that a covered site only loads and
+// tests its byte, and removes the sinks.
+// ---------------------------------------------------------------------------
+class LowerCoverageBits : public llvm::ModulePass {
+private:
+  bool runOnModule(llvm::Module &M);
+
+public:
+  static char ID; // Pass identification, replacement for typeid
+  LowerCoverageBits() : ModulePass(ID) {}
+
+  virtual PassName getPassName() const {
+    return "CSI Lowering of Packed Coverage Bits";
+  }
+};
+} // end csi_inst namespace
+
+#endif
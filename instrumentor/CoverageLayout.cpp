@@ -0,0 +1,173 @@
+//===-------------------------- CoverageLayout.cpp ------------------------===//
+//
+// This module pass gathers the global coverage arrays of the CSI coverage
+// passes into sections of their own, so that they share cache lines neither
+// with unrelated program data nor with the read-mostly function switchers.
+//
+//===----------------------------------------------------------------------===//
+//
+// Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+#define DEBUG_TYPE "coverage-layout"
+
+#include "CoverageLayout.h"
+#include "Utils.hpp"
+
+#include <llvm/Analysis/BlockFrequencyInfo.h>
+#include <llvm/Analysis/BranchProbabilityInfo.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Debug.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "llvm_proxy/Dominators.h"
+#include "llvm_proxy/Instructions.h"
+#include "llvm_proxy/Module.h"
+
+#include <algorithm>
+
+using namespace csi_inst;
+using namespace llvm;
+using namespace std;
+
+char CoverageLayout::ID = 0;
+static RegisterPass<CoverageLayout> X("coverage-layout",
+                "Place coverage globals on cache lines of their own",
+                false, false);
+
+static cl::opt<unsigned> HotRatio("coverage-layout-hot", cl::desc("Give the "
+                "coverage arrays of functions whose hottest block is "
+                "estimated to run at least this many times per call cache "
+                "lines of their own (0 to disable)"), cl::init(0));
+
+// The section of the function switchers (see PrepareCSI.cpp)
+static const char * const SWITCHER_SECTION = "__CSI_func_inst";
+
+static const unsigned CACHE_LINE = 64;
+
+// The function part of a coverage array's name, which groups the arrays of
+// the same function together
+static StringRef ownerName(const GlobalVariable &global){
+  const StringRef name = global.getName();
+  return(name.substr(name.find("_arr_") + 5));
+}
+
+static bool byOwner(const GlobalVariable *a, const GlobalVariable *b){
+  return(ownerName(*a) < ownerName(*b));
+}
+
+// Collects the functions whose instructions use value, directly or through
+// constant expressions (such as the GEPs that index coverage arrays)
+static void collectUsers(Value &value, vector<Function*> &functions){
+#if LLVM_VERSION < 30500
+  for(Value::use_iterator i = value.use_begin(), e = value.use_end(); i != e; ++i){
+#else
+  for(Value::user_iterator i = value.user_begin(), e = value.user_end(); i != e; ++i){
+#endif
+    if(Instruction* inst = dyn_cast<Instruction>(*i))
+      functions.push_back(inst->getParent()->getParent());
+    else if(ConstantExpr* expr = dyn_cast<ConstantExpr>(*i))
+      collectUsers(*expr, functions);
+  }
+}
+
+uint64_t CoverageLayout::getHeat(Function &F){
+  map<Function*, uint64_t>::iterator known = heat.find(&F);
+  if(known != heat.end())
+    return(known->second);
+
+  uint64_t result = 0;
+#if LLVM_VERSION >= 30900
+  // as for path tracing's frequency-based spanning trees, estimate from any
+  // profile metadata, and otherwise from static heuristics
+  DominatorTree domTree(F);
+  LoopInfo loops(domTree);
+  BranchProbabilityInfo branchProbs(F, loops);
+  BlockFrequencyInfo blockFreqs(F, branchProbs, loops);
+  const uint64_t entry = blockFreqs.getEntryFreq();
+  uint64_t peak = entry;
+  for(Function::iterator bb = F.begin(), e = F.end(); bb != e; ++bb)
+    peak = max(peak, blockFreqs.getBlockFreq(&*bb).getFrequency());
+  if(entry)
+    result = peak / entry;
+#endif
+  DEBUG(dbgs() << "Function " << F.getName() << ": hottest block runs "
+               << result << " times per call\n");
+  heat[&F] = result;
+  return(result);
+}
+
+bool CoverageLayout::isHot(GlobalVariable &global){
+  vector<Function*> functions;
+  collectUsers(global, functions);
+  for(vector<Function*>::iterator i = functions.begin(), e = functions.end(); i != e; ++i)
+    if(getHeat(**i) >= HotRatio)
+      return(true);
+  return(false);
+}
+
+void CoverageLayout::place(Module &M, const vector<GlobalVariable*> &globals,
+                           const char *section, bool ownLines){
+  for(vector<GlobalVariable*>::const_iterator i = globals.begin(), e = globals.end(); i != e; ++i){
+    GlobalVariable* global = *i;
+    DEBUG(dbgs() << global->getName() << " -> " << section << '\n');
+    global->setSection(section);
+    // a section is aligned as strictly as its most aligned member, so the
+    // first array also starts the section on a line of its own
+    if(ownLines || i == globals.begin())
+      global->setAlignment(max<unsigned>(global->getAlignment(), CACHE_LINE));
+    global->removeFromParent();
+    M.getGlobalList().push_back(global);
+  }
+}
+
+bool CoverageLayout::runOnModule(Module &M){
+#if LLVM_VERSION < 30900
+  if(HotRatio)
+    errs() << "WARNING: -coverage-layout-hot requires LLVM 3.9 or later.  "
+           << "No coverage arrays will be treated as hot.\n";
+#endif
+
+  vector<GlobalVariable*> cold, hot;
+  GlobalVariable* firstSwitcher = NULL;
+  for(Module::global_iterator G = M.global_begin(), E = M.global_end(); G != E; ++G){
+    if(isCoverageGlobal(*G)){
+#if LLVM_VERSION >= 30900
+      if(HotRatio && isHot(*G)){
+        hot.push_back(&*G);
+        continue;
+      }
+#endif
+      cold.push_back(&*G);
+    }
+    else if(!firstSwitcher && G->getSection() == SWITCHER_SECTION)
+      firstSwitcher = &*G;
+  }
+  if(cold.empty() && hot.empty())
+    return(false);
+
+  // keep the arrays of each function next to each other, as they are
+  // written by the same code
+  stable_sort(cold.begin(), cold.end(), byOwner);
+  stable_sort(hot.begin(), hot.end(), byOwner);
+  place(M, cold, "__CSI_cov", false);
+  place(M, hot, "__CSI_cov_hot", true);
+
+  // switchers are rarely written, so start their section on a line of its own
+  if(firstSwitcher)
+    firstSwitcher->setAlignment(max<unsigned>(firstSwitcher->getAlignment(), CACHE_LINE));
+
+  return(true);
+}
@@ -0,0 +1,69 @@
+//===--------------------------- CoverageLayout.h -------------------------===//
+//
+// This module pass gathers the global coverage arrays of the CSI coverage
+// passes into sections of their own, so that they share cache lines neither
+// with unrelated program data nor with the read-mostly function switchers.
+//
+//===----------------------------------------------------------------------===//
+//
+// Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+#ifndef CSI_COVERAGE_LAYOUT_H
+#define CSI_COVERAGE_LAYOUT_H
+
+#include "PassName.h"
+
+#include <llvm/Pass.h>
+
+#include "llvm_proxy/GlobalVariable.h"
+
+#include <map>
+#include <vector>
+
+namespace csi_inst {
+
+// ---------------------------------------------------------------------------
+// CoverageLayout is a module pass that must run after all coverage passes.
+// Coverage arrays are placed in section "__CSI_cov", grouped by function.
+// With -coverage-layout-hot, the arrays of functions estimated to be hot go
+// to section "__CSI_cov_hot" instead, each starting on a cache line of its
+// own.
+// ---------------------------------------------------------------------------
+class CoverageLayout : public llvm::ModulePass {
+private:
+  // Estimated executions of each function's hottest block per call
+  std::map<llvm::Function*, uint64_t> heat;
+
+  // Whether any function that writes to the given coverage array is hot
+  bool isHot(llvm::GlobalVariable &global);
+  uint64_t getHeat(llvm::Function &F);
+
+  // Moves globals, in order, to the end of M and into the given section
+  void place(llvm::Module &M, const std::vector<llvm::GlobalVariable*> &globals,
+             const char *section, bool ownLines);
+
+  bool runOnModule(llvm::Module &M);
+
+public:
+  static char ID; // Pass identification, replacement for typeid
+  CoverageLayout() : ModulePass(ID) {}
+
+  virtual PassName getPassName() const {
+    return "CSI Cache-Line-Aware Coverage Layout";
+  }
+};
+} // end csi_inst namespace
+
+#endif
@@ -66,6 +66,13 @@ static cl::opt<bool> VerifyOptimality("opt-verify-optimality",
                                                "based on requested optimality "
                                                "level."));
 
+// option to keep probes out of innermost loop bodies where possible
+static cl::opt<bool> LoopAware("opt-loop-aware",
+                               cl::desc("Prefer coverage probes outside the "
+                                        "bodies of innermost loops whenever "
+                                        "a coverage set without them "
+                                        "exists."));
+
 // option to log stats on optimization result
 static cl::opt<bool> LogStats("opt-log-stats",
 			      cl::desc("Log stats on coverage set cost and "
@@ -349,6 +356,12 @@ namespace llvm {
 }
 #endif
 
+#if LLVM_VERSION < 30700
+namespace llvm {
+  typedef LoopInfo LoopInfoWrapperPass;
+}
+#endif
+
 bool CoverageOptimizationData::runOnFunction(Function& F){
   BlockFrequencyInfoWrapperPass& bfPass = getAnalysis<BlockFrequencyInfoWrapperPass>();
 #if LLVM_VERSION < 30800
@@ -357,15 +370,22 @@ bool CoverageOptimizationData::runOnFunction(Function& F){
   BlockFrequencyInfo& bf = bfPass.getBFI();
 #endif
   DominatorTree& domTree = getDominatorTree(*this);
-  this->graph.reset(new NaiveOptimizationGraph(&F, bf));
-  this->tree = DominatorOptimizationGraph(&F, bf, domTree);
+  LoopInfoWrapperPass& loopPass = getAnalysis<LoopInfoWrapperPass>();
+#if LLVM_VERSION < 30700
+  const LoopInfo* loops = LoopAware ? &loopPass : NULL;
+#else
+  const LoopInfo* loops = LoopAware ? &loopPass.getLoopInfo() : NULL;
+#endif
+  this->graph.reset(new NaiveOptimizationGraph(&F, bf, loops));
+  this->tree = DominatorOptimizationGraph(&F, bf, domTree, loops);
   return(false);
 }
 
-// We currently need BlockFrequencyInfo and dominators to run coverage
-// optimization
+// We currently need BlockFrequencyInfo, dominators, and loops to run
+// coverage optimization
 void CoverageOptimizationData::getAnalysisUsage(AnalysisUsage& AU) const {
   AU.setPreservesAll();
   AU.addRequired<BlockFrequencyInfoWrapperPass>();
   addRequiredDominatorTree(AU);
+  AU.addRequired<LoopInfoWrapperPass>();
 }
@@ -27,6 +27,7 @@
 #include "PassName.h"
 
 #include <llvm/Analysis/BlockFrequencyInfo.h>
+#include <llvm/Analysis/LoopInfo.h>
 #include <llvm/Pass.h>
 
 #include "llvm_proxy/Dominators.h"
@@ -24,6 +24,8 @@
 #include "CoverageOptimizationGraph.h"
 #include "NaiveCoverageSet.h"
 
+#include <llvm/Analysis/LoopInfo.h>
+
 #include "llvm_proxy/CFG.h"
 #include "Utils.hpp"
 #include "Versions.h"
@@ -71,7 +73,8 @@ vector<BasicBlock*> CoverageOptimizationGraph::sortBlocksByCost(
 }
 
 void CoverageOptimizationGraph::fillInNodeCost(
-     const llvm::BlockFrequencyInfo& bf) {
+     const llvm::BlockFrequencyInfo& bf,
+     const llvm::LoopInfo* loops) {
   blockCost.clear();
 
   const Function* graphFunction = this->function;
@@ -96,6 +99,29 @@ void CoverageOptimizationGraph::fillInNodeCost(
     double myScaledFreq = (double)myWhole + (double)myPart / freqScaleDouble;
     blockCost[&*i] = myScaledFreq;
   }
+
+  if(!loops)
+    return;
+
+  // With loop-aware costs, a block in the body of an innermost loop that is
+  // estimated to iterate costs more than all other blocks together.  Any
+  // coverage set with fewer probes in such bodies is then cheaper, whatever
+  // its other probes, and the optimizers only leave a probe in a loop body
+  // when no valid coverage set can do without it.
+  double penalty = 1.0;
+  for(map<const BasicBlock*, double>::const_iterator i = blockCost.begin(), e = blockCost.end(); i != e; ++i)
+    penalty += i->second;
+  for(Function::const_iterator i = graphFunction->begin(), e = graphFunction->end(); i != e; ++i){
+    const Loop* loop = loops->getLoopFor(&*i);
+    if(!loop || !loop->getSubLoops().empty())
+      continue;
+    // a loop whose header runs no more often than its preheader is not
+    // expected to take its back edge
+    const BasicBlock* preheader = loop->getLoopPreheader();
+    if(preheader && blockCost[loop->getHeader()] <= blockCost[preheader])
+      continue;
+    blockCost[&*i] += penalty;
+  }
 }
 
 void CoverageOptimizationGraph::buildGraphFromFunction(Function* F){
@@ -117,10 +143,11 @@ CoverageOptimizationGraph::CoverageOptimizationGraph(){
 
 CoverageOptimizationGraph::CoverageOptimizationGraph(
      llvm::Function* F,
-     const llvm::BlockFrequencyInfo& bf){
+     const llvm::BlockFrequencyInfo& bf,
+     const llvm::LoopInfo* loops){
   this->function = F;
   this->entryBlock = &F->getEntryBlock();
-  fillInNodeCost(bf);
+  fillInNodeCost(bf, loops);
 
   buildGraphFromFunction(F);
 }
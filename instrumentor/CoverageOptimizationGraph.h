@@ -32,6 +32,10 @@
 #include <set>
 #include <vector>
 
+namespace llvm {
+  class LoopInfo;
+}
+
 namespace csi_inst {
 
 
@@ -64,8 +68,9 @@ private:
   // a local cache of the estimated cost of each node
   std::map<const llvm::BasicBlock*, double> blockCost;
 
-  // fill in the cost of each block
-  void fillInNodeCost(const llvm::BlockFrequencyInfo& bf);
+  // fill in the cost of each block (loop-aware, if loops are given)
+  void fillInNodeCost(const llvm::BlockFrequencyInfo& bf,
+                      const llvm::LoopInfo* loops);
 
   // fill in the edges and block/ID maps based on the llvm function
   void buildGraphFromFunction(llvm::Function* F);
@@ -73,8 +78,10 @@ private:
 public:
   // constructor for an empty graph
   CoverageOptimizationGraph();
-  // constructor from an LLVM function and block frequency info
-  CoverageOptimizationGraph(llvm::Function* F, const llvm::BlockFrequencyInfo& bf);
+  // constructor from an LLVM function and block frequency info, and (for
+  // loop-aware costs) loop info
+  CoverageOptimizationGraph(llvm::Function* F, const llvm::BlockFrequencyInfo& bf,
+                            const llvm::LoopInfo* loops = NULL);
   // TODO: constructor from an LLVM function, with unit costs
   virtual ~CoverageOptimizationGraph();
 
@@ -37,7 +37,9 @@ using namespace std;
 
 csi_inst::CoveragePass::CoveragePass(char &id, const CoveragePassNames &names)
   : ModulePass(id),
-    names(names)
+    bitSink(NULL),
+    names(names),
+    globalBits(false)
 {
 }
 
@@ -45,7 +47,107 @@ csi_inst::CoveragePass::CoveragePass(char &id, const CoveragePassNames &names)
 void csi_inst::CoveragePass::writeFunctionValue(const Function &function, const GlobalVariable &global)
 {
   infoStream << '#' << function.getName().str() << '|'
-             << global.getName().str() << '\n';
+             << global.getName().str();
+  if (globalBits && isa<ArrayType>(global.getType()->getElementType()))
+    infoStream << "|bits";
+  infoStream << '\n';
+}
+
+
+unsigned csi_inst::CoveragePass::globalArraySize(unsigned sites) const
+{
+  return globalBits ? (sites + 7) / 8 : sites;
+}
+
+
+AllocaInst &csi_inst::CoveragePass::getBitSink(Function &function)
+{
+  if (!bitSink)
+    {
+      IRBuilder<> builder(&*function.getEntryBlock().getFirstInsertionPt());
+      bitSink = builder.CreateAlloca(tBool, NULL, "__" + names.upperShort + "_sink");
+    }
+  return *bitSink;
+}
+
+
+// clear out debug data for instrumentation instructions (so as not to
+// confuse CFG writing into thinking these are from the original code).
+// Sadly, it appears there is no way to clear debug data from the IRBuilder.
+static void clearDebugLoc(Value *value)
+{
+  if (Instruction * const instruction = dyn_cast<Instruction>(value))
+    instruction->setDebugLoc(DebugLoc());
+}
+
+
+Instruction &csi_inst::CoveragePass::setGlobalCoverage(GlobalVariable &global, unsigned index, IRBuilder<> &builder)
+{
+  // find the site's entry (or the byte holding its bit)
+  Value *entry = &global;
+  if (isa<ArrayType>(global.getType()->getElementType()))
+    {
+      Type * const intType = builder.getInt32Ty();
+      Value * const gepIndices[] = {
+        Constant::getNullValue(intType),
+        ConstantInt::get(intType, globalBits ? index / 8 : index),
+      };
+      entry = builder.CreateInBoundsGEP(&global, gepIndices, "global" + names.upperShort);
+      clearDebugLoc(entry);
+    }
+
+  if (!globalBits)
+    {
+      Value * const trueValue = ConstantInt::get(tBool, true);
+#if LLVM_VERSION < 30200
+      StoreInst * const globalStore = builder.CreateStore(trueValue, entry, false);
+      globalStore->setAlignment(1);
+#else
+      StoreInst * const globalStore = builder.CreateAlignedStore(trueValue, entry, 1, false);
+#endif
+#if LLVM_VERSION < 30900
+      globalStore->setOrdering(Unordered);
+#else
+      globalStore->setOrdering(AtomicOrdering::Unordered);
+#endif
+#if LLVM_VERSION < 50000
+      globalStore->setSynchScope(SynchronizationScope::CrossThread);
+#else
+      globalStore->setSyncScopeID(SyncScope::System);
+#endif
+      globalStore->setDebugLoc(DebugLoc());
+      return *globalStore;
+    }
+
+  // Once a bit is set, its line only needs to be read: the write goes to a
+  // private sink instead, chosen without branching so that the CFG (and
+  // thus path tracing) is unaffected until LowerCoverageBits turns the
+  // choice into a branch.  Threads may set different bits of the same byte
+  // at once, so the write is an atomic "or".
+  Constant * const bit = ConstantInt::get(tBool, 1 << (index % 8));
+  LoadInst * const oldBits = builder.CreateLoad(entry, "global" + names.upperShort + "Bits");
+  oldBits->setAlignment(1);
+#if LLVM_VERSION < 30900
+  oldBits->setAtomic(Unordered);
+#else
+  oldBits->setAtomic(AtomicOrdering::Unordered);
+#endif
+  Value * const newBits = builder.CreateOr(oldBits, bit);
+  Value * const alreadySet = builder.CreateICmpEQ(newBits, oldBits);
+  Function &function = *builder.GetInsertBlock()->getParent();
+  Value * const target = builder.CreateSelect(alreadySet, &getBitSink(function), entry);
+#if LLVM_VERSION < 30900
+  AtomicRMWInst * const globalSet = builder.CreateAtomicRMW(AtomicRMWInst::Or, target, bit, Monotonic);
+#else
+  AtomicRMWInst * const globalSet = builder.CreateAtomicRMW(AtomicRMWInst::Or, target, bit, AtomicOrdering::Monotonic);
+#endif
+
+  clearDebugLoc(oldBits);
+  clearDebugLoc(newBits);
+  clearDebugLoc(alreadySet);
+  clearDebugLoc(target);
+  globalSet->setDebugLoc(DebugLoc());
+  return *globalSet;
 }
 
 
@@ -83,6 +185,8 @@ void csi_inst::CoveragePass::modulePreliminaries(Module &module, DIBuilder &debu
   createCompileUnit(debugBuilder, module, *this);
   boolType = createBasicType(debugBuilder, "__" + names.lowerShort + "_bool", 8,
                              dwarf::DW_ATE_boolean);
+  bitsType = createBasicType(debugBuilder, "__" + names.lowerShort + "_bits", 8,
+                             dwarf::DW_ATE_unsigned);
 
   // the type of bool
   LLVMContext &Context = module.getContext();
@@ -98,7 +202,10 @@ void csi_inst::CoveragePass::instrumentFunctions(Module &module, DIBuilder &debu
     if (!function->isDeclaration() && !function->isIntrinsic() &&
         !function->getName().substr(0, 5).equals("__PT_") &&
         plan.hasInstrumentationType(*function, names.upperShort))
-      instrumentFunction(*function, debugBuilder);
+      {
+        bitSink = NULL;
+        instrumentFunction(*function, debugBuilder);
+      }
 }
 
 
@@ -109,10 +216,11 @@ void csi_inst::CoveragePass::getAnalysisUsage(AnalysisUsage &usage) const
 }
 
 
-bool csi_inst::CoveragePass::runOnModuleOnce(Module &module, const InfoFileOption &infoFile, bool &runBefore)
+bool csi_inst::CoveragePass::runOnModuleOnce(Module &module, const Options &options, bool &runBefore)
 {
-  if (!prepareForModule(runBefore, module, infoFile))
+  if (!prepareForModule(runBefore, module, options.infoFile))
     return false;
+  globalBits = options.globalBits;
 
   // some debug info preliminaries
   ScopedDIBuilder debugBuilder(module);
@@ -130,6 +238,7 @@ bool csi_inst::CoveragePass::runOnModuleOnce(Module &module, const InfoFileOptio
 
 
 csi_inst::CoveragePass::Options::Options(const CoveragePassNames &names)
-  : infoFile(names)
+  : infoFile(names),
+    globalBits(names)
 {
 }
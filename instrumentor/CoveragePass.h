@@ -24,20 +24,24 @@
 #ifndef CSI_COVERAGE_PASS_H
 #define CSI_COVERAGE_PASS_H
 
+#include "GlobalBitsOption.h"
 #include "InfoFileOption.h"
 #include "Versions.h"
 
 #include <llvm/Pass.h>
 
 #include "llvm_proxy/DebugInfo.h"
+#include "llvm_proxy/IRBuilder.h"
 
 #include <fstream>
 #include <map>
 
 namespace llvm
 {
+  class AllocaInst;
   class DIBuilder;
   class GlobalVariable;
+  class Instruction;
 }
 
 
@@ -49,6 +53,10 @@ namespace csi_inst
   class CoveragePass : public llvm::ModulePass
   {
   private:
+    // where the current function writes bits that are already set
+    llvm::AllocaInst *bitSink;
+    llvm::AllocaInst &getBitSink(llvm::Function &);
+
     bool prepareForModule(bool &, const llvm::Module &, const InfoFileOption &);
     void modulePreliminaries(llvm::Module &, llvm::DIBuilder &);
     void instrumentFunctions(llvm::Module &, llvm::DIBuilder &);
@@ -60,6 +68,7 @@ namespace csi_inst
     struct Options
     {
       InfoFileOption infoFile;
+      GlobalBitsOption globalBits;
       Options(const CoveragePassNames &);
     };
 
@@ -74,13 +83,30 @@ namespace csi_inst
     llvm::DIType *boolType;
 #endif
 
+    // whether global coverage arrays are packed into bits that are only
+    // written when clear (-<pass>-global-bits), and the type of their bytes
+    bool globalBits;
+#if LLVM_VERSION < 30700
+    llvm::DIType bitsType;
+#else
+    llvm::DIType *bitsType;
+#endif
+
     CoveragePass(char &, const CoveragePassNames &);
 
     template <typename Pass> static void requireAndPreserve(llvm::AnalysisUsage &);
 
-    bool runOnModuleOnce(llvm::Module &, const InfoFileOption &, bool &);
+    bool runOnModuleOnce(llvm::Module &, const Options &, bool &);
     void writeFunctionValue(const llvm::Function &, const llvm::GlobalVariable &);
 
+    // the number of entries in a global coverage array for the given
+    // number of sites
+    unsigned globalArraySize(unsigned sites) const;
+
+    // marks a site covered in its global coverage array, returning the
+    // instruction that writes to the array
+    llvm::Instruction &setGlobalCoverage(llvm::GlobalVariable &, unsigned index, llvm::IRBuilder<> &);
+
   public:
     void getAnalysisUsage(llvm::AnalysisUsage &) const;
   };
@@ -217,7 +217,8 @@ DominatorOptimizationGraph::DominatorOptimizationGraph() :
 DominatorOptimizationGraph::DominatorOptimizationGraph(
      Function* F,
      const BlockFrequencyInfo& bf,
-     const DominatorTree& domTree) : CoverageOptimizationGraph(F, bf) {
+     const DominatorTree& domTree,
+     const LoopInfo* loops) : CoverageOptimizationGraph(F, bf, loops) {
   const DomTreeNode* domRoot = domTree.getRootNode();
   recAddToGraph(domRoot);
 }
@@ -95,10 +95,12 @@ private:
 public:
   // constructor for an empty graph
   DominatorOptimizationGraph();
-  // constructor from an LLVM function, block frequency info
+  // constructor from an LLVM function, block frequency info, dominator
+  // tree, and (for loop-aware costs) loop info
   DominatorOptimizationGraph(llvm::Function* F,
                              const llvm::BlockFrequencyInfo& bf,
-                             const llvm::DominatorTree& domTree);
+                             const llvm::DominatorTree& domTree,
+                             const llvm::LoopInfo* loops = NULL);
   // TODO: constructor from an LLVM function, with unit costs
   ~DominatorOptimizationGraph();
 
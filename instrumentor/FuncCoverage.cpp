@@ -32,6 +32,7 @@
 
 #include "llvm_proxy/InstIterator.h"
 #include "llvm_proxy/IntrinsicInst.h"
+#include "llvm_proxy/IRBuilder.h"
 #include "llvm_proxy/Module.h"
 
 #include <iostream>
@@ -67,23 +68,13 @@ void FuncCoverage::instrumentFunction(Function &function, DIBuilder &debugBuilde
   
   // instrument the function's entry
   Instruction* insertPoint = &*function.getEntryBlock().getFirstInsertionPt();
-  new StoreInst(ConstantInt::get(tBool, 1), &theGlobal, false, 1,
-#if LLVM_VERSION < 30900
-                Unordered,
-#else
-                AtomicOrdering::Unordered,
-#endif
-#if LLVM_VERSION < 50000
-		CrossThread,
-#else
-                SyncScope::System,
-#endif
-		insertPoint);
+  IRBuilder<> builder(insertPoint);
+  setGlobalCoverage(theGlobal, 0, builder);
 }
 
 
 bool FuncCoverage::runOnModule(Module& module)
 {
   static bool runBefore;
-  return runOnModuleOnce(module, options.infoFile, runBefore);
+  return runOnModuleOnce(module, options, runBefore);
 }
@@ -0,0 +1,35 @@
+//===------------------------ GlobalBitsOption.cpp ------------------------===//
+//
+// A simple class encapsulating the flag that packs a coverage pass's global
+// arrays into bits, which are only written when not yet set.
+//
+//===----------------------------------------------------------------------===//
+//
+// Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+#include "CoveragePassNames.h"
+#include "GlobalBitsOption.h"
+#include "optionName.h"
+
+using namespace llvm;
+using namespace std;
+
+
+csi_inst::GlobalBitsOption::GlobalBitsOption(const CoveragePassNames &names)
+  : flag(names.lowerShort + "-global-bits"),
+    description("Pack global " + names.lowerFull + " coverage into bits, and set each bit only if it is not set already, so that covered sites stop writing to shared cache lines"),
+    option(optionName(flag), cl::desc(description.c_str()))
+{
+}
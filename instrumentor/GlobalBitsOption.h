@@ -0,0 +1,58 @@
+//===------------------------- GlobalBitsOption.h -------------------------===//
+//
+// A simple class encapsulating the flag that packs a coverage pass's global
+// arrays into bits, which are only written when not yet set.
+//
+//===----------------------------------------------------------------------===//
+//
+// Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+#ifndef CSI_GLOBAL_BITS_OPTION_H
+#define CSI_GLOBAL_BITS_OPTION_H
+
+#include "llvm_proxy/CommandLine.h"
+
+#include <string>
+
+
+namespace csi_inst
+{
+  struct CoveragePassNames;
+
+
+  class GlobalBitsOption
+  {
+  public:
+    GlobalBitsOption(const CoveragePassNames &);
+    operator bool() const;
+
+  private:
+    const std::string flag;
+    const std::string description;
+    llvm::cl::opt<bool> option;
+  };
+}
+
+
+////////////////////////////////////////////////////////////////////////
+
+
+inline csi_inst::GlobalBitsOption::operator bool() const
+{
+  return option;
+}
+
+
+#endif // !CSI_GLOBAL_BITS_OPTION_H
@@ -48,20 +48,39 @@ void csi_inst::LocalCoveragePass::getAnalysisUsage(AnalysisUsage &usage) const
 }
 
 
-csi_inst::LocalCoveragePass::CoverageArrays csi_inst::LocalCoveragePass::prepareFunction(Function &function, unsigned arraySize, const SilentInternalOption &silentInternal, DIBuilder &debugBuilder)
+csi_inst::LocalCoveragePass::CoverageArrays csi_inst::LocalCoveragePass::prepareFunction(Function &function, unsigned arraySize, const Options &options, DIBuilder &debugBuilder)
 {
   ArrayType * const tArr = ArrayType::get(tBool, arraySize);
 
-  // create global coverage array
+  // create global coverage array (of bytes, or of packed bits)
+  const unsigned globalSize = globalArraySize(arraySize);
+  ArrayType * const tGlobalArr = ArrayType::get(tBool, globalSize);
 #if LLVM_VERSION < 30700
-  const DIType arrType = createArrayType(debugBuilder, arraySize, boolType);
+  const DIType arrType = createArrayType(debugBuilder, globalSize, globalBits ? bitsType : boolType);
 #else
-  DIType * const arrType { createArrayType(debugBuilder, arraySize, boolType) };
+  DIType * const arrType { createArrayType(debugBuilder, globalSize, globalBits ? bitsType : boolType) };
 #endif
-  GlobalVariable &theGlobal = getOrCreateGlobal(debugBuilder, function, *tArr, arrType, names.upperShort);
+  GlobalVariable &theGlobal = getOrCreateGlobal(debugBuilder, function, *tGlobalArr, arrType, names.upperShort);
   
-  // declare the local coverage array and set up debug metadata
-  AllocaInst * const arrInst = createZeroedLocalArray(function, *tArr, "__" + names.upperShort + "_arr", debugBuilder, boolType, silentInternal);
+  // declare the local coverage array (or mask) and set up debug metadata;
+  // a mask is cleared by one store rather than a memset on every call
+  const string localName = "__" + names.upperShort + "_arr";
+  AllocaInst *arrInst;
+  if (options.localMask && arraySize <= 64)
+    {
+      unsigned maskBits = 8;
+      while (maskBits < arraySize)
+        maskBits *= 2;
+      IntegerType * const tMask = IntegerType::get(function.getContext(), maskBits);
+#if LLVM_VERSION < 30700
+      const DIType maskType = createBasicType(debugBuilder, "__" + names.lowerShort + "_mask", maskBits, dwarf::DW_ATE_unsigned);
+#else
+      DIType * const maskType { createBasicType(debugBuilder, "__" + names.lowerShort + "_mask", maskBits, dwarf::DW_ATE_unsigned) };
+#endif
+      arrInst = createZeroedLocalMask(function, *tMask, localName, debugBuilder, maskType, options.silentInternal);
+    }
+  else
+    arrInst = createZeroedLocalArray(function, *tArr, localName, debugBuilder, boolType, options.silentInternal);
 
   // write out the function name and its arrays
   writeFunctionValue(function, theGlobal);
@@ -71,7 +90,7 @@ csi_inst::LocalCoveragePass::CoverageArrays csi_inst::LocalCoveragePass::prepare
 }
 
 
-void csi_inst::LocalCoveragePass::insertArrayStoreInsts(const CoverageArrays &arrays, unsigned index, IRBuilder<> &builder) const
+void csi_inst::LocalCoveragePass::insertArrayStoreInsts(const CoverageArrays &arrays, unsigned index, IRBuilder<> &builder)
 {
   Type * const intType = builder.getInt32Ty();
 
@@ -81,37 +100,34 @@ void csi_inst::LocalCoveragePass::insertArrayStoreInsts(const CoverageArrays &ar
     ConstantInt::get(intType, index),
   };
 
-  Value * const localGEP = builder.CreateInBoundsGEP(&arrays.local, gepIndices, "local"  + names.upperShort);
-  StoreInst * const localStore = builder.CreateStore(trueValue, localGEP, true);
-  Value * const globalGEP = builder.CreateInBoundsGEP(&arrays.global, gepIndices, "global" + names.upperShort);
-#if LLVM_VERSION < 30200
-  StoreInst * const globalStore = builder.CreateStore(trueValue, globalGEP, false);
-  globalStore->setAlignment(1);
-#else
-  StoreInst * const globalStore = builder.CreateAlignedStore(trueValue, globalGEP, 1, false);
-#endif
-#if LLVM_VERSION < 30900
-  globalStore->setOrdering(Unordered);
-#else
-  globalStore->setOrdering(AtomicOrdering::Unordered);
-#endif
-#if LLVM_VERSION < 50000
-  globalStore->setSynchScope(SynchronizationScope::CrossThread);
-#else
-  globalStore->setSyncScopeID(SyncScope::System);
-#endif
+  // set the site's byte of the local array, or OR its bit into the mask
+  Value *localGEP = NULL;
+  Value *localBits = NULL;
+  StoreInst *localStore;
+  if (IntegerType * const tMask = dyn_cast<IntegerType>(arrays.local.getAllocatedType()))
+    {
+      LoadInst * const oldBits = builder.CreateLoad(&arrays.local, true, "local" + names.upperShort);
+      localBits = builder.CreateOr(oldBits, ConstantInt::get(tMask, 1ULL << index));
+      localStore = builder.CreateStore(localBits, &arrays.local, true);
+      oldBits->setDebugLoc(DebugLoc());
+    }
+  else
+    {
+      localGEP = builder.CreateInBoundsGEP(&arrays.local, gepIndices, "local"  + names.upperShort);
+      localStore = builder.CreateStore(trueValue, localGEP, true);
+    }
 
   // clear out debug data for instrumentation instructions (so as not to
   // confuse CFG writing into thinking these are from the original code).
   // Sadly, it appears there is no way to clear debug data from the IRBuilder.
-  if(Instruction* localGEPInst = dyn_cast<Instruction>(localGEP))
+  if(Instruction* localGEPInst = dyn_cast_or_null<Instruction>(localGEP))
     localGEPInst->setDebugLoc(DebugLoc());
-  if(Instruction* globalGEPInst = dyn_cast<Instruction>(globalGEP))
-    globalGEPInst->setDebugLoc(DebugLoc());
+  if(Instruction* localBitsInst = dyn_cast_or_null<Instruction>(localBits))
+    localBitsInst->setDebugLoc(DebugLoc());
   localStore->setDebugLoc(DebugLoc());
-  globalStore->setDebugLoc(DebugLoc());
 
-  attachCSILabelToInstruction(*globalStore, indexToLabel(index));
+  Instruction &globalStore = setGlobalCoverage(arrays.global, index, builder);
+  attachCSILabelToInstruction(globalStore, indexToLabel(index));
 }
 
 string csi_inst::LocalCoveragePass::indexToLabel(unsigned int index) const
@@ -126,6 +142,7 @@ string csi_inst::LocalCoveragePass::indexToLabel(unsigned int index) const
 csi_inst::LocalCoveragePass::Options::Options(const CoveragePassNames &names, const char descriptionO1[])
   : CoveragePass::Options(names),
     optimizationLevel(names, descriptionO1),
-    silentInternal(names)
+    silentInternal(names),
+    localMask(names)
 {
 }
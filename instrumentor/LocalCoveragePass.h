@@ -24,6 +24,7 @@
 #define CSI_LOCAL_COVERAGE_PASS_H
 
 #include "CoveragePass.h"
+#include "LocalMaskOption.h"
 #include "OptimizationOption.h"
 #include "SilentInternalOption.h"
 
@@ -46,19 +47,22 @@ namespace csi_inst
     {
       OptimizationOption optimizationLevel;
       SilentInternalOption silentInternal;
+      LocalMaskOption localMask;
       Options(const CoveragePassNames &, const char descriptionO1[]);
     };
 
     LocalCoveragePass(char &, const CoveragePassNames &);
 
+    // the local is an array of bytes, or (with -<pass>-local-mask and at
+    // most 64 sites) a single integer with one bit per site
     struct CoverageArrays
     {
       llvm::GlobalVariable &global;
       llvm::AllocaInst &local;
     };
 
-    CoverageArrays prepareFunction(llvm::Function &, unsigned, const SilentInternalOption &, llvm::DIBuilder &debugBuilder);
-    void insertArrayStoreInsts(const CoverageArrays &, unsigned, llvm::IRBuilder<> &) const;
+    CoverageArrays prepareFunction(llvm::Function &, unsigned, const Options &, llvm::DIBuilder &debugBuilder);
+    void insertArrayStoreInsts(const CoverageArrays &, unsigned, llvm::IRBuilder<> &);
 
     std::string indexToLabel(unsigned int index) const;
 
@@ -0,0 +1,35 @@
+//===------------------------ LocalMaskOption.cpp -------------------------===//
+//
+// A simple class encapsulating the flag that keeps a local coverage pass's
+// local array as bits of one integer, for functions with few enough sites.
+//
+//===----------------------------------------------------------------------===//
+//
+// Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+#include "CoveragePassNames.h"
+#include "LocalMaskOption.h"
+#include "optionName.h"
+
+using namespace llvm;
+using namespace std;
+
+
+csi_inst::LocalMaskOption::LocalMaskOption(const CoveragePassNames &names)
+  : flag(names.lowerShort + "-local-mask"),
+    description("Keep local " + names.lowerFull + " coverage as the bits of a single integer, rather than as an array of bytes, in functions with at most 64 " + names.lowerFull + " coverage sites"),
+    option(optionName(flag), cl::desc(description.c_str()))
+{
+}
@@ -79,7 +79,8 @@ NaiveOptimizationGraph::NaiveOptimizationGraph() : CoverageOptimizationGraph() {
 
 NaiveOptimizationGraph::NaiveOptimizationGraph(
      llvm::Function* F,
-     const llvm::BlockFrequencyInfo& bf) : CoverageOptimizationGraph(F, bf) {
+     const llvm::BlockFrequencyInfo& bf,
+     const llvm::LoopInfo* loops) : CoverageOptimizationGraph(F, bf, loops) {
   // nothing more to do
 }
 
@@ -45,8 +45,10 @@ private:
 public:
   // constructor for an empty graph
   NaiveOptimizationGraph();
-  // constructor from an LLVM function and block frequency info
-  NaiveOptimizationGraph(llvm::Function* F, const llvm::BlockFrequencyInfo& bf);
+  // constructor from an LLVM function and block frequency info, and (for
+  // loop-aware costs) loop info
+  NaiveOptimizationGraph(llvm::Function* F, const llvm::BlockFrequencyInfo& bf,
+                         const llvm::LoopInfo* loops = NULL);
   // TODO: constructor from an LLVM function, with unit costs
   ~NaiveOptimizationGraph();
 
@@ -44,6 +44,10 @@
 #include "llvm_proxy/Instructions.h"
 #include "llvm_proxy/TypeBuilder.h"
 
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <new>
 #include <queue>
 #include <string>
 #include <utility>
@@ -57,6 +61,11 @@ BasicBlock* PPBallLarusNode::getBlock() {
   return(_basicBlock);
 }
 
+// Returns the dense index of this node within its DAG.
+unsigned PPBallLarusNode::getIndex() const {
+  return(_index);
+}
+
 // Returns the number of paths to the exit starting at the node.
 unsigned long PPBallLarusNode::getNumberPaths() {
   return(_numberPaths);
@@ -113,22 +122,48 @@ unsigned PPBallLarusNode::getNumberSuccEdges() {
 
 // Add an edge to the predecessor list.
 void PPBallLarusNode::addPredEdge(PPBallLarusEdge* edge) {
+  edge->_predSlot = _predEdges.size();
   _predEdges.push_back(edge);
 }
 
 // Remove an edge from the predecessor list.
 void PPBallLarusNode::removePredEdge(PPBallLarusEdge* edge) {
-  removeEdge(_predEdges, edge);
+  removeEdge(_predEdges, edge, &PPBallLarusEdge::_predSlot);
 }
 
 // Add an edge to the successor list.
 void PPBallLarusNode::addSuccEdge(PPBallLarusEdge* edge) {
+  edge->_succSlot = _succEdges.size();
   _succEdges.push_back(edge);
 }
 
 // Remove an edge from the successor list.
 void PPBallLarusNode::removeSuccEdge(PPBallLarusEdge* edge) {
-  removeEdge(_succEdges, edge);
+  removeEdge(_succEdges, edge, &PPBallLarusEdge::_succSlot);
+}
+
+// Remove every edge whose index is marked from both edge lists, keeping the
+// remaining edges in order.
+void PPBallLarusNode::removeMarkedEdges(const std::vector<bool>& marked) {
+  unsigned kept = 0;
+  for(unsigned i = 0; i < _succEdges.size(); ++i) {
+    PPBallLarusEdge* edge = _succEdges[i];
+    if(marked[edge->getIndex()])
+      continue;
+    edge->_succSlot = kept;
+    _succEdges[kept++] = edge;
+  }
+  _succEdges.resize(kept);
+
+  kept = 0;
+  for(unsigned i = 0; i < _predEdges.size(); ++i) {
+    PPBallLarusEdge* edge = _predEdges[i];
+    if(marked[edge->getIndex()])
+      continue;
+    edge->_predSlot = kept;
+    _predEdges[kept++] = edge;
+  }
+  _predEdges.resize(kept);
 }
 
 // Returns the name of the BasicBlock being represented.  If BasicBlock
@@ -149,19 +184,22 @@ std::string PPBallLarusNode::getName() {
   return name.str();
 }
 
-// Removes an edge from an edgeVector.  Used by removePredEdge and
-// removeSuccEdge.
-void PPBallLarusNode::removeEdge(PPBLEdgeVector& v, PPBallLarusEdge* e) {
-  // TODO: Avoid linear scan by using a set instead
-  for(PPBLEdgeIterator i = v.begin(),
-        end = v.end();
-      i != end;
-      ++i) {
-    if((*i) == e) {
-      v.erase(i);
-      break;
-    }
-  }
+// Removes an edge from an edgeVector, given where the edge records its
+// position in that vector.  The last edge moves into the vacated position.
+// Used by removePredEdge and removeSuccEdge.
+void PPBallLarusNode::removeEdge(PPBLEdgeVector& v, PPBallLarusEdge* e,
+                                 unsigned PPBallLarusEdge::* slot) {
+  assert(e->*slot < v.size() && v[e->*slot] == e &&
+         "Removing an edge that is not in the list");
+  PPBallLarusEdge* last = v.back();
+  v[e->*slot] = last;
+  last->*slot = e->*slot;
+  v.pop_back();
+}
+
+// Returns the dense index of this edge within its DAG.
+unsigned PPBallLarusEdge::getIndex() const {
+  return(_index);
 }
 
 // Returns the source node of this edge.
@@ -250,24 +288,38 @@ void PPBallLarusDag::init() {
   addEdge(getExit(),getRoot(),0);
 }
 
-// Frees all memory associated with the DAG.
+// Frees all memory associated with the DAG.  The arena itself is freed
+// when _allocator is destroyed.
 PPBallLarusDag::~PPBallLarusDag() {
   for(PPBLEdgeIterator edge = _edges.begin(), end = _edges.end(); edge != end;
       ++edge)
-    delete (*edge);
+    (*edge)->~PPBallLarusEdge();
 
   for(PPBLNodeIterator node = _nodes.begin(), end = _nodes.end(); node != end;
       ++node)
-    delete (*node);
+    (*node)->~PPBallLarusNode();
 }
 
 // Calculate the path numbers by assigning edge increments as prescribed
-// in Ball-Larus path profiling.
+// in Ball-Larus path profiling.  A node is queued once, when the last of its
+// successors has been numbered, so each node and edge is visited once.
 void PPBallLarusDag::calculatePathNumbers() {
   PPBallLarusNode* node;
   std::queue<PPBallLarusNode*> bfsQueue;
   bfsQueue.push(getExit());
 
+  // the successors of each node that are not yet numbered
+  std::vector<unsigned> unnumberedSuccs(_nodes.size(), 0);
+  for(PPBLNodeIterator n = _nodes.begin(), end = _nodes.end(); n != end;
+      ++n) {
+    for(PPBLEdgeIterator succ = (*n)->succBegin(), succEnd = (*n)->succEnd();
+        succ != succEnd; ++succ) {
+      if( (*succ)->getType() != PPBallLarusEdge::BACKEDGE &&
+          (*succ)->getType() != PPBallLarusEdge::SPLITEDGE )
+        unnumberedSuccs[(*n)->getIndex()]++;
+    }
+  }
+
   while(!bfsQueue.empty()) {
     node = bfsQueue.front();
 
@@ -329,8 +381,8 @@ void PPBallLarusDag::calculatePathNumbers() {
           continue;
 
         PPBallLarusNode* nextNode = (*pred)->getSource();
-        // not yet visited?
-        if(nextNode->getNumberPaths() == 0)
+        // all successors numbered?
+        if(--unnumberedSuccs[nextNode->getIndex()] == 0)
           bfsQueue.push(nextNode);
       }
     }
@@ -339,6 +391,89 @@ void PPBallLarusDag::calculatePathNumbers() {
   DEBUG(dbgs() << "\tNumber of paths: " << getRoot()->getNumberPaths() << '\n');
 }
 
+// Cuts the DAG at chosen blocks if it has more than maxPaths paths.
+//
+// Each cut adds a path start at the root, so the regions between cuts must
+// be small enough that all of them together stay under maxPaths.  Working
+// from the exit up, any node with too many paths below it cuts whichever
+// of its successors carries the most paths until it fits.  Only blocks
+// that close a single-entry, single-exit region are cut, so that a cut
+// splits the paths through it into those before and those after, rather
+// than slicing across a region.  Loop headers need no cuts: backedges
+// already end paths there.
+void PPBallLarusDag::cutRegions(unsigned long maxPaths) {
+  PPBLNodeVector order;
+  orderBySuccessors(order);
+
+  std::vector<unsigned long> paths(_nodes.size(), 0);
+  std::vector<bool> cut(_nodes.size(), false);
+  for(PPBLNodeIterator node = order.begin(), end = order.end(); node != end;
+      ++node)
+    paths[(*node)->getIndex()] = countPaths(*node, paths, cut);
+  if(paths[getRoot()->getIndex()] <= maxPaths)
+    return;
+
+  const unsigned long regionPaths =
+    std::max(maxPaths / (unsigned long)(_edges.size() + 1), 1UL);
+  std::vector<bool> joins;
+  markRegionJoins(order, joins);
+  DEBUG(dbgs() << "Cutting DAG for function "
+               << getFunction().getName().str() << " into regions of at most "
+               << regionPaths << " paths\n");
+
+  for(PPBLNodeIterator node = order.begin(), end = order.end(); node != end;
+      ++node) {
+    unsigned long numberPaths = countPaths(*node, paths, cut);
+    while(*node != getRoot() && numberPaths > regionPaths) {
+      PPBallLarusNode* heaviest = NULL;
+      for(PPBLEdgeIterator succ = (*node)->succBegin(),
+          succEnd = (*node)->succEnd(); succ != succEnd; ++succ) {
+        PPBallLarusNode* target = (*succ)->getTarget();
+        if((*succ)->getType() == PPBallLarusEdge::BACKEDGE ||
+           (*succ)->getType() == PPBallLarusEdge::SPLITEDGE ||
+           !joins[target->getIndex()] || cut[target->getIndex()])
+          continue;
+        if(!heaviest ||
+           paths[target->getIndex()] > paths[heaviest->getIndex()])
+          heaviest = target;
+      }
+
+      // a node with more successors than regionPaths cannot be helped
+      if(!heaviest || paths[heaviest->getIndex()] <= 1)
+        break;
+
+      DEBUG(dbgs() << "  cut at " << heaviest->getName() << '\n');
+      cut[heaviest->getIndex()] = true;
+      _cutNodes.push_back(heaviest);
+      numberPaths = countPaths(*node, paths, cut);
+    }
+    paths[(*node)->getIndex()] = numberPaths;
+  }
+
+  // the split edges' phony edges turn each cut into a region of its own
+  for(PPBLNodeIterator node = _cutNodes.begin(), end = _cutNodes.end();
+      node != end; ++node) {
+    PPBLEdgeVector intoCut;
+    for(PPBLEdgeIterator pred = (*node)->predBegin(),
+        predEnd = (*node)->predEnd(); pred != predEnd; ++pred)
+      if((*pred)->getType() == PPBallLarusEdge::NORMAL)
+        intoCut.push_back(*pred);
+
+    for(PPBLEdgeIterator edge = intoCut.begin(), edgeEnd = intoCut.end();
+        edge != edgeEnd; ++edge)
+      addCutEdge(*edge);
+  }
+}
+
+// Iterator information for the blocks chosen by cutRegions().
+PPBLNodeIterator PPBallLarusDag::cutBegin() {
+  return(_cutNodes.begin());
+}
+
+PPBLNodeIterator PPBallLarusDag::cutEnd() {
+  return(_cutNodes.end());
+}
+
 // Returns the number of paths for the Dag.
 unsigned long PPBallLarusDag::getNumberOfPaths() {
   return(getRoot()->getNumberPaths());
@@ -471,25 +606,26 @@ void PPBallLarusDag::calculatePathNumbersFrom(PPBallLarusNode* node) {
 
 // Allows subclasses to determine which type of Node is created.
 // Override this method to produce subclasses of PPBallLarusNode if
-// necessary. The destructor of PPBallLarusDag will call free on each
-// pointer created.
+// necessary.  Nodes must be allocated from _allocator; the destructor of
+// PPBallLarusDag destroys each one and then frees the whole arena.
 PPBallLarusNode* PPBallLarusDag::createNode(BasicBlock* BB) {
-  return( new PPBallLarusNode(BB) );
+  return( new (_allocator.Allocate<PPBallLarusNode>()) PPBallLarusNode(BB) );
 }
 
 // Allows subclasses to determine which type of Edge is created.
 // Override this method to produce subclasses of PPBallLarusEdge if
-// necessary. The destructor of PPBallLarusDag will call free on each
-// pointer created.
+// necessary.  Edges must be allocated from _allocator, as for createNode.
 PPBallLarusEdge* PPBallLarusDag::createEdge(PPBallLarusNode* source,
                                         PPBallLarusNode* target,
                                         unsigned duplicateCount) {
-  return( new PPBallLarusEdge(source, target, duplicateCount) );
+  return( new (_allocator.Allocate<PPBallLarusEdge>())
+          PPBallLarusEdge(source, target, duplicateCount) );
 }
 
 // Proxy to node's constructor.  Updates the DAG state.
 PPBallLarusNode* PPBallLarusDag::addNode(BasicBlock* BB) {
   PPBallLarusNode* newNode = createNode(BB);
+  newNode->_index = _nodes.size();
   _nodes.push_back(newNode);
   return( newNode );
 }
@@ -499,12 +635,31 @@ PPBallLarusEdge* PPBallLarusDag::addEdge(PPBallLarusNode* source,
                                      PPBallLarusNode* target,
                                      unsigned duplicateCount) {
   PPBallLarusEdge* newEdge = createEdge(source, target, duplicateCount);
+  newEdge->_index = _edges.size();
   _edges.push_back(newEdge);
   source->addSuccEdge(newEdge);
   target->addPredEdge(newEdge);
   return(newEdge);
 }
 
+// Removes the given edges from their sources' successor lists and their
+// targets' predecessor lists, keeping all other edges in order.
+void PPBallLarusDag::unlinkEdges(const PPBLEdgeVector& edges) {
+  std::vector<bool> marked(_edges.size(), false);
+  std::vector<bool> touched(_nodes.size(), false);
+  for(PPBLEdgeVector::const_iterator edge = edges.begin(), end = edges.end();
+      edge != end; ++edge) {
+    marked[(*edge)->getIndex()] = true;
+    touched[(*edge)->getSource()->getIndex()] = true;
+    touched[(*edge)->getTarget()->getIndex()] = true;
+  }
+
+  for(PPBLNodeIterator node = _nodes.begin(), end = _nodes.end(); node != end;
+      ++node)
+    if(touched[(*node)->getIndex()])
+      (*node)->removeMarkedEdges(marked);
+}
+
 // Adds a backedge with its phony edges. Updates the DAG state.
 void PPBallLarusDag::addBackedge(PPBallLarusNode* source, PPBallLarusNode* target,
                                unsigned duplicateCount) {
@@ -522,6 +677,173 @@ void PPBallLarusDag::addBackedge(PPBallLarusNode* source, PPBallLarusNode* targe
   _backEdges.push_back(childEdge);
 }
 
+// Lists the nodes reachable from the root so that every node comes after
+// all of its successors in the DAG.
+void PPBallLarusDag::orderBySuccessors(PPBLNodeVector& order) {
+  std::vector<bool> visited(_nodes.size(), false);
+  std::stack<std::pair<PPBallLarusNode*, PPBLEdgeIterator> > dfsStack;
+
+  visited[getRoot()->getIndex()] = true;
+  dfsStack.push(std::make_pair(getRoot(), getRoot()->succBegin()));
+  while(!dfsStack.empty()) {
+    PPBallLarusNode* node = dfsStack.top().first;
+    PPBLEdgeIterator& succ = dfsStack.top().second;
+
+    // the exit->root edge is the only edge out of the exit
+    if(node == getExit() || succ == node->succEnd()) {
+      order.push_back(node);
+      dfsStack.pop();
+      continue;
+    }
+
+    PPBallLarusEdge* edge = *succ++;
+    PPBallLarusNode* target = edge->getTarget();
+    if(edge->getType() != PPBallLarusEdge::BACKEDGE &&
+       edge->getType() != PPBallLarusEdge::SPLITEDGE &&
+       !visited[target->getIndex()]) {
+      visited[target->getIndex()] = true;
+      dfsStack.push(std::make_pair(target, target->succBegin()));
+    }
+  }
+}
+
+// Finds the nearest common ancestor of a and b in a dominator tree given by
+// parent, in which every node ranks below its parent.
+static PPBallLarusNode* commonDominator(PPBallLarusNode* a,
+                                        PPBallLarusNode* b,
+                                  const std::vector<PPBallLarusNode*>& parent,
+                                  const std::vector<unsigned>& rank) {
+  while(a != b) {
+    while(rank[a->getIndex()] < rank[b->getIndex()])
+      a = parent[a->getIndex()];
+    while(rank[b->getIndex()] < rank[a->getIndex()])
+      b = parent[b->getIndex()];
+  }
+  return(a);
+}
+
+// A node closes a single-entry, single-exit region if it postdominates its
+// immediate dominator: every path through the dominator then also passes
+// through the node.  The DAG is acyclic, so one pass in topological order
+// finds each dominator (and one in reverse, each postdominator), as in
+// Cooper, Harvey, and Kennedy's "A Simple, Fast Dominance Algorithm".
+void PPBallLarusDag::markRegionJoins(const PPBLNodeVector& order,
+                                     std::vector<bool>& joins) {
+  // dominators come after a node in order, and postdominators before it
+  std::vector<unsigned> rank(_nodes.size(), 0);
+  std::vector<unsigned> reverseRank(_nodes.size(), 0);
+  for(unsigned i = 0; i < order.size(); ++i) {
+    rank[order[i]->getIndex()] = i;
+    reverseRank[order[i]->getIndex()] = order.size() - i;
+  }
+
+  std::vector<PPBallLarusNode*> idom(_nodes.size(), NULL);
+  idom[getRoot()->getIndex()] = getRoot();
+  for(PPBLNodeVector::const_reverse_iterator node = order.rbegin(),
+      end = order.rend(); node != end; ++node) {
+    if(*node == getRoot())
+      continue;
+    PPBallLarusNode* dominator = NULL;
+    for(PPBLEdgeIterator pred = (*node)->predBegin(),
+        predEnd = (*node)->predEnd(); pred != predEnd; ++pred) {
+      PPBallLarusNode* source = (*pred)->getSource();
+      if((*pred)->getType() == PPBallLarusEdge::BACKEDGE ||
+         (*pred)->getType() == PPBallLarusEdge::SPLITEDGE ||
+         !idom[source->getIndex()])
+        continue;
+      dominator = dominator ? commonDominator(dominator, source, idom, rank)
+                            : source;
+    }
+    idom[(*node)->getIndex()] = dominator;
+  }
+
+  std::vector<PPBallLarusNode*> ipdom(_nodes.size(), NULL);
+  ipdom[getExit()->getIndex()] = getExit();
+  for(PPBLNodeVector::const_iterator node = order.begin(), end = order.end();
+      node != end; ++node) {
+    if(*node == getExit())
+      continue;
+    PPBallLarusNode* postdominator = NULL;
+    for(PPBLEdgeIterator succ = (*node)->succBegin(),
+        succEnd = (*node)->succEnd(); succ != succEnd; ++succ) {
+      PPBallLarusNode* target = (*succ)->getTarget();
+      if((*succ)->getType() == PPBallLarusEdge::BACKEDGE ||
+         (*succ)->getType() == PPBallLarusEdge::SPLITEDGE ||
+         !ipdom[target->getIndex()])
+        continue;
+      postdominator = postdominator ?
+        commonDominator(postdominator, target, ipdom, reverseRank) : target;
+    }
+    ipdom[(*node)->getIndex()] = postdominator;
+  }
+
+  joins.assign(_nodes.size(), false);
+  for(PPBLNodeVector::const_iterator node = order.begin(), end = order.end();
+      node != end; ++node) {
+    if(*node == getRoot() || *node == getExit() ||
+       !idom[(*node)->getIndex()])
+      continue;
+    PPBallLarusNode* after = idom[(*node)->getIndex()];
+    while(after && after != *node && after != getExit())
+      after = ipdom[after->getIndex()];
+    joins[(*node)->getIndex()] = after == *node;
+  }
+}
+
+// Estimates the number of paths from node to the exit, given estimates for
+// its successors, if every edge into a node in cut ends a path.  The root
+// also starts a path at each cut block for every edge into it.  Sums
+// saturate at ULONG_MAX rather than overflowing.
+unsigned long PPBallLarusDag::countPaths(PPBallLarusNode* node,
+                             const std::vector<unsigned long>& paths,
+                             const std::vector<bool>& cut) {
+  if(node == getExit())
+    return(1);
+
+  unsigned long sumPaths = 0;
+  for(PPBLEdgeIterator succ = node->succBegin(), end = node->succEnd();
+      succ != end; ++succ) {
+    if( (*succ)->getType() == PPBallLarusEdge::BACKEDGE ||
+        (*succ)->getType() == PPBallLarusEdge::SPLITEDGE )
+      continue;
+
+    PPBallLarusNode* target = (*succ)->getTarget();
+    const unsigned long targetPaths =
+      cut[target->getIndex()] ? 1 : paths[target->getIndex()];
+    sumPaths = std::min(sumPaths, ULONG_MAX - targetPaths) + targetPaths;
+  }
+
+  if(node == getRoot()) {
+    for(PPBLNodeIterator i = _cutNodes.begin(), end = _cutNodes.end();
+        i != end; ++i) {
+      for(PPBLEdgeIterator pred = (*i)->predBegin(), predEnd = (*i)->predEnd();
+          pred != predEnd; ++pred) {
+        if((*pred)->getType() != PPBallLarusEdge::NORMAL)
+          continue;
+        const unsigned long cutPaths = paths[(*i)->getIndex()];
+        sumPaths = std::min(sumPaths, ULONG_MAX - cutPaths) + cutPaths;
+      }
+    }
+  }
+
+  return(sumPaths);
+}
+
+// Turns a forward edge into a split edge with its phony edges.  Updates the
+// DAG state.
+void PPBallLarusDag::addCutEdge(PPBallLarusEdge* edge) {
+  edge->setType(PPBallLarusEdge::SPLITEDGE);
+
+  edge->setPhonyRoot(addEdge(getRoot(), edge->getTarget(), 0));
+  edge->setPhonyExit(addEdge(edge->getSource(), getExit(), 0));
+
+  edge->getPhonyRoot()->setRealEdge(edge);
+  edge->getPhonyRoot()->setType(PPBallLarusEdge::SPLITEDGE_PHONY);
+
+  edge->getPhonyExit()->setRealEdge(edge);
+  edge->getPhonyExit()->setType(PPBallLarusEdge::SPLITEDGE_PHONY);
+}
+
 bool PPBallLarusDag::error_edgeOverflow(){
   return this->_errorEdgeOverflow;
 }
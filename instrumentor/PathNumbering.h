@@ -41,7 +41,9 @@
 
 #include "llvm_proxy/CFG.h"
 
-#include <map>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Support/Allocator.h>
+
 #include <stack>
 #include <vector>
 
@@ -55,7 +57,7 @@ typedef std::vector<PPBallLarusNode*> PPBLNodeVector;
 typedef std::vector<PPBallLarusNode*>::iterator PPBLNodeIterator;
 typedef std::vector<PPBallLarusEdge*> PPBLEdgeVector;
 typedef std::vector<PPBallLarusEdge*>::iterator PPBLEdgeIterator;
-typedef std::map<llvm::BasicBlock*, PPBallLarusNode*> PPBLBlockNodeMap;
+typedef llvm::DenseMap<llvm::BasicBlock*, PPBallLarusNode*> PPBLBlockNodeMap;
 typedef std::stack<PPBallLarusNode*> PPBLNodeStack;
 
 // Represents a basic block with information necessary for the BallLarus
@@ -66,7 +68,7 @@ public:
 
   // Constructor: Initializes a new Node for the given BasicBlock
   PPBallLarusNode(llvm::BasicBlock* BB) :
-    _basicBlock(BB), _numberPaths(0), _color(WHITE) {
+    _basicBlock(BB), _numberPaths(0), _color(WHITE), _index(0) {
     static unsigned nextUID = 0;
     _uid = nextUID++;
   }
@@ -74,6 +76,10 @@ public:
   // Returns the basic block for the PPBallLarusNode
   llvm::BasicBlock* getBlock();
 
+  // Returns the dense index of this node within its DAG (its position in
+  // the DAG's node list).
+  unsigned getIndex() const;
+
   // Get/set the number of paths to the exit starting at the node.
   unsigned long getNumberPaths();
   void setNumberPaths(unsigned long numberPaths);
@@ -97,15 +103,21 @@ public:
   // Add an edge to the predecessor list.
   void addPredEdge(PPBallLarusEdge* edge);
 
-  // Remove an edge from the predecessor list.
+  // Remove an edge from the predecessor list in constant time.  The last
+  // predecessor edge takes its place.
   void removePredEdge(PPBallLarusEdge* edge);
 
   // Add an edge to the successor list.
   void addSuccEdge(PPBallLarusEdge* edge);
 
-  // Remove an edge from the successor list.
+  // Remove an edge from the successor list in constant time.  The last
+  // successor edge takes its place.
   void removeSuccEdge(PPBallLarusEdge* edge);
 
+  // Remove every edge whose index is marked from both edge lists, keeping
+  // the remaining edges in order.
+  void removeMarkedEdges(const std::vector<bool>& marked);
+
   // Returns the name of the BasicBlock being represented.  If BasicBlock
   // is null then returns "<null>".  If BasicBlock has no name, then
   // "<unnamed>" is returned.  Intended for use with debug output.
@@ -130,9 +142,15 @@ private:
   // Unique ID to ensure naming difference with dotgraphs
   unsigned _uid;
 
-  // Removes an edge from an edgeVector.  Used by removePredEdge and
-  // removeSuccEdge.
-  void removeEdge(PPBLEdgeVector& v, PPBallLarusEdge* e);
+  // Position in the DAG's node list.  Set by the DAG.
+  unsigned _index;
+
+  // Removes an edge from an edgeVector, given where the edge records its
+  // position in that vector.  Used by removePredEdge and removeSuccEdge.
+  void removeEdge(PPBLEdgeVector& v, PPBallLarusEdge* e,
+                  unsigned PPBallLarusEdge::* slot);
+
+  friend class PPBallLarusDag;
 };
 
 // Represents an edge in the Dag.  For an edge, v -> w, v is the source, and
@@ -146,7 +164,13 @@ public:
   PPBallLarusEdge(PPBallLarusNode* source, PPBallLarusNode* target,
                                 unsigned duplicateNumber)
     : _source(source), _target(target), _weight(0), _edgeType(NORMAL),
-      _realEdge(NULL), _duplicateNumber(duplicateNumber) {}
+      _phonyRoot(NULL), _phonyExit(NULL), _realEdge(NULL),
+      _duplicateNumber(duplicateNumber), _index(0),
+      _succSlot(0), _predSlot(0) {}
+
+  // Returns the dense index of this edge within its DAG (its position in
+  // the DAG's edge list).
+  unsigned getIndex() const;
 
   // Returns the source/ target node of this edge.
   PPBallLarusNode* getSource() const;
@@ -198,11 +222,12 @@ private:
 
   // For backedges and split-edges, the phony edge which is linked to the
   // root node of the DAG. This contains a path number initialization.
+  // Otherwise, this is null.
   PPBallLarusEdge* _phonyRoot;
 
   // For backedges and split-edges, the phony edge which is linked to the
   // exit node of the DAG. This contains a path counter increment, and
-  // potentially a path number increment.
+  // potentially a path number increment.  Otherwise, this is null.
   PPBallLarusEdge* _phonyExit;
 
   // If this is a phony edge, _realEdge is a link to the back or split
@@ -212,6 +237,17 @@ private:
   // An ID to differentiate between those edges which have the same source
   // and destination blocks.
   unsigned _duplicateNumber;
+
+  // Position in the DAG's edge list.  Set by the DAG.
+  unsigned _index;
+
+  // Positions in the source's successor list and the target's predecessor
+  // list, so that the edge can be removed from either in constant time.
+  unsigned _succSlot;
+  unsigned _predSlot;
+
+  friend class PPBallLarusNode;
+  friend class PPBallLarusDag;
 };
 
 // Represents the Ball Larus DAG for a given Function.  Can calculate
@@ -232,6 +268,17 @@ public:
   // Frees all memory associated with the DAG.
   virtual ~PPBallLarusDag();
 
+  // Cuts the DAG at chosen blocks if it has more than maxPaths paths.
+  // Every forward edge into a cut block ends the current path and starts a
+  // new one at the block, just as a backedge does at a loop header, so
+  // paths are numbered per region between cuts.  Must be called after
+  // init() and before calculatePathNumbers().
+  void cutRegions(unsigned long maxPaths);
+
+  // Iterator information for the blocks chosen by cutRegions().
+  PPBLNodeIterator cutBegin();
+  PPBLNodeIterator cutEnd();
+
   // Calculate the path numbers by assigning edge increments as prescribed
   // in Ball-Larus path profiling.
   void calculatePathNumbers();
@@ -264,18 +311,24 @@ protected:
   // All backedges in the DAG.
   PPBLEdgeVector _backEdges;
 
+  // All nodes chosen as cut points by cutRegions().
+  PPBLNodeVector _cutNodes;
+
+  // Storage for all nodes and edges, freed together with the DAG.
+  llvm::BumpPtrAllocator _allocator;
+
   // Allows subclasses to determine which type of Node is created.
   // Override this method to produce subclasses of PPBallLarusNode if
-  // necessary. The destructor of PPBallLarusDag will call free on each pointer
-  // created.
+  // necessary.  Nodes must be allocated from _allocator; the destructor of
+  // PPBallLarusDag destroys each one and then frees the whole arena.
   virtual PPBallLarusNode* createNode(llvm::BasicBlock* BB);
 
   // Allows subclasses to determine which type of Edge is created.
   // Override this method to produce subclasses of PPBallLarusEdge if
   // necessary.  Parameters source and target will have been created by
   // createNode and can be cast to the subclass of PPBallLarusNode*
-  // returned by createNode. The destructor of PPBallLarusDag will call free
-  // on each pointer created.
+  // returned by createNode.  Edges must be allocated from _allocator, as
+  // for createNode.
   virtual PPBallLarusEdge* createEdge(PPBallLarusNode* source, PPBallLarusNode*
                                     target, unsigned duplicateNumber);
 
@@ -286,6 +339,11 @@ protected:
   PPBallLarusEdge* addEdge(PPBallLarusNode* source, PPBallLarusNode* target,
                          unsigned duplicateNumber);
 
+  // Removes the given edges from their sources' successor lists and their
+  // targets' predecessor lists, keeping all other edges in order.  Takes
+  // time linear in the size of the DAG, however many edges are removed.
+  void unlinkEdges(const PPBLEdgeVector& edges);
+
 private:
   // The root (i.e. entry) node for this DAG.
   PPBallLarusNode* _root;
@@ -314,6 +372,26 @@ private:
   // Adds a backedge with its phony edges.  Updates the DAG state.
   void addBackedge(PPBallLarusNode* source, PPBallLarusNode* target,
                    unsigned duplicateCount);
+
+  // Lists the nodes reachable from the root so that every node comes after
+  // all of its successors in the DAG.
+  void orderBySuccessors(PPBLNodeVector& order);
+
+  // Marks (by node index) each node that closes a single-entry,
+  // single-exit region of the DAG, given the order from
+  // orderBySuccessors().
+  void markRegionJoins(const PPBLNodeVector& order, std::vector<bool>& joins);
+
+  // Estimates the number of paths from node to the exit, given estimates
+  // for its successors (by node index), if every edge into a node marked
+  // in cut ends a path.
+  unsigned long countPaths(PPBallLarusNode* node,
+                           const std::vector<unsigned long>& paths,
+                           const std::vector<bool>& cut);
+
+  // Turns a forward edge into a split edge with its phony edges.  Updates
+  // the DAG state.
+  void addCutEdge(PPBallLarusEdge* edge);
 };
 } // end csi_inst namespace
 
@@ -34,12 +34,16 @@
 #define DEBUG_TYPE "path-tracing"
 
 #include "BBCoverage.h"
+#include "ExtrinsicCalls.h"
 #include "PathTracing.h"
 #include "PrepareCSI.h"
 #include "Utils.hpp"
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-parameter"
+#include <llvm/Analysis/BlockFrequencyInfo.h>
+#include <llvm/Analysis/BranchProbabilityInfo.h>
+#include <llvm/Analysis/LoopInfo.h>
 #include <llvm/Transforms/Utils/Cloning.h>
 #include <llvm/Support/Debug.h>
 #include <llvm/Support/CommandLine.h>
@@ -50,13 +54,20 @@
 
 #include "Versions.h"
 #include "llvm_proxy/DIBuilder.h"
+#include "llvm_proxy/Dominators.h"
+#include "llvm_proxy/IRBuilder.h"
 #include "llvm_proxy/Module.h"
 #include "llvm_proxy/InstIterator.h"
 #include "llvm_proxy/IntrinsicInst.h"
 
+#include "csi-rt.h"
+
+#include <algorithm>
 #include <climits>
 #include <iostream>
+#include <limits>
 #include <list>
+#include <new>
 #include <set>
 
 using namespace csi_inst;
@@ -66,6 +77,13 @@ using namespace std;
 unsigned long HASH_THRESHHOLD;
 unsigned int PATHS_SIZE;
 
+// The most loop nesting levels that each get their own PATHS_SIZE slots
+static const unsigned MAX_PATHS_DEPTH = 4;
+
+// The most slots in a hash table sized from its function's path count
+// (each slot takes 16 bytes of the function's frame)
+static const unsigned MAX_HASH_SLOTS = 256;
+
 // a special argument parser for unsigned longs
 class ULongParser : public cl::parser<unsigned long> {
 public:
@@ -98,15 +116,71 @@ static cl::opt<bool> NoArrayWrites("pt-no-array-writes", cl::Hidden,
 
 static cl::opt<unsigned long, false, ULongParser> HashSize("pt-hash-size",
                                   cl::desc("Set the maximum acyclic path count "
-                                  "to instrument per function. "
+                                  "to trace in a circular array per function; "
+                                  "larger functions use a direct-mapped hash "
+                                  "table, in which colliding paths evict each "
+                                  "other. "
                                   "Default: ULONG_MAX / 2 - 1"),
                                   cl::value_desc("hash_size"));
 
 static cl::opt<int> ArraySize("pt-path-array-size", cl::desc("Set the size "
                                   "of the paths array for instrumented "
-                                  "functions.  Default: 10"),
+                                  "functions.  Default: chosen per function"),
                                   cl::value_desc("path_array_size"));
 
+static cl::opt<bool> SSATracker("pt-ssa-tracker", cl::desc("Keep the current "
+                                "path number in an SSA register rather than "
+                                "a volatile local, flushing it to the local "
+                                "only before calls"));
+
+static cl::opt<bool> SelectIncrements("pt-select-increments", cl::desc("Compute "
+                                      "path number increments for branches "
+                                      "and small switches before the "
+                                      "terminator rather than by splitting "
+                                      "critical edges"));
+
+static cl::opt<bool> CutRegions("pt-cut-regions", cl::desc("Cut functions "
+                                "with more acyclic paths than the hash size "
+                                "into regions traced in order, rather than "
+                                "storing their paths in a hash table"));
+
+static cl::opt<bool> NarrowPaths("pt-narrow-paths", cl::desc("Use the "
+                                 "narrowest integer type (8, 16, 32, or 64 "
+                                 "bits) that holds each function's path "
+                                 "numbers for its path tracker, increments, "
+                                 "and path array"));
+
+static cl::opt<bool> TailCalls("pt-tail-calls", cl::desc("Complete each "
+                               "function's last path before a call in tail "
+                               "position, rather than after it, so the call "
+                               "stays a tail call; the path is also recorded "
+                               "in a per-thread buffer of tail calls"));
+
+static cl::opt<bool> RunLength("pt-run-length", cl::desc("Fold consecutive "
+                               "completions of the same path into a single "
+                               "(path, count) entry of the path array"));
+
+static cl::opt<bool> Ring("pt-ring", cl::desc("Commit each completed path, "
+                          "with its function's ID, to a per-thread ring kept "
+                          "by the CSI runtime library, rather than to a path "
+                          "array in each frame"));
+
+enum SpanningTreeStyle {
+  DFS_TREE, FREQUENCY_TREE
+};
+static cl::opt<SpanningTreeStyle> SpanningTree("pt-spanning-tree",
+                               cl::desc("How to choose the uninstrumented "
+                                        "spanning tree edges"),
+                               cl::init(DFS_TREE),
+                               cl::values(
+                                 clEnumValN(DFS_TREE, "dfs",
+                                            "(default) any depth-first tree"),
+                                 clEnumValN(FREQUENCY_TREE, "frequency",
+                                            "maximum spanning tree by block "
+                                            "frequency and branch probability")
+                                 CL_ENUM_VAL_END
+                               ));
+
 static cl::opt<string> TrackerFile("pt-info-file", cl::desc("The path to "
                                    "the increment-line-number output file."),
                                    cl::value_desc("file_path"));
@@ -120,7 +194,8 @@ static RegisterPass<PathTracing> X("pt-inst",
 // Creates a new BLInstrumentationNode from a BasicBlock.
 BLInstrumentationNode::BLInstrumentationNode(BasicBlock* BB) :
   PPBallLarusNode(BB),
-  _startingPathNumber(NULL), _endingPathNumber(NULL), _pathPHI(NULL){
+  _startingPathNumber(NULL), _endingPathNumber(NULL), _pathPHI(NULL),
+  _hasSelectIncrement(false){
   static unsigned nextID = 0;
   _blockId = nextID++;
 }
@@ -251,6 +326,28 @@ PPBLEdgeVector BLInstrumentationDag::getCallPhonyEdges () {
   return callEdges;
 }
 
+// Whether every call completes exactly one path
+bool BLInstrumentationDag::completesOnePath() {
+  for( PPBLEdgeIterator edge = _edges.begin(), end = _edges.end();
+       edge != end; edge++ ) {
+    if( (*edge)->getType() == PPBallLarusEdge::BACKEDGE ||
+        (*edge)->getType() == PPBallLarusEdge::SPLITEDGE )
+      return false;
+  }
+
+  return true;
+}
+
+// Iterator to the first node of the DAG
+PPBLNodeIterator BLInstrumentationDag::nodeBegin() {
+  return _nodes.begin();
+}
+
+// Iterator past the last node of the DAG
+PPBLNodeIterator BLInstrumentationDag::nodeEnd() {
+  return _nodes.end();
+}
+
 // Gets the path counter array
 Value* BLInstrumentationDag::getCounterArray() {
   return _counterArray;
@@ -313,10 +410,11 @@ void BLInstrumentationDag::splitUpdate(BLInstrumentationEdge* formerEdge,
                                        BasicBlock* newBlock) {
   PPBallLarusNode* oldTarget = formerEdge->getTarget();
   PPBallLarusNode* newNode = addNode(newBlock);
+  // the edge records its place in oldTarget's list until it is removed
+  oldTarget->removePredEdge(formerEdge);
   formerEdge->setTarget(newNode);
   newNode->addPredEdge(formerEdge);
 
-  oldTarget->removePredEdge(formerEdge);
   PPBallLarusEdge* newEdge = addEdge(newNode, oldTarget,0);
 
   if( formerEdge->getType() == PPBallLarusEdge::BACKEDGE ||
@@ -375,12 +473,105 @@ void BLInstrumentationDag::calculateSpanningTree() {
     }
   }
 
+  collectChords();
+}
+
+// Returns the representative of node i's component, halving paths as it goes.
+static unsigned findComponent(vector<unsigned>& parent, unsigned i) {
+  while(parent[i] != i) {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return(i);
+}
+
+// Orders (frequency, edge) pairs from hottest to coldest.
+static bool isHotter(const pair<double, PPBallLarusEdge*>& a,
+                     const pair<double, PPBallLarusEdge*>& b) {
+  return(a.first > b.first);
+}
+
+// Calculates a maximum-weight spanning tree of the DAG ignoring cycles
+// (Kruskal's algorithm).  Edges are weighted by estimated execution counts:
+// a CFG edge by its source's frequency scaled by the branch probability, an
+// edge into the exit by its source's frequency, and a phony edge by the
+// backedge it stands for.  The exit->root edge always carries an
+// initialization and a counter increment, so an increment there costs
+// nothing: it goes last, and so is left out of the tree as a chord.
+void BLInstrumentationDag::calculateSpanningTree(
+  const BlockFrequencyInfo& blockFreqs,
+  const BranchProbabilityInfo& branchProbs) {
+  vector<double> frequency(_edges.size(), 0.0);
+  for(PPBLEdgeIterator i = _edges.begin(), end = _edges.end(); i != end; i++) {
+    PPBallLarusEdge* edge = *i;
+    if(edge->getType() != PPBallLarusEdge::NORMAL &&
+       edge->getType() != PPBallLarusEdge::BACKEDGE &&
+       edge->getType() != PPBallLarusEdge::SPLITEDGE)
+      continue;
+
+    BasicBlock* source = edge->getSource()->getBlock();
+    BasicBlock* target = edge->getTarget()->getBlock();
+    double edgeFrequency;
+    if(!source)
+      edgeFrequency = -numeric_limits<double>::infinity();
+    else {
+      edgeFrequency = blockFreqs.getBlockFreq(source).getFrequency();
+      if(target) {
+        const BranchProbability probability =
+          branchProbs.getEdgeProbability(source, target);
+        edgeFrequency = edgeFrequency * probability.getNumerator()
+                        / probability.getDenominator();
+      }
+    }
+    frequency[edge->getIndex()] = edgeFrequency;
+
+    // phony edges execute exactly when the edge they replace does
+    if(edge->getPhonyRoot())
+      frequency[edge->getPhonyRoot()->getIndex()] = edgeFrequency;
+    if(edge->getPhonyExit())
+      frequency[edge->getPhonyExit()->getIndex()] = edgeFrequency;
+  }
+
+  vector<pair<double, PPBallLarusEdge*> > candidates;
+  for(PPBLEdgeIterator i = _edges.begin(), end = _edges.end(); i != end; i++) {
+    // Ignore split edges and backedges: neither lies on a path through the
+    // DAG, so neither may stand in for a chord
+    if((*i)->getType() == PPBallLarusEdge::SPLITEDGE ||
+       (*i)->getType() == PPBallLarusEdge::BACKEDGE)
+      continue;
+    candidates.push_back(make_pair(frequency[(*i)->getIndex()], *i));
+  }
+  stable_sort(candidates.begin(), candidates.end(), isHotter);
+
+  vector<unsigned> parent(_nodes.size());
+  for(unsigned i = 0; i < _nodes.size(); ++i)
+    parent[i] = i;
+
+  for(unsigned i = 0; i < candidates.size(); ++i) {
+    PPBallLarusEdge* edge = candidates[i].second;
+    const unsigned source = findComponent(parent, edge->getSource()->getIndex());
+    const unsigned target = findComponent(parent, edge->getTarget()->getIndex());
+    if(source != target) {
+      parent[source] = target;
+      makeEdgeSpanning((BLInstrumentationEdge*)edge);
+    }
+  }
+
+  collectChords();
+}
+
+// Collects all edges not in the spanning tree as chords.  Split edges and
+// backedges are left out: their phony edges carry their increments, and a
+// backedge that is later split becomes a normal edge whose own increment
+// must stay zero.
+void BLInstrumentationDag::collectChords() {
   for(PPBLEdgeIterator edge = _edges.begin(), end = _edges.end();
       edge != end; edge++) {
     BLInstrumentationEdge* instEdge = (BLInstrumentationEdge*) (*edge);
       // safe since createEdge is overriden
-    if(!instEdge->isInSpanningTree() && (*edge)->getType()
-        != PPBallLarusEdge::SPLITEDGE)
+    if(!instEdge->isInSpanningTree() &&
+       (*edge)->getType() != PPBallLarusEdge::SPLITEDGE &&
+       (*edge)->getType() != PPBallLarusEdge::BACKEDGE)
       _chordEdges.push_back(instEdge);
   }
 }
@@ -406,39 +597,41 @@ void BLInstrumentationDag::pushCounters() {
 // Removes phony edges from the successor list of the source, and the
 // predecessor list of the target.
 void BLInstrumentationDag::unlinkPhony() {
-  PPBallLarusEdge* edge;
+  PPBLEdgeVector phonyEdges;
 
   for(PPBLEdgeIterator next = _edges.begin(),
       end = _edges.end(); next != end; next++) {
-    edge = (*next);
+    PPBallLarusEdge* edge = (*next);
 
     if( edge->getType() == PPBallLarusEdge::BACKEDGE_PHONY ||
         edge->getType() == PPBallLarusEdge::SPLITEDGE_PHONY ||
         edge->getType() == PPBallLarusEdge::CALLEDGE_PHONY ) {
-      unlinkEdge(edge);
+      phonyEdges.push_back(edge);
     }
   }
+
+  unlinkEdges(phonyEdges);
 }
 
 // Allows subclasses to determine which type of Node is created.
 // Override this method to produce subclasses of PPBallLarusNode if
-// necessary. The destructor of PPBallLarusDag will call free on each pointer
-// created.
+// necessary.  Nodes are allocated from the DAG's arena.
 PPBallLarusNode* BLInstrumentationDag::createNode(BasicBlock* BB) {
-  return( new BLInstrumentationNode(BB) );
+  return( new (_allocator.Allocate<BLInstrumentationNode>())
+          BLInstrumentationNode(BB) );
 }
 
 // Allows subclasses to determine which type of Edge is created.
 // Override this method to produce subclasses of PPBallLarusEdge if
-// necessary. The destructor of PPBallLarusDag will call free on each pointer
-// created.
+// necessary.  Edges are allocated from the DAG's arena.
 PPBallLarusEdge* BLInstrumentationDag::createEdge(PPBallLarusNode* source,
                                                 PPBallLarusNode* target, unsigned edgeNumber) {
   (void)edgeNumber; // suppress warning
   // One can cast from PPBallLarusNode to BLInstrumentationNode since createNode
   // is overriden to produce BLInstrumentationNode.
-  return( new BLInstrumentationEdge((BLInstrumentationNode*)source,
-                                    (BLInstrumentationNode*)target) );
+  return( new (_allocator.Allocate<BLInstrumentationEdge>())
+          BLInstrumentationEdge((BLInstrumentationNode*)source,
+                                (BLInstrumentationNode*)target) );
 }
 
 // Sets the Value corresponding to the pathNumber register, constant,
@@ -478,19 +671,19 @@ void BLInstrumentationNode::setPathPHI(PHINode* pathPHI) {
   _pathPHI = pathPHI;
 }
 
-// Get the unique ID of the node
-unsigned int BLInstrumentationNode::getNodeId() {
-  return(_blockId);
+// Whether the increments of all outgoing edges are selected in this node.
+bool BLInstrumentationNode::hasSelectIncrement() {
+  return(_hasSelectIncrement);
 }
 
-// Removes the edge from the appropriate predecessor and successor
-// lists.
-void BLInstrumentationDag::unlinkEdge(PPBallLarusEdge* edge) {
-  if(edge == getExitRootEdge())
-    DEBUG(dbgs() << " Removing exit->root edge\n");
+// Set whether the increments of all outgoing edges are selected in this node.
+void BLInstrumentationNode::setHasSelectIncrement(bool hasSelectIncrement) {
+  _hasSelectIncrement = hasSelectIncrement;
+}
 
-  edge->getSource()->removeSuccEdge(edge);
-  edge->getTarget()->removePredEdge(edge);
+// Get the unique ID of the node
+unsigned int BLInstrumentationNode::getNodeId() {
+  return(_blockId);
 }
 
 // Makes an edge part of the spanning tree.
@@ -499,15 +692,23 @@ void BLInstrumentationDag::makeEdgeSpanning(BLInstrumentationEdge* edge) {
   _treeEdges.push_back(edge);
 }
 
-// Pushes initialization and calls itself recursively.
+// Pushes initialization down along chains of single-predecessor nodes.
+// Each edge's increment moves into the edges leaving its target at most
+// once, so a worklist of edges replaces recursion.
 void BLInstrumentationDag::pushInitializationFromEdge(
   BLInstrumentationEdge* edge) {
-  PPBallLarusNode* target;
+  vector<BLInstrumentationEdge*> worklist;
+  worklist.reserve(_nodes.size());
+  worklist.push_back(edge);
+
+  while(!worklist.empty()) {
+    edge = worklist.back();
+    worklist.pop_back();
+
+    PPBallLarusNode* target = edge->getTarget();
+    if( target->getNumberPredEdges() > 1 || target == getExit() )
+      continue;
 
-  target = edge->getTarget();
-  if( target->getNumberPredEdges() > 1 || target == getExit() ) {
-    return;
-  } else {
     for(PPBLEdgeIterator next = target->succBegin(),
           end = target->succEnd(); next != end; next++) {
       BLInstrumentationEdge* intoEdge = (BLInstrumentationEdge*) *next;
@@ -521,7 +722,7 @@ void BLInstrumentationDag::pushInitializationFromEdge(
         this->_errorNegativeIncrements = true;
       intoEdge->setIncrement(increment);
       intoEdge->setIsInitialization(true);
-      pushInitializationFromEdge(intoEdge);
+      worklist.push_back(intoEdge);
     }
 
     edge->setIncrement(0);
@@ -529,15 +730,22 @@ void BLInstrumentationDag::pushInitializationFromEdge(
   }
 }
 
-// Pushes path counter increments up recursively.
+// Pushes path counter increments up along chains of single-successor nodes,
+// using a worklist of edges as for initialization.
 void BLInstrumentationDag::pushCountersFromEdge(BLInstrumentationEdge* edge) {
-  PPBallLarusNode* source;
+  vector<BLInstrumentationEdge*> worklist;
+  worklist.reserve(_nodes.size());
+  worklist.push_back(edge);
+
+  while(!worklist.empty()) {
+    edge = worklist.back();
+    worklist.pop_back();
+
+    PPBallLarusNode* source = edge->getSource();
+    if(source->getNumberSuccEdges() > 1 || source == getRoot()
+       || edge->isInitialization())
+      continue;
 
-  source = edge->getSource();
-  if(source->getNumberSuccEdges() > 1 || source == getRoot()
-     || edge->isInitialization()) {
-    return;
-  } else {
     for(PPBLEdgeIterator previous = source->predBegin(),
           end = source->predEnd(); previous != end; previous++) {
       BLInstrumentationEdge* fromEdge = (BLInstrumentationEdge*) *previous;
@@ -551,7 +759,7 @@ void BLInstrumentationDag::pushCountersFromEdge(BLInstrumentationEdge* edge) {
         this->_errorNegativeIncrements = true;
       fromEdge->setIncrement(increment);
       fromEdge->setIsCounterIncrement(true);
-      pushCountersFromEdge(fromEdge);
+      worklist.push_back(fromEdge);
     }
 
     edge->setIncrement(0);
@@ -559,36 +767,74 @@ void BLInstrumentationDag::pushCountersFromEdge(BLInstrumentationEdge* edge) {
   }
 }
 
-// Depth first algorithm for determining the chord increments.
+// One node of the spanning tree walk in calculateChordIncrementsDfs
+struct ChordIncrementFrame {
+  PPBallLarusNode* node;   // the node being visited
+  PPBallLarusEdge* edge;   // the tree edge it was reached by
+  long weight;             // the path weight carried along that edge
+  unsigned next;           // the next incident tree edge to follow
+};
+
+// Depth first algorithm for determining the chord increments.  The walk
+// over the spanning tree uses an explicit stack, and each node's incident
+// tree edges and chords are indexed up front, so it takes time linear in
+// the size of the DAG.  Chords are updated in the same (post-)order as the
+// recursive formulation in [Ball94].
 void BLInstrumentationDag::calculateChordIncrementsDfs(long weight,
                                                        PPBallLarusNode* v, PPBallLarusEdge* e) {
-  BLInstrumentationEdge* f;
-
+  vector<PPBLEdgeVector> treeEdgesAt(_nodes.size());
+  vector<PPBLEdgeVector> chordEdgesAt(_nodes.size());
   for(PPBLEdgeIterator treeEdge = _treeEdges.begin(),
         end = _treeEdges.end(); treeEdge != end; treeEdge++) {
-    f = (BLInstrumentationEdge*) *treeEdge;
-    if(e != f && v == f->getTarget()) {
-      calculateChordIncrementsDfs(
-        calculateChordIncrementsDir(e,f)*(weight) +
-        f->getWeight(), f->getSource(), f);
-    }
-    if(e != f && v == f->getSource()) {
-      calculateChordIncrementsDfs(
-        calculateChordIncrementsDir(e,f)*(weight) +
-        f->getWeight(), f->getTarget(), f);
-    }
+    treeEdgesAt[(*treeEdge)->getTarget()->getIndex()].push_back(*treeEdge);
+    treeEdgesAt[(*treeEdge)->getSource()->getIndex()].push_back(*treeEdge);
   }
-
   for(PPBLEdgeIterator chordEdge = _chordEdges.begin(),
         end = _chordEdges.end(); chordEdge != end; chordEdge++) {
-    f = (BLInstrumentationEdge*) *chordEdge;
-    if(v == f->getSource() || v == f->getTarget()) {
+    PPBallLarusNode* source = (*chordEdge)->getSource();
+    PPBallLarusNode* target = (*chordEdge)->getTarget();
+    chordEdgesAt[source->getIndex()].push_back(*chordEdge);
+    if(target != source)
+      chordEdgesAt[target->getIndex()].push_back(*chordEdge);
+  }
+
+  vector<ChordIncrementFrame> dfsStack;
+  dfsStack.reserve(_nodes.size());
+  const ChordIncrementFrame first = { v, e, weight, 0 };
+  dfsStack.push_back(first);
+
+  while(!dfsStack.empty()) {
+    ChordIncrementFrame& frame = dfsStack.back();
+    const PPBLEdgeVector& treeEdges = treeEdgesAt[frame.node->getIndex()];
+
+    // follow the next tree edge other than the one we came by
+    if(frame.next < treeEdges.size()) {
+      BLInstrumentationEdge* f = (BLInstrumentationEdge*)treeEdges[frame.next++];
+      if(f == frame.edge)
+        continue;
+      const ChordIncrementFrame child = {
+        f->getTarget() == frame.node ? f->getSource() : f->getTarget(),
+        f,
+        (long)(calculateChordIncrementsDir(frame.edge, f) * frame.weight +
+               f->getWeight()),
+        0
+      };
+      dfsStack.push_back(child);
+      continue;
+    }
+
+    // all subtrees are done: apply this node's share to its chords
+    const PPBLEdgeVector& chordEdges = chordEdgesAt[frame.node->getIndex()];
+    for(PPBLEdgeVector::const_iterator chordEdge = chordEdges.begin(),
+          end = chordEdges.end(); chordEdge != end; chordEdge++) {
+      BLInstrumentationEdge* f = (BLInstrumentationEdge*) *chordEdge;
       long increment = f->getIncrement() +
-                       calculateChordIncrementsDir(e,f)*weight;
+                       calculateChordIncrementsDir(frame.edge, f)*frame.weight;
       if(increment < 0)
         this->_errorNegativeIncrements = true;
       f->setIncrement(increment);
     }
+    dfsStack.pop_back();
   }
 }
 
@@ -618,20 +864,286 @@ ConstantInt* PathTracing::createIncrementConstant(long incr,
 // edge->getIncrement().
 ConstantInt* PathTracing::createIncrementConstant(
   BLInstrumentationEdge* edge) {
-  return(createIncrementConstant(edge->getIncrement(), 64));
+  return(createIncrementConstant(edge->getIncrement(), _pathWidth));
+}
+
+// Returns the integer type holding path numbers in the current function.
+IntegerType* PathTracing::getPathType() {
+  return(IntegerType::get(*Context, _pathWidth));
+}
+
+// Returns the narrowest width (8, 16, 32, or 64 bits) whose signed range
+// holds every path number below numPaths.  Path numbers must stay positive
+// so that they are never confused with the -1 sentinel in the path array.
+static unsigned narrowestPathWidth(unsigned long numPaths) {
+  for(unsigned width = 8; width < 64; width *= 2)
+    if(numPaths <= (1UL << (width - 1)))
+      return(width);
+  return(64);
+}
+
+// Returns the number of hash table slots for a function with numPaths paths:
+// the smallest power of two that gives each path a slot of its own if the
+// hash spreads them perfectly, up to MAX_HASH_SLOTS
+static unsigned hashSlots(unsigned long numPaths) {
+  unsigned slots = 1;
+  while(slots < MAX_HASH_SLOTS && slots < numPaths)
+    slots *= 2;
+  return(slots);
+}
+
+// Returns the deepest loop nesting of any block in F (at least 1).  Before
+// LLVM 3.9, neither the dominator tree nor the loop info has a constructor
+// that analyzes a function, so build them from their template bases.
+static unsigned maxLoopDepth(Function& F) {
+#if LLVM_VERSION < 30900
+  DominatorTreeBase<BasicBlock> domTree(false);
+  domTree.recalculate(F);
+  LoopInfoBase<BasicBlock, Loop> loops;
+#if LLVM_VERSION < 30700
+  loops.Analyze(domTree);
+#else
+  loops.analyze(domTree);
+#endif
+#else
+  DominatorTree domTree(F);
+  LoopInfo loops(domTree);
+#endif
+  unsigned depth = 1;
+  for(Function::iterator bb = F.begin(), e = F.end(); bb != e; ++bb)
+    depth = max(depth, loops.getLoopDepth(&*bb));
+  return(depth);
+}
+
+// Gets (or creates) a per-thread global for -pt-tail-calls
+static GlobalVariable* getTailGlobal(Module& M, Type* type, const char* name){
+  GlobalVariable* global = M.getGlobalVariable(name);
+  if(!global)
+    global = new GlobalVariable(M, type, false, GlobalValue::WeakAnyLinkage,
+                                Constant::getNullValue(type), name, NULL,
+#if LLVM_VERSION < 30200
+                                true
+#else
+                                GlobalVariable::GeneralDynamicTLSModel
+#endif
+                                );
+  return(global);
+}
+
+// Gets (or declares) a per-thread global of the runtime library for -pt-ring
+static GlobalVariable* getRingGlobal(Module& M, Type* type, const char* name){
+  GlobalVariable* global = M.getGlobalVariable(name);
+  if(!global)
+    global = new GlobalVariable(M, type, false, GlobalValue::ExternalLinkage,
+                                NULL, name, NULL,
+#if LLVM_VERSION < 30200
+                                true
+#else
+                                GlobalVariable::GeneralDynamicTLSModel
+#endif
+                                );
+  return(global);
+}
+
+// Appends a (function, path) pair to a per-thread circular buffer of size
+// pairs.  count holds the number of pairs ever appended, and is only bumped
+// once the pair is complete.
+static void appendPathPair(GlobalVariable* pairs, GlobalVariable* count,
+                           unsigned size, Value* function, Value* path,
+                           bool isVolatile, const string& prefix,
+                           Instruction* insertBefore){
+  IntegerType* tInt = Type::getInt64Ty(count->getContext());
+
+  LoadInst* seen = new LoadInst(count, prefix + "Count", isVolatile,
+                                insertBefore);
+  Instruction* slot = BinaryOperator::Create(Instruction::And, seen,
+                                             ConstantInt::get(tInt, size-1),
+                                             prefix + "Slot", insertBefore);
+  Instruction* fnIdx = BinaryOperator::Create(Instruction::Shl, slot,
+                                              ConstantInt::get(tInt, 1),
+                                              prefix + "FnIdx", insertBefore);
+  Instruction* pathIdx = BinaryOperator::Create(Instruction::Or, fnIdx,
+                                                ConstantInt::get(tInt, 1),
+                                                prefix + "PathIdx",
+                                                insertBefore);
+
+  Value * const fnIndices[] = {
+    Constant::getNullValue(tInt),
+    fnIdx,
+  };
+  GetElementPtrInst* fnPointer =
+    GetElementPtrInst::CreateInBounds(pairs, fnIndices, prefix + "FnLoc",
+                                      insertBefore);
+  new StoreInst(function, fnPointer, isVolatile, insertBefore);
+
+  Value * const pathIndices[] = {
+    Constant::getNullValue(tInt),
+    pathIdx,
+  };
+  GetElementPtrInst* pathPointer =
+    GetElementPtrInst::CreateInBounds(pairs, pathIndices, prefix + "PathLoc",
+                                      insertBefore);
+  new StoreInst(path, pathPointer, isVolatile, insertBefore);
+
+  Instruction* nextCount = BinaryOperator::Create(Instruction::Add, seen,
+                                                  ConstantInt::get(tInt, 1),
+                                                  prefix + "Count",
+                                                  insertBefore);
+  new StoreInst(nextCount, count, isVolatile, insertBefore);
+}
+
+// Records the completed path of a function about to make a tail call.
+// __CSI_pt_tail_paths is a per-thread circular buffer of (function address,
+// path) pairs, and __CSI_pt_tail_count counts the pairs ever written to it.
+void PathTracing::recordTailPath(Value* path, Instruction* call) {
+  Function& F = *call->getParent()->getParent();
+  Module& M = *F.getParent();
+  IntegerType* tInt = Type::getInt64Ty(*Context);
+  ArrayType* tPaths = ArrayType::get(tInt, 2*CSI_PT_TAIL_SIZE);
+  GlobalVariable* paths = getTailGlobal(M, tPaths, "__CSI_pt_tail_paths");
+  GlobalVariable* count = getTailGlobal(M, tInt, "__CSI_pt_tail_count");
+
+  if(_pathWidth != 64)
+    path = new ZExtInst(path, tInt, "tailPath", call);
+  appendPathPair(paths, count, CSI_PT_TAIL_SIZE,
+                 new PtrToIntInst(&F, tInt, "tailFn", call), path, false,
+                 "tail", call);
+}
+
+// Commits a completed path to the per-thread ring of the runtime library.
+// As in the shadow stack and the tail call buffer, the function is
+// identified by its address, which names its .debug_PT entry through the
+// executable's symbols whatever else is linked with it.
+void PathTracing::commitRingPath(Value* path, Instruction* insertBefore) {
+  Function& F = *insertBefore->getParent()->getParent();
+  Module& M = *F.getParent();
+  IntegerType* tInt = Type::getInt64Ty(*Context);
+  GlobalVariable* ring = getRingGlobal(M,
+                                       ArrayType::get(tInt, 2*CSI_PT_RING_SIZE),
+                                       "__CSI_pt_ring");
+  GlobalVariable* count = getRingGlobal(M, tInt, "__CSI_pt_ring_count");
+
+  if(_pathWidth != 64)
+    path = new ZExtInst(path, tInt, "ringPath", insertBefore);
+  appendPathPair(ring, count, CSI_PT_RING_SIZE,
+                 ConstantExpr::getPtrToInt(&F, tInt), path, true,
+                 "ring", insertBefore);
 }
 
 // Creates a counter increment in the given node.  The Value* in node is
-// taken as the index into an array or hash table.  The hash table access
-// is a call to the runtime.
+// taken as the index into an array or hash table.
+//
+// Functions with at most HASH_THRESHHOLD paths store completed paths into a
+// circular array.  Larger functions store them into a direct-mapped hash
+// table of (path, sequence) pairs, keyed by path number.  The
+// table keeps the most recent occurrence of each path that still owns its
+// slot, and the sequence numbers (counting from 1; 0 marks an empty slot)
+// give the order in which those paths completed.  Colliding paths evict
+// each other, so the table is lossy whenever two completed paths share a
+// slot, which is certain once a function has more paths than slots.
+//
+// With -pt-run-length, the circular array instead holds (path, count)
+// pairs, and the index names the most recent pair.  A path equal to that
+// pair's path just bumps its count; any other path starts a new pair.
+//
+// With -pt-ring, every path goes to the runtime library's per-thread ring
+// instead, whatever the function's number of paths.
 void PathTracing::insertCounterIncrement(Value* incValue,
                                           BasicBlock::iterator insertPoint,
                                           BLInstrumentationDag* dag) {
-  // first, find out the current location
-  LoadInst* curLoc = new LoadInst(dag->getCurIndex(), "curIdx", &*insertPoint);
-  
+  Type* tInt = Type::getInt64Ty(*Context);
+
+  // Ring of the runtime library: no per-frame storage at all
+  if( Ring )
+    commitRingPath(incValue, &*insertPoint);
+
+  // Run-length encoded array: compare against the latest pair, and either
+  // bump its count or move on to the next pair (without branching)
+  else if( _runLength ) {
+    LoadInst* curLoc = new LoadInst(dag->getCurIndex(), "curIdx",
+                                    &*insertPoint);
+    Instruction* lastIdx = BinaryOperator::Create(Instruction::Shl, curLoc,
+                                                  ConstantInt::get(tInt, 1),
+                                                  "lastLoc", &*insertPoint);
+    Value * const lastIndices[] = {
+      Constant::getNullValue(tInt),
+      lastIdx,
+    };
+    GetElementPtrInst* lastPointer =
+      GetElementPtrInst::CreateInBounds(dag->getCounterArray(), lastIndices,
+                                        "lastArrLoc", &*insertPoint);
+    LoadInst* lastPath = new LoadInst(lastPointer, "lastPath", true,
+                                      &*insertPoint);
+    Instruction* repeat = new ICmpInst(&*insertPoint, CmpInst::ICMP_EQ,
+                                       lastPath, incValue, "repeat");
+
+    // the next pair, if this path starts one
+    BinaryOperator* addLoc = BinaryOperator::Create(Instruction::Add,
+                                                    curLoc,
+                                                    ConstantInt::get(tInt, 1),
+                                                    "addLoc", &*insertPoint);
+    Instruction* atEnd = new ICmpInst(&*insertPoint, CmpInst::ICMP_EQ, curLoc,
+                               ConstantInt::get(tInt, dag->getCounterSize()-1),
+                               "atEnd");
+    Instruction* wrapLoc = SelectInst::Create(atEnd, ConstantInt::get(tInt, 0),
+                                              addLoc, "wrapLoc", &*insertPoint);
+    Instruction* nextLoc = SelectInst::Create(repeat, curLoc, wrapLoc,
+                                              "nextLoc", &*insertPoint);
+
+    Instruction* pathIdx = BinaryOperator::Create(Instruction::Shl, nextLoc,
+                                                  ConstantInt::get(tInt, 1),
+                                                  "arrIdx", &*insertPoint);
+    Instruction* countIdx = BinaryOperator::Create(Instruction::Or, pathIdx,
+                                                   ConstantInt::get(tInt, 1),
+                                                   "arrCountIdx", &*insertPoint);
+    Value * const pathIndices[] = {
+      Constant::getNullValue(tInt),
+      pathIdx,
+    };
+    GetElementPtrInst* pathPointer =
+      GetElementPtrInst::CreateInBounds(dag->getCounterArray(), pathIndices,
+                                        "arrLoc", &*insertPoint);
+    Value * const countIndices[] = {
+      Constant::getNullValue(tInt),
+      countIdx,
+    };
+    GetElementPtrInst* countPointer =
+      GetElementPtrInst::CreateInBounds(dag->getCounterArray(), countIndices,
+                                        "arrCountLoc", &*insertPoint);
+
+    // a repeated path keeps its pair's count going; a new pair starts at 1
+    LoadInst* count = new LoadInst(countPointer, "count", true, &*insertPoint);
+    BinaryOperator* bumped = BinaryOperator::Create(Instruction::Add, count,
+                                                    ConstantInt::get(tInt, 1),
+                                                    "bumped", &*insertPoint);
+    Instruction* newCount = SelectInst::Create(repeat, bumped,
+                                               ConstantInt::get(tInt, 1),
+                                               "newCount", &*insertPoint);
+
+    new StoreInst(incValue, pathPointer, true, &*insertPoint);
+    new StoreInst(newCount, countPointer, true, &*insertPoint);
+    new StoreInst(nextLoc, dag->getCurIndex(), true, &*insertPoint);
+  }
+
+  // A single-slot array never moves its index: just overwrite the slot
+  else if( dag->getNumberOfPaths() <= HASH_THRESHHOLD &&
+           dag->getCounterSize() == 1 ) {
+    Value * const gepIndices[] = {
+      Constant::getNullValue(tInt),
+      Constant::getNullValue(tInt),
+    };
+    GetElementPtrInst* pcPointer =
+      GetElementPtrInst::CreateInBounds(dag->getCounterArray(), gepIndices,
+                                        "arrLoc", &*insertPoint);
+    new StoreInst(incValue, pcPointer, true, &*insertPoint);
+  }
+
   // Counter increment for array
-  if( dag->getNumberOfPaths() <= HASH_THRESHHOLD ) {
+  else if( dag->getNumberOfPaths() <= HASH_THRESHHOLD ) {
+    // first, find out the current location
+    LoadInst* curLoc = new LoadInst(dag->getCurIndex(), "curIdx",
+                                    &*insertPoint);
+
     // Get pointer to the array location
     Value * const gepIndices[] = {
       Constant::getNullValue(Type::getInt64Ty(*Context)),
@@ -646,7 +1158,6 @@ void PathTracing::insertCounterIncrement(Value* incValue,
     new StoreInst(incValue, pcPointer, true, &*insertPoint);
     
     // update the next circular buffer location
-    Type* tInt = Type::getInt64Ty(*Context);
     BinaryOperator* addLoc = BinaryOperator::Create(Instruction::Add,
                                                     curLoc,
                                                     ConstantInt::get(tInt, 1),
@@ -658,21 +1169,193 @@ void PathTracing::insertCounterIncrement(Value* incValue,
                                               addLoc, "nextLoc", &*insertPoint);
     
     new StoreInst(nextLoc, dag->getCurIndex(), true, &*insertPoint);
-    new StoreInst(ConstantInt::get(tInt, 0), this->getPathTracker(), true,
-                  &*insertPoint);
   }
   else {
-    // Counter increment for hash would have gone here (should actually be
-    // unreachable now)
-    errs() << "ERROR: instrumentation continued in function with over-large"
-           << " path count.  This is a tool error. Results will be wrong!\n";
-    exit(1);
+    LoadInst* curLoc = new LoadInst(dag->getCurIndex(), "curIdx",
+                                    &*insertPoint);
+
+    // Counter increment for hash: multiplicative (Fibonacci) hashing
+    // spreads nearby path numbers over the table
+    Instruction* scaled = BinaryOperator::Create(Instruction::Mul, incValue,
+                                 ConstantInt::get(tInt, 0x9E3779B97F4A7C15ULL),
+                                 "pathHash", &*insertPoint);
+    Instruction* mixed = BinaryOperator::Create(Instruction::LShr, scaled,
+                                                ConstantInt::get(tInt, 32),
+                                                "pathHash", &*insertPoint);
+    Instruction* slot = BinaryOperator::Create(Instruction::URem, mixed,
+                               ConstantInt::get(tInt, dag->getCounterSize()),
+                               "hashSlot", &*insertPoint);
+    Instruction* pathIdx = BinaryOperator::Create(Instruction::Shl, slot,
+                                                  ConstantInt::get(tInt, 1),
+                                                  "hashLoc", &*insertPoint);
+    Instruction* seqIdx = BinaryOperator::Create(Instruction::Or, pathIdx,
+                                                 ConstantInt::get(tInt, 1),
+                                                 "hashSeqLoc", &*insertPoint);
+    Instruction* sequence = BinaryOperator::Create(Instruction::Add, curLoc,
+                                                   ConstantInt::get(tInt, 1),
+                                                   "nextSeq", &*insertPoint);
+
+    // Store the path and its sequence number into the slot
+    Value * const pathIndices[] = {
+      Constant::getNullValue(Type::getInt64Ty(*Context)),
+      pathIdx,
+    };
+    GetElementPtrInst* pathPointer =
+      GetElementPtrInst::CreateInBounds(dag->getCounterArray(), pathIndices,
+                                        "arrLoc", &*insertPoint);
+    new StoreInst(incValue, pathPointer, true, &*insertPoint);
+
+    Value * const seqIndices[] = {
+      Constant::getNullValue(Type::getInt64Ty(*Context)),
+      seqIdx,
+    };
+    GetElementPtrInst* seqPointer =
+      GetElementPtrInst::CreateInBounds(dag->getCounterArray(), seqIndices,
+                                        "arrSeqLoc", &*insertPoint);
+    new StoreInst(sequence, seqPointer, true, &*insertPoint);
+
+    new StoreInst(sequence, dag->getCurIndex(), true, &*insertPoint);
+  }
+
+  // A tail call reuses this frame, so keep its last path where it survives
+  // (the ring already outlives the frame)
+  if(TailCalls && !Ring && isa<CallInst>(&*insertPoint) &&
+     &*insertPoint == tailCall(*insertPoint->getParent()))
+    recordTailPath(incValue, &*insertPoint);
+
+  if(SSATracker)
+    describePathNumber(createIncrementConstant(0, _pathWidth), false,
+                       &*insertPoint);
+  else
+    new StoreInst(createIncrementConstant(0, _pathWidth),
+                  this->getPathTracker(), true, &*insertPoint);
+}
+
+// Returns the path number register Value live at the end of node.
+Value* PathTracing::getCurrentPathNumber(BLInstrumentationNode* node) {
+  if(node->getEndingPathNumber())
+    return(node->getEndingPathNumber());
+  return(createIncrementConstant(0, _pathWidth));
+}
+
+// Inserts source's ending path number into target.  Target may or may not
+// have multiple predecessors, and may or may not have its PHINode
+// initialized.
+void PathTracing::pushValueIntoNode(BLInstrumentationNode* source,
+                                    BLInstrumentationNode* target) {
+  if(target->getBlock() == NULL)
+    return;
+
+  if(target->getNumberPredEdges() <= 1) {
+    assert(target->getStartingPathNumber() == NULL &&
+           "Target already has path number");
+    target->setStartingPathNumber(source->getEndingPathNumber());
+    target->setEndingPathNumber(source->getEndingPathNumber());
+    DEBUG(dbgs() << "  Passing path number"
+          << (source->getEndingPathNumber() ? "" : " (null)")
+          << " value through.\n");
+  } else {
+    if(target->getPathPHI() == NULL) {
+      DEBUG(dbgs() << "  Initializing PHI node for block '"
+            << target->getName() << "'\n");
+      preparePHI(target);
+    }
+    pushValueIntoPHI(target, source);
+    DEBUG(dbgs() << "  Passing number value into PHI for block '"
+          << target->getName() << "'\n");
+  }
+}
+
+// Inserts source's ending path number into the PHINode of target.
+void PathTracing::pushValueIntoPHI(BLInstrumentationNode* target,
+                                   BLInstrumentationNode* source) {
+  PHINode* phi = target->getPathPHI();
+  assert(phi != NULL && "  Tried to push value into node with PHI, but node"
+         " actually had no PHI.");
+  phi->removeIncomingValue(source->getBlock(), false);
+  phi->addIncoming(getCurrentPathNumber(source), source->getBlock());
+}
+
+// Creates the PHINode for the path number register in node.  Every
+// predecessor starts out contributing zero (no path in flight); real values
+// replace these as the predecessors are instrumented.
+void PathTracing::preparePHI(BLInstrumentationNode* node) {
+  BasicBlock* block = node->getBlock();
+  const pred_iterator begin = pred_begin(block), end = pred_end(block);
+  PHINode* phi = PHINode::Create(getPathType(),
+                                 std::distance(begin, end),
+                                 "pathNumber", &*block->begin());
+  for(pred_iterator pred = begin; pred != end; ++pred)
+    phi->addIncoming(createIncrementConstant(0, _pathWidth), *pred);
+
+  node->setPathPHI(phi);
+  node->setStartingPathNumber(phi);
+  node->setEndingPathNumber(phi);
+  describePathNumber(phi, false, &*block->getFirstInsertionPt());
+}
+
+// Flushes the path number register to the path tracker before the first
+// call in each instrumented block.  Instrumentation never moves the register
+// in the middle of a block, so one flush per block is enough, except that
+// with -pt-tail-calls a call in tail position completes the path first: the
+// tracker is then flushed again (as zero, as for a completed path) after
+// that path's instrumentation, right before the tail call.
+void PathTracing::spillPathNumbers(BLInstrumentationDag* dag) {
+  for(PPBLNodeIterator i = dag->nodeBegin(), e = dag->nodeEnd(); i != e; ++i){
+    BLInstrumentationNode* node = (BLInstrumentationNode*)*i;
+    BasicBlock* block = node->getBlock();
+    if(!block)
+      continue;
+
+    CallInst* const tail = TailCalls ? tailCall(*block) : NULL;
+    Instruction* call = NULL;
+    Value* pathNumber = node->getStartingPathNumber();
+    const ExtrinsicCalls<BasicBlock::iterator> calls = extrinsicCalls(*block);
+    if(calls.begin() != calls.end())
+      call = &*calls.begin();
+    else if(isa<InvokeInst>(block->getTerminator())){
+      call = block->getTerminator();
+      pathNumber = node->getEndingPathNumber();
+    }
+
+    if(call && call != tail){
+      if(!pathNumber)
+        pathNumber = createIncrementConstant(0, _pathWidth);
+      new StoreInst(pathNumber, this->getPathTracker(), true, call);
+      describePathNumber(this->getPathTracker(), true, call);
+    }
+    if(tail){
+      new StoreInst(createIncrementConstant(0, _pathWidth),
+                    this->getPathTracker(), true, tail);
+      describePathNumber(this->getPathTracker(), true, tail);
+    }
   }
 }
 
+// Describes the path number register from insertBefore onward.
+void PathTracing::describePathNumber(Value* value, bool indirect,
+                                     Instruction* insertBefore) {
+#if LLVM_VERSION >= 30700
+  if(_pathTrackerInfo)
+    insertDbgValue(*_debugBuilder, value, _pathTrackerInfo, indirect,
+                   _pathTrackerLoc, insertBefore);
+#else
+  // older LLVM releases only describe the path tracker itself
+  (void)value;
+  (void)indirect;
+  (void)insertBefore;
+#endif
+}
+
+// Returns the point where instrumentation at the end of node goes: its
+// terminator or, with -pt-tail-calls, any call in tail position before it
 static BasicBlock::iterator getTerminator(BLInstrumentationNode &node)
 {
-  return node.getBlock()->getTerminator()
+  Instruction* end = node.getBlock()->getTerminator();
+  if(TailCalls)
+    if(CallInst* call = tailCall(*node.getBlock()))
+      end = call;
+  return end
 #if LLVM_VERSION >= 30800
     ->getIterator()
 #endif
@@ -680,11 +1363,184 @@ static BasicBlock::iterator getTerminator(BLInstrumentationNode &node)
 }
 
 
+// Returns true if edge carries no instrumentation of its own.
+static bool isEmptyEdge(BLInstrumentationEdge* edge) {
+  return( edge->getType() == PPBallLarusEdge::NORMAL &&
+          !edge->isInitialization() && !edge->isCounterIncrement() &&
+          edge->getIncrement() == 0 );
+}
+
+// Largest number of successors whose increments are selected rather than
+// placed on (split) edges.  Each extra successor costs a compare and select
+// on every execution of the terminator.
+static const unsigned MAX_SELECT_SUCCESSORS = 4;
+
+bool PathTracing::insertSelectIncrement(BLInstrumentationNode* node) {
+  if(node->hasSelectIncrement())
+    return(true);
+
+  BasicBlock* block = node->getBlock();
+  if(!block || node->getNumberSuccEdges() <= 1)
+    return(false);
+
+  TerminatorInst* terminator = block->getTerminator();
+  BranchInst* branch = dyn_cast<BranchInst>(terminator);
+  SwitchInst* switchInst = dyn_cast<SwitchInst>(terminator);
+  if(!(branch && branch->isConditional()) && !switchInst)
+    return(false);
+
+  const unsigned numSuccs = terminator->getNumSuccessors();
+  if(numSuccs > MAX_SELECT_SUCCESSORS ||
+     numSuccs != node->getNumberSuccEdges())
+    return(false);
+
+  // Every successor must be distinct, so each one identifies its edge, and
+  // every edge must need nothing but a path number update
+  vector<BLInstrumentationEdge*> edges(numSuccs, (BLInstrumentationEdge*)NULL);
+  unsigned initializations = 0;
+  unsigned increments = 0;
+  bool allCritical = true;
+  for(PPBLEdgeIterator i = node->succBegin(), e = node->succEnd(); i != e; ++i){
+    BLInstrumentationEdge* edge = (BLInstrumentationEdge*)*i;
+    if(edge->getType() != PPBallLarusEdge::NORMAL ||
+       edge->isCounterIncrement())
+      return(false);
+
+    const unsigned succNum = edge->getSuccessorNumber();
+    if(succNum >= numSuccs || edges[succNum])
+      return(false);
+    edges[succNum] = edge;
+
+    if(edge->isInitialization())
+      ++initializations;
+    else if(edge->getIncrement() != 0)
+      ++increments;
+    allCritical &= !terminator->getSuccessor(succNum)->getSinglePredecessor();
+  }
+
+  // The select runs on every pass through the block, where edge code runs
+  // only on the edge taken.  It only pays when every edge would update the
+  // path number anyway, and would need a block of its own (and a jump) to
+  // do it: an edge with nothing to do costs nothing, and the code for an
+  // edge into a block with no other predecessors goes at that block's top.
+  if(initializations != 0 && initializations != numSuccs)
+    return(false);
+  if(!initializations && increments != 0 && increments != numSuccs)
+    return(false);
+  if((initializations || increments) && !allCritical)
+    return(false);
+
+  // Switch successor 0 is the default; the others each have one case
+  vector<ConstantInt*> caseValues(numSuccs, (ConstantInt*)NULL);
+  if(switchInst){
+    for(unsigned i = 1; i < numSuccs; ++i){
+      caseValues[i] = switchInst->findCaseDest(switchInst->getSuccessor(i));
+      if(!caseValues[i])
+        return(false);
+    }
+  }
+
+  DEBUG(dbgs() << "  Selecting increments before the terminator of: "
+        << node->getName() << '\n');
+  node->setHasSelectIncrement(true);
+  if(!initializations && !increments)
+    return(true);
+
+  // Pick the increment for whichever successor is taken
+  Value* increment;
+  if(branch){
+    increment = createIncrementConstant(edges[1]);
+    if(edges[0]->getIncrement() != edges[1]->getIncrement())
+      increment = SelectInst::Create(branch->getCondition(),
+                                     createIncrementConstant(edges[0]),
+                                     increment, "pathInc", terminator);
+  }
+  else{
+    increment = createIncrementConstant(edges[0]);
+    for(unsigned i = 1; i < numSuccs; ++i){
+      if(edges[i]->getIncrement() == edges[0]->getIncrement())
+        continue;
+      Instruction* isCase = new ICmpInst(terminator, CmpInst::ICMP_EQ,
+                                         switchInst->getCondition(),
+                                         caseValues[i], "isCase");
+      increment = SelectInst::Create(isCase, createIncrementConstant(edges[i]),
+                                     increment, "pathInc", terminator);
+    }
+  }
+
+  // Initialize or increment the path number
+  if(SSATracker){
+    Value* newValue = initializations ? increment :
+      BinaryOperator::Create(Instruction::Add, getCurrentPathNumber(node),
+                             increment, "pathNumber", terminator);
+    describePathNumber(newValue, false, terminator);
+    node->setEndingPathNumber(newValue);
+  }
+  else{
+    Value* newValue = increment;
+    if(!initializations){
+      Instruction* oldValue = new LoadInst(this->getPathTracker(),
+                                           "oldVal", terminator);
+      newValue = BinaryOperator::Create(Instruction::Add, oldValue, increment,
+                                        "pathNumber", terminator);
+    }
+    new StoreInst(newValue, this->getPathTracker(), true, terminator);
+  }
+
+  return(true);
+}
+
 void PathTracing::insertInstrumentationStartingAt(BLInstrumentationEdge* edge,
                                                    BLInstrumentationDag* dag) {
-  // Mark the edge as instrumented
-  edge->setHasInstrumentation(true);
+  // Depth-first walk over the DAG, visiting each edge as soon as it is
+  // reached.  Each stack entry holds a node and the index of its next
+  // successor edge to consider; indices stay valid while edges are split.
+  vector<pair<BLInstrumentationNode*, unsigned> > dfsStack;
+  dfsStack.reserve(dag->getFunction().size() + 2);
+
+  for(;;) {
+    // Mark the edge as instrumented
+    edge->setHasInstrumentation(true);
+
+    // Edges whose increments are already accounted for in their source (or
+    // that have nothing to do) stay unsplit
+    BLInstrumentationNode* sourceNode =
+      (BLInstrumentationNode*)edge->getSource();
+    if(SelectIncrements &&
+       (insertSelectIncrement(sourceNode) || isEmptyEdge(edge))) {
+      if(SSATracker)
+        pushValueIntoNode(sourceNode,
+                          (BLInstrumentationNode*)edge->getTarget());
+    }
+    else
+      insertEdgeInstrumentation(edge, dag);
+
+    // Add all the successors
+    dfsStack.push_back(make_pair((BLInstrumentationNode*)edge->getTarget(),
+                                 0u));
+
+    // Find the next un-instrumented edge
+    edge = NULL;
+    while(!edge && !dfsStack.empty()) {
+      BLInstrumentationNode* node = dfsStack.back().first;
+      unsigned& next = dfsStack.back().second;
+      if(next == node->getNumberSuccEdges()) {
+        dfsStack.pop_back();
+        continue;
+      }
 
+      BLInstrumentationEdge* succ =
+        (BLInstrumentationEdge*)*(node->succBegin() + next++);
+      if(!succ->hasInstrumentation())
+        edge = succ;
+    }
+    if(!edge)
+      break;
+  }
+}
+
+void PathTracing::insertEdgeInstrumentation(BLInstrumentationEdge* edge,
+                                            BLInstrumentationDag* dag) {
   // create a new node for this edge's instrumentation
   splitCritical(edge, dag);
 
@@ -718,6 +1574,11 @@ void PathTracing::insertInstrumentationStartingAt(BLInstrumentationEdge* edge,
     exit(1);
   }
 
+  // In SSA mode, the target inherits the path number register before any
+  // instrumentation is inserted at its beginning
+  if(SSATracker && atBeginning)
+    pushValueIntoNode(sourceNode, targetNode);
+
   // Insert instrumentation if this is a back or split edge
   if( edge->getType() == PPBallLarusEdge::BACKEDGE ||
       edge->getType() == PPBallLarusEdge::SPLITEDGE ) {
@@ -735,24 +1596,45 @@ void PathTracing::insertInstrumentationStartingAt(BLInstrumentationEdge* edge,
       instrumentNode->getBlock()->getFirstInsertionPt() :
       getTerminator(*instrumentNode);
 
-    // add information from the bottom edge, if it exists
-    if( bottom->getIncrement() ) {
-      Instruction* oldValue = new LoadInst(this->getPathTracker(),
-                                           "oldValBackSplit", &*insertPoint);
-      Instruction* newValue = BinaryOperator::Create(Instruction::Add,
-                                 oldValue, createIncrementConstant(bottom),
+    if(SSATracker) {
+      // add information from the bottom edge, if it exists
+      Value* curValue = getCurrentPathNumber(instrumentNode);
+      if( bottom->getIncrement() ) {
+        curValue = BinaryOperator::Create(Instruction::Add,
+                                 curValue, createIncrementConstant(bottom),
                                  "pathNumber", &*insertPoint);
-      new StoreInst(newValue, this->getPathTracker(), true, &*insertPoint);
-    }
+      }
+
+      if(!NoArrayWrites)
+        insertCounterIncrement(curValue, insertPoint, dag);
 
-    if(!NoArrayWrites){
-      Instruction* curValue = new LoadInst(this->getPathTracker(),
-                                           "curValBackSplit", &*insertPoint);
-      insertCounterIncrement(curValue, insertPoint, dag);
+      // the path number register restarts from the top edge's initialization
+      Value* topValue = createIncrementConstant(top);
+      describePathNumber(topValue, false, &*insertPoint);
+      instrumentNode->setEndingPathNumber(topValue);
+      if(atBeginning)
+        instrumentNode->setStartingPathNumber(topValue);
     }
+    else {
+      // add information from the bottom edge, if it exists
+      if( bottom->getIncrement() ) {
+        Instruction* oldValue = new LoadInst(this->getPathTracker(),
+                                             "oldValBackSplit", &*insertPoint);
+        Instruction* newValue = BinaryOperator::Create(Instruction::Add,
+                                   oldValue, createIncrementConstant(bottom),
+                                   "pathNumber", &*insertPoint);
+        new StoreInst(newValue, this->getPathTracker(), true, &*insertPoint);
+      }
+
+      if(!NoArrayWrites){
+        Instruction* curValue = new LoadInst(this->getPathTracker(),
+                                             "curValBackSplit", &*insertPoint);
+        insertCounterIncrement(curValue, insertPoint, dag);
+      }
     
-    new StoreInst(createIncrementConstant(top), this->getPathTracker(), true,
-                  &*insertPoint);
+      new StoreInst(createIncrementConstant(top), this->getPathTracker(), true,
+                    &*insertPoint);
+    }
     
     // Check for path counter increments: we would never expect the top edge to
     // also be a counter increment, but we'll handle it anyways
@@ -762,6 +1644,8 @@ void PathTracing::insertInstrumentationStartingAt(BLInstrumentationEdge* edge,
         insertCounterIncrement(createIncrementConstant(top),
                                getTerminator(*instrumentNode), dag);
       }
+      if(SSATracker)
+        instrumentNode->setEndingPathNumber(NULL);
     }
   }
 
@@ -771,7 +1655,33 @@ void PathTracing::insertInstrumentationStartingAt(BLInstrumentationEdge* edge,
       instrumentNode->getBlock()->getFirstInsertionPt() :
       getTerminator(*instrumentNode);
 
-    if(edge->isInitialization()){ // initialize path number
+    if(SSATracker){
+      Value* newValue = NULL;
+      if(edge->isInitialization()) // initialize path number
+        newValue = createIncrementConstant(edge);
+      else if(edge->getIncrement()) // increment path number
+        newValue = BinaryOperator::Create(Instruction::Add,
+                                 getCurrentPathNumber(instrumentNode),
+                                 createIncrementConstant(edge),
+                                 "pathNumber", &*insertPoint);
+      if(newValue){
+        describePathNumber(newValue, false, &*insertPoint);
+        instrumentNode->setEndingPathNumber(newValue);
+        if(atBeginning)
+          instrumentNode->setStartingPathNumber(newValue);
+      }
+
+      // Check for path counter increments (function exit)
+      if(edge->isCounterIncrement()){
+        if(!NoArrayWrites)
+          insertCounterIncrement(getCurrentPathNumber(instrumentNode),
+                                 insertPoint, dag);
+        instrumentNode->setEndingPathNumber(NULL);
+        if(atBeginning)
+          instrumentNode->setStartingPathNumber(NULL);
+      }
+    }
+    else if(edge->isInitialization()){ // initialize path number
       new StoreInst(createIncrementConstant(edge), this->getPathTracker(), true,
                     &*insertPoint);
     }
@@ -785,7 +1695,7 @@ void PathTracing::insertInstrumentationStartingAt(BLInstrumentationEdge* edge,
     }
 
     // Check for path counter increments (function exit)
-    if(edge->isCounterIncrement()){
+    if(!SSATracker && edge->isCounterIncrement()){
       if(!NoArrayWrites){
         Instruction* curValue = new LoadInst(this->getPathTracker(),
                                              "curVal", &*insertPoint);
@@ -794,13 +1704,10 @@ void PathTracing::insertInstrumentationStartingAt(BLInstrumentationEdge* edge,
     }
   }
 
-  // Add all the successors
-  for( PPBLEdgeIterator next = targetNode->succBegin(),
-         end = targetNode->succEnd(); next != end; next++ ) {
-    // So long as it is un-instrumented, add it to the list
-    if( !((BLInstrumentationEdge*)(*next))->hasInstrumentation() )
-      insertInstrumentationStartingAt((BLInstrumentationEdge*)*next,dag);
-  }
+  // In SSA mode, the register now flows along the edge out of the block
+  // where it was instrumented
+  if(SSATracker && !atBeginning)
+    pushValueIntoNode(instrumentNode, targetNode);
 }
 
 void PathTracing::insertInstrumentation(BLInstrumentationDag& dag){
@@ -808,6 +1715,8 @@ void PathTracing::insertInstrumentation(BLInstrumentationDag& dag){
   BLInstrumentationEdge* exitRootEdge =
     (BLInstrumentationEdge*) dag.getExitRootEdge();
   insertInstrumentationStartingAt(exitRootEdge, &dag);
+  if(SSATracker)
+    spillPathNumbers(&dag);
   
   PPBLEdgeVector callEdges = dag.getCallPhonyEdges();
   if(callEdges.begin() != callEdges.end()){
@@ -868,6 +1777,12 @@ static void writeBBLineNums(BasicBlock* bb,
     if(BranchInst* inst = dyn_cast<BranchInst>(i))
       if(inst->isUnconditional())
         continue;
+#if LLVM_VERSION >= 30700
+    // descriptions of the SSA path register are not part of the source
+    if(DbgValueInst* inst = dyn_cast<DbgValueInst>(i))
+      if(inst->getVariable()->getName().startswith("__PT_"))
+        continue;
+#endif
     
     dbLoc = i->getDebugLoc();
     if (!isUnknown(dbLoc)) {
@@ -876,7 +1791,17 @@ static void writeBBLineNums(BasicBlock* bb,
     }
     else if(LoadInst* inst = dyn_cast<LoadInst>(&*i)){
       if(inst->getPointerOperand() == dag->getCurIndex() &&
-         inst->getName().find("curIdx") == 0){
+         (inst->getName().find("curIdx") == 0 ||
+          inst->getName().find("ringCount") == 0)){
+        stream << "|-1";
+        any = true;
+      }
+    }
+    else if(GetElementPtrInst* inst = dyn_cast<GetElementPtrInst>(&*i)){
+      // a single-slot array commits without reading its index
+      if(inst->getPointerOperand() == dag->getCounterArray() &&
+         inst->getName().find("arrLoc") == 0 &&
+         inst->hasAllConstantIndices()){
         stream << "|-1";
         any = true;
       }
@@ -942,6 +1867,23 @@ void PathTracing::writeBBs(Function& F, BLInstrumentationDag* dag){
 
 void PathTracing::writeTrackerInfo(Function& F, BLInstrumentationDag* dag){
   trackerStream << "#\n" << F.getName().str() << '\n';
+  if(Ring)
+    trackerStream << "@storage|ring\n";
+  else if(dag->getNumberOfPaths() > HASH_THRESHHOLD)
+    trackerStream << "@storage|hash\n";
+  else if(_runLength)
+    trackerStream << "@storage|rle\n";
+  if(_pathWidth != 64)
+    trackerStream << "@width|" << _pathWidth << '\n';
+  if(dag->cutBegin() != dag->cutEnd()){
+    trackerStream << "@cuts|";
+    for(PPBLNodeIterator i = dag->cutBegin(), e = dag->cutEnd(); i != e; ++i){
+      if(i != dag->cutBegin())
+        trackerStream << ',';
+      trackerStream << ((BLInstrumentationNode*)*i)->getNodeId();
+    }
+    trackerStream << '\n';
+  }
   
   writeBBs(F, dag);
   trackerStream << "$\n";
@@ -1008,86 +1950,198 @@ bool PathTracing::runOnFunction(Function &F) {
   DEBUG(dbgs() << "Function: " << F.getName() << '\n');
   
   // Build DAG from CFG
-  BLInstrumentationDag dag = BLInstrumentationDag(F);
+  BLInstrumentationDag dag(F);
   dag.init();
 
+  // with -pt-cut-regions, cut functions with too many paths to trace in
+  // order into separately numbered regions
+  if(CutRegions)
+    dag.cutRegions(min(HASH_THRESHHOLD, ULONG_MAX / 2 - 1));
+  if(dag.cutBegin() != dag.cutEnd() && !SilentInternal)
+    errs() << "WARNING: function " << F.getName() << " has too many paths "
+           << "to number as a whole.  Paths will be traced in "
+           << (dag.cutEnd() - dag.cutBegin()) + 1 << " regions.\n";
+
   // give each path a unique integer value
   dag.calculatePathNumbers();
 
   // modify path increments to increase the efficiency
   // of instrumentation
-  dag.calculateSpanningTree();
+  if(SpanningTree == FREQUENCY_TREE) {
+#if LLVM_VERSION >= 30900
+    // PT must not require further analysis passes (see getAnalysisUsage),
+    // so compute frequencies for the function as it stands.  Branch
+    // probabilities come from any profile metadata (e.g. from
+    // -fprofile-instr-use) and otherwise from static heuristics.
+    DominatorTree domTree(F);
+    LoopInfo loops(domTree);
+    BranchProbabilityInfo branchProbs(F, loops);
+    BlockFrequencyInfo blockFreqs(F, branchProbs, loops);
+    dag.calculateSpanningTree(blockFreqs, branchProbs);
+#else
+    if(!SilentInternal)
+      errs() << "WARNING: frequency-based spanning trees require LLVM 3.9 "
+             << "or later.  Using a depth-first tree for function "
+             << F.getName() << ".\n";
+    dag.calculateSpanningTree();
+#endif
+  }
+  else
+    dag.calculateSpanningTree();
   dag.calculateChordIncrements();
   dag.pushInitialization();
   dag.pushCounters();
   dag.unlinkPhony();
   
-  // We only support the information in an array for now
-  if( dag.getNumberOfPaths() <= HASH_THRESHHOLD ) {
-    if(dag.error_negativeIncrements()){
-      errs() << "ERROR: Instrumentation is proceeding while DAG structure is "
-             << "in error and contains a negative increment for function "
-             << F.getName() << ".  This is a tool error.\n";
-      exit(1);
-    }
-    else if(dag.error_edgeOverflow()){
-      errs() << "ERROR: Instrumentation is proceeding while DAG structure is "
-             << "in error due to an edge weight overflow for function "
-             << F.getName() << ".  This is a tool error.\n";
-      exit(2);
-    }
-    
-    Type* tInt = Type::getInt64Ty(*Context);
-    Type* tArr = ArrayType::get(tInt, PATHS_SIZE);
-
-    // declare the path index and array
-    Instruction* entryInst = F.getEntryBlock().getFirstNonPHI();
-    AllocaInst* arrInst = createAllocaInst(tArr, "__PT_pathArr", entryInst);
-    AllocaInst* idxInst = createAllocaInst(tInt, "__PT_arrIndex", entryInst);
-    new StoreInst(ConstantInt::get(tInt, 0), idxInst, true, entryInst);
-    Instruction* trackInst = createAllocaInst(tInt, "__PT_curPath", entryInst);
-    new StoreInst(ConstantInt::get(tInt, 0), trackInst, true, entryInst);
-    
-    // Store the setinal value (-1) into pathArr[end]
+  // even a hash table needs every path number to fit in 63 bits
+  if(dag.getNumberOfPaths() > ULONG_MAX / 2 - 1){
+    if(!SilentInternal)
+      errs() << "WARNING: instrumentation not done for function "
+             << F.getName() << " due to large path count.  Path info "
+             << "will be missing!\n";
+    return false;
+  }
+  
+  // Paths are stored in a circular array, or a hash table for functions with
+  // too many paths to trace in order (unless they all go to the ring)
+  const bool hashed = !Ring && dag.getNumberOfPaths() > HASH_THRESHHOLD;
+
+  // A depth-first tree never yields a negative increment, but any other
+  // spanning tree may.  Those are still correct: path numbers wrap in their
+  // type, and every completed path number lies in [0, number of paths).
+  if(dag.error_negativeIncrements() && SpanningTree == DFS_TREE){
+    errs() << "ERROR: Instrumentation is proceeding while DAG structure is "
+           << "in error and contains a negative increment for function "
+           << F.getName() << ".  This is a tool error.\n";
+    exit(1);
+  }
+  else if(dag.error_edgeOverflow()){
+    errs() << "ERROR: Instrumentation is proceeding while DAG structure is "
+           << "in error due to an edge weight overflow for function "
+           << F.getName() << ".  This is a tool error.\n";
+    exit(2);
+  }
+  
+  // Run-length encoding only pays off when a call can repeat a path
+  _runLength = RunLength && !Ring && !hashed && !dag.completesOnePath();
+
+  // Narrow path numbers to the smallest type that holds them.  The hash
+  // table and run-length array share their arrays between paths and
+  // sequence numbers or counts, so they always use 64 bits.
+  _pathWidth = 64;
+  if(NarrowPaths && !hashed && !_runLength)
+    _pathWidth = narrowestPathWidth(dag.getNumberOfPaths());
+
+  // Size the path array (or hash table).  The scheme and -pt-path-array-size
+  // override the choice; otherwise a hash table gets a slot per path (up to
+  // MAX_HASH_SLOTS), a function that completes one path per call needs only
+  // one slot, and looping functions get PATHS_SIZE slots per level of loop
+  // nesting (up to MAX_PATHS_DEPTH levels).  With -pt-ring, the only path
+  // array is the runtime library's ring.
+  unsigned pathsSize = instData.getPathArraySize(F);
+  if(Ring)
+    pathsSize = CSI_PT_RING_SIZE;
+  else if(pathsSize == 0){
+    if(ArraySize > 0)
+      pathsSize = PATHS_SIZE;
+    else if(hashed)
+      pathsSize = hashSlots(dag.getNumberOfPaths());
+    else if(dag.completesOnePath())
+      pathsSize = 1;
+    else
+      pathsSize = PATHS_SIZE * min(maxLoopDepth(F), MAX_PATHS_DEPTH);
+  }
+
+  Type* tInt = Type::getInt64Ty(*Context);
+  Type* tPath = getPathType();
+  const unsigned arrSize = hashed || _runLength ? 2 * pathsSize : pathsSize;
+  Type* tArr = ArrayType::get(tPath, arrSize);
+
+  // declare the path index and array (committed paths leave the frame at
+  // once with -pt-ring, so then only the path tracker is local)
+  Instruction* entryInst = F.getEntryBlock().getFirstNonPHI();
+  AllocaInst* arrInst = NULL;
+  AllocaInst* idxInst = NULL;
+  if(!Ring){
+    arrInst = createAllocaInst(tArr, "__PT_pathArr", entryInst);
+    idxInst = createAllocaInst(tInt, "__PT_arrIndex", entryInst);
+    new StoreInst(ConstantInt::get(tInt, _runLength ? pathsSize-1 : 0),
+                  idxInst, true, entryInst);
+  }
+  Instruction* trackInst = createAllocaInst(tPath, "__PT_curPath", entryInst);
+  new StoreInst(ConstantInt::get(tPath, 0), trackInst, true, entryInst);
+  
+  if(Ring){
+    // the ring's count stands in for the path index in the block line numbers
+    dag.setCurIndex(getRingGlobal(*F.getParent(), tInt,
+                                  "__CSI_pt_ring_count"));
+  }
+  else if(hashed){
+    // Empty the hash table (a zero sequence number marks an empty slot)
+    if(!SilentInternal)
+      errs() << "WARNING: function " << F.getName() << " has too many paths "
+             << "to trace in order.  Paths will be stored in a hash "
+             << "table.\n";
+    IRBuilder<> builder(entryInst);
+    builder.CreateMemSet(arrInst, builder.getInt8(0),
+                         arrSize * sizeof(uint64_t), 0, true);
+  }
+  else{
+    // Store the setinal value (-1) into pathArr[end] (or, for run-length
+    // arrays, into the path of the last pair)
     Value * const gepIndices[] = {
       Constant::getNullValue(Type::getInt64Ty(*Context)),
-      ConstantInt::get(tInt, PATHS_SIZE-1),
+      ConstantInt::get(tInt, _runLength ? 2*(pathsSize-1) : pathsSize-1),
     };
     GetElementPtrInst* arrLast = GetElementPtrInst::CreateInBounds(arrInst,
                                                                    gepIndices,
                                                                    "arrLast",
                                                                    entryInst);
-    new StoreInst(ConstantInt::get(tInt, -1), arrLast, true, entryInst);
-    
-    dag.setCounterArray(arrInst);
+    new StoreInst(ConstantInt::get(tPath, -1), arrLast, true, entryInst);
+  }
+  
+  dag.setCounterArray(arrInst);
+  if(!Ring)
     dag.setCurIndex(idxInst);
-    dag.setCounterSize(PATHS_SIZE);
-    this->setPathTracker(trackInst);
-    
-    // create debug info for new variables
-    DIBuilder Builder(*F.getParent());
+  dag.setCounterSize(pathsSize);
+  this->setPathTracker(trackInst);
+  
+  // create debug info for new variables
+  DIBuilder Builder(*F.getParent());
+  _debugBuilder = &Builder;
+#if LLVM_VERSION >= 30700
+  _pathTrackerInfo = NULL;
+#endif
 #if LLVM_VERSION < 30700
-    const DIType intType = Builder.createBasicType("__pt_int", 64, 64, dwarf::DW_ATE_signed);
-    const DIType arrType = createArrayType(Builder, PATHS_SIZE, intType);
+  const DIType intType = Builder.createBasicType("__pt_int", 64, 64, dwarf::DW_ATE_signed);
+  const DIType pathType = _pathWidth == 64 ? intType :
+    Builder.createBasicType("__pt_path_int", _pathWidth, _pathWidth,
+                            dwarf::DW_ATE_signed);
+  const DIType arrType = createArrayType(Builder, arrSize, pathType);
 #else
-    DIType * const intType { createBasicType(Builder, "__pt_int", 64, dwarf::DW_ATE_signed) };
-    DIType * const arrType { createArrayType(Builder, PATHS_SIZE, intType) };
+  DIType * const intType { createBasicType(Builder, "__pt_int", 64, dwarf::DW_ATE_signed) };
+  DIType * const pathType { _pathWidth == 64 ? intType :
+    createBasicType(Builder, "__pt_path_int", _pathWidth,
+                    dwarf::DW_ATE_signed) };
+  DIType * const arrType { createArrayType(Builder, arrSize, pathType) };
 #endif
-    
-    // get the debug location of any instruction in this basic block--this will
-    // use the same info.  If there is none, technically we should build it, but
-    // that's a huge pain (if it's possible) so I just give up right now
-    const DebugLoc dbLoc = findEarlyDebugLoc(F, SilentInternal);
-    if (!isUnknown(dbLoc)) {
+  
+  // get the debug location of any instruction in this basic block--this will
+  // use the same info.  If there is none, technically we should build it, but
+  // that's a huge pain (if it's possible) so I just give up right now
+  const DebugLoc dbLoc = findEarlyDebugLoc(F, SilentInternal);
+  _pathTrackerLoc = dbLoc;
+  if (!isUnknown(dbLoc)) {
 #if LLVM_VERSION < 30700
-      typedef DIVariable Info;
-      const DIDescriptor scope(dbLoc.getScope(*Context));
-      const DIFile file(dbLoc.getScope(*Context));
+    typedef DIVariable Info;
+    const DIDescriptor scope(dbLoc.getScope(*Context));
+    const DIFile file(dbLoc.getScope(*Context));
 #else
-      typedef DILocalVariable *Info;
-      DIScope * const scope { dbLoc->getScope() };
-      DIFile * const file { scope->getFile() };
+    typedef DILocalVariable *Info;
+    DIScope * const scope { dbLoc->getScope() };
+    DIFile * const file { scope->getFile() };
 #endif
+    if(!Ring){
       const Info arrDI = createAutoVariable(
                             Builder,
                             scope,
@@ -1100,27 +2154,28 @@ bool PathTracing::runOnFunction(Function &F) {
                             "__PT_counter_idx",
                             file, 0, intType, true);
       insertDeclare(Builder, idxInst, idxDI, dbLoc, entryInst);
-      const Info trackDI = createAutoVariable(
-                             Builder,
-                             scope,
-                             "__PT_current_path",
-                             file, 0, intType,
-                             true);
-      insertDeclare(Builder, trackInst, trackDI, dbLoc, entryInst);
     }
-    
-    // do the instrumentation and write out the path info to the .info file
-    insertInstrumentation(dag);
-    
-    writeTrackerInfo(F, &dag);
-  }
-  else if(!SilentInternal){
-    errs() << "WARNING: instrumentation not done for function "
-           << F.getName() << " due to large path count.  Path info "
-           << "will be missing!\n";
-    return false;
+    const Info trackDI = createAutoVariable(
+                           Builder,
+                           scope,
+                           "__PT_current_path",
+                           file, 0, pathType,
+                           true);
+#if LLVM_VERSION >= 30700
+    // an SSA path register is described by dbg.value as it changes
+    if(SSATracker)
+      _pathTrackerInfo = trackDI;
+    else
+#endif
+    insertDeclare(Builder, trackInst, trackDI, dbLoc, entryInst);
   }
   
+  // do the instrumentation and write out the path info to the .info file
+  insertInstrumentation(dag);
+  _debugBuilder = NULL;
+  
+  writeTrackerInfo(F, &dag);
+  
   return true;
 }
 
@@ -44,6 +44,13 @@
 #include "llvm_proxy/Instructions.h"
 
 #include <fstream>
+#include <vector>
+
+namespace llvm {
+  class BlockFrequencyInfo;
+  class BranchProbabilityInfo;
+  class DIBuilder;
+}
 
 namespace csi_inst {
 class BLInstrumentationNode;
@@ -72,6 +79,11 @@ public:
   llvm::PHINode* getPathPHI();
   void setPathPHI(llvm::PHINode* pathPHI);
   
+  // Get/set whether the increments of all outgoing edges are computed
+  // before this node's terminator (rather than on the edges themselves).
+  bool hasSelectIncrement();
+  void setHasSelectIncrement(bool hasSelectIncrement);
+
   // Node ID access is required to help with writing out block data
   unsigned int getNodeId();
 
@@ -80,6 +92,7 @@ private:
   llvm::Value* _startingPathNumber; // The Value for the current pathNumber.
   llvm::Value* _endingPathNumber; // The Value for the current pathNumber.
   llvm::PHINode* _pathPHI; // The PHINode for current pathNumber.
+  bool _hasSelectIncrement; // Outgoing increments selected in this node?
   
   unsigned int _blockId; // The unique ID for the node
 };
@@ -161,6 +174,15 @@ public:
   // with function calls
   PPBLEdgeVector getCallPhonyEdges();
 
+  // Whether every call completes exactly one path (i.e., the function has
+  // no loops and was not cut into regions)
+  bool completesOnePath();
+
+  // Iterators over all nodes of the DAG (including any created by
+  // splitting critical edges)
+  PPBLNodeIterator nodeBegin();
+  PPBLNodeIterator nodeEnd();
+
   // Gets/sets the path counter array
   llvm::Value* getCounterArray();
   llvm::Value* getCurIndex();
@@ -184,6 +206,12 @@ public:
   // by trying to find hot edges.
   void calculateSpanningTree();
 
+  // Calculates a maximum-weight spanning tree of the DAG ignoring cycles,
+  // weighting each edge by its estimated execution frequency.  Hot edges
+  // thus stay uninstrumented, and increments land on cold chords.
+  void calculateSpanningTree(const llvm::BlockFrequencyInfo& blockFreqs,
+                             const llvm::BranchProbabilityInfo& branchProbs);
+
   // Pushes initialization further down in order to group the first
   // increment and initialization.
   void pushInitialization();
@@ -227,16 +255,17 @@ private:
   
   bool _errorNegativeIncrements; // DAG in an error state with negative incs?
   
-  // Removes the edge from the appropriate predecessor and successor lists.
-  void unlinkEdge(PPBallLarusEdge* edge);
 
   // Makes an edge part of the spanning tree.
   void makeEdgeSpanning(BLInstrumentationEdge* edge);
 
-  // Pushes initialization and calls itself recursively.
+  // Collects all edges not in the spanning tree as chords.
+  void collectChords();
+
+  // Pushes initialization down chains of single-predecessor nodes.
   void pushInitializationFromEdge(BLInstrumentationEdge* edge);
 
-  // Pushes path counter increments up recursively.
+  // Pushes path counter increments up chains of single-successor nodes.
   void pushCountersFromEdge(BLInstrumentationEdge* edge);
 
   // Depth first algorithm for determining the chord increments.f
@@ -260,7 +289,23 @@ private:
   llvm::Value* getPathTracker();
   void setPathTracker(llvm::Value* c);
   llvm::Value* _pathTracker; // The storage for the current path tracker
-  
+
+  // Debug info support for an SSA path register (-pt-ssa-tracker).  The
+  // register is described with dbg.value at each update, or through its
+  // spill slot (the path tracker) after it is flushed at a call.
+  llvm::DIBuilder* _debugBuilder;
+#if LLVM_VERSION >= 30700
+  llvm::DILocalVariable* _pathTrackerInfo;
+#endif
+  llvm::DebugLoc _pathTrackerLoc;
+
+  // Width in bits of path numbers in the current function (-pt-narrow-paths)
+  unsigned _pathWidth;
+
+  // Whether the current function folds repeated paths into (path, count)
+  // entries (-pt-run-length)
+  bool _runLength;
+
   std::ofstream trackerStream; // The output stream to the tracker file
                                // (managed by runOnFunction and written to as
                                // we go)
@@ -277,12 +322,51 @@ private:
   // edge->getIncrement().
   llvm::ConstantInt* createIncrementConstant(BLInstrumentationEdge* edge);
 
+  // Returns the integer type holding path numbers in the current function.
+  llvm::IntegerType* getPathType();
+
   // Creates a counter increment in the given node.  The Value* in node is
   // taken as the index into a hash table.
   void insertCounterIncrement(llvm::Value* incValue,
                               llvm::BasicBlock::iterator insertPoint,
                               BLInstrumentationDag* dag);
 
+  // Records the path completed before a call in tail position in a
+  // per-thread buffer (-pt-tail-calls)
+  void recordTailPath(llvm::Value* path, llvm::Instruction* call);
+
+  // Commits a completed path to the runtime library's per-thread ring
+  // (-pt-ring)
+  void commitRingPath(llvm::Value* path, llvm::Instruction* insertBefore);
+
+  // Returns the path number register Value live at the end of node (zero
+  // if the path was just committed or never initialized).  SSA mode only.
+  llvm::Value* getCurrentPathNumber(BLInstrumentationNode* node);
+
+  // Inserts source's ending path number into target.  Target may or may
+  // not have multiple predecessors, and may or may not have its PHINode
+  // initialized.  SSA mode only.
+  void pushValueIntoNode(BLInstrumentationNode* source,
+                         BLInstrumentationNode* target);
+
+  // Inserts source's ending path number into the PHINode of target.
+  void pushValueIntoPHI(BLInstrumentationNode* target,
+                        BLInstrumentationNode* source);
+
+  // Creates the PHINode for the path number register in node.
+  void preparePHI(BLInstrumentationNode* node);
+
+  // Flushes the path number register to the path tracker before the first
+  // call in each instrumented block, so that the current path survives
+  // into (and can be recovered from) the callee.  SSA mode only.
+  void spillPathNumbers(BLInstrumentationDag* dag);
+
+  // Describes the path number register with the given value from
+  // insertBefore onward.  If indirect, the value is the path tracker
+  // holding the register rather than the register itself.
+  void describePathNumber(llvm::Value* value, bool indirect,
+                          llvm::Instruction* insertBefore);
+
   // Inserts instrumentation for the given edge
   //
   // Pre: The edge's source node has pathNumber set if edge is non zero
@@ -294,6 +378,17 @@ private:
   void insertInstrumentationStartingAt(
     BLInstrumentationEdge* edge,
     BLInstrumentationDag* dag);
+
+  // Inserts the code for a single edge, splitting it if it is critical.
+  void insertEdgeInstrumentation(BLInstrumentationEdge* edge,
+                                 BLInstrumentationDag* dag);
+
+  // If node ends in a conditional branch or a small switch, computes the
+  // increments of all its outgoing edges before its terminator by selecting
+  // on the branch condition or switch value.  The outgoing edges then need
+  // no code (and no critical edge splitting) of their own.  Returns true if
+  // node's increments were (or had already been) selected this way.
+  bool insertSelectIncrement(BLInstrumentationNode* node);
   
   // If this edge is a critical edge, then inserts a node at this edge.
   // This edge becomes the first edge, and a new PPBallLarusEdge is created.
@@ -315,7 +410,8 @@ private:
 
 public:
   static char ID; // Pass identification, replacement for typeid
-  PathTracing() : ModulePass(ID) {}
+  PathTracing() : ModulePass(ID), _debugBuilder(NULL), _pathWidth(64),
+                  _runLength(false) {}
 
   virtual PassName getPassName() const {
     return "Intraprocedural Path Tracing";
@@ -30,12 +30,14 @@
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-parameter"
+#include <llvm/ADT/Triple.h>
 #include <llvm/Support/Debug.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
 #include <llvm/Transforms/Utils/Cloning.h>
 #pragma GCC diagnostic pop
 
+#include "llvm_proxy/CFG.h"
 #include "llvm_proxy/CommandLine.h"
 #include "llvm_proxy/Module.h"
 #include "llvm_proxy/InstIterator.h"
@@ -43,6 +45,7 @@
 
 #include <algorithm>
 #include <climits>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -54,7 +57,7 @@ using namespace llvm;
 using namespace std;
 
 enum IndirectStyle{
-  Std, Ifunc
+  Std, Ifunc, Patch
 };
 static cl::opt<IndirectStyle> TrampolineStyle("csi-trampoline-style",
    cl::desc("(optional) Trampoline style:"), cl::init(Std),
@@ -63,7 +66,10 @@ static cl::opt<IndirectStyle> TrampolineStyle("csi-trampoline-style",
      clEnumValN(Ifunc, "ifunc", "use @gnu_indirect_function attribute "
                                 "(requires glibc 2.11.1+, "
                                 "binutils 2.20.1+, and an unreleased "
-                                "version of LLVM containing r198780)")
+                                "version of LLVM containing r198780)"),
+     clEnumValN(Patch, "patch", "use a direct jump at function entry, which "
+                                "the runtime library retargets when a "
+                                "switcher changes (x86 only)")
      CL_ENUM_VAL_END
    )
 );
@@ -74,9 +80,33 @@ static cl::opt<bool> SilentInternal("csi-silent", cl::desc("Silence internal "
 static cl::opt<string> VariantsFile("csi-variants-file", cl::desc("The path to "
                                    "the instrumentation variants output file."),
                                    cl::value_desc("file_path"));
+static cl::opt<unsigned> SamplePeriod("csi-pt-sample-period", cl::desc("Trace "
+                                      "paths in one of every N calls to "
+                                      "functions with path tracing, counting "
+                                      "down per thread.  0 traces every call. "
+                                      "Default: 0"),
+                                      cl::value_desc("N"));
 static cl::opt<bool> NoFilter("csi-no-filter", cl::desc("Do not filter "
                               "instrumentation schemes.  All schemes are used "
                               "verbatim for function replication."));
+static cl::opt<bool> VariantTable("csi-variant-table", cl::desc("Describe "
+                                  "each function switcher in section "
+                                  "__CSI_variants, so that the runtime library "
+                                  "can choose variants by scheme."));
+static cl::opt<bool> CountCalls("csi-count-calls", cl::desc("Count the calls "
+                                "to each function with a switcher in "
+                                "__CSI_calls_<function>, for the runtime "
+                                "library's overhead governor.  Requires "
+                                "-csi-variant-table."));
+static cl::opt<unsigned> CallPeriod("csi-count-calls-period", cl::desc("With "
+                                    "-csi-count-calls, count calls in samples "
+                                    "of N, counting down per thread.  0 "
+                                    "counts every call.  Default: 64"),
+                                    cl::value_desc("N"), cl::init(64));
+static cl::opt<bool> TailCalls("csi-tail-calls", cl::desc("Give each call "
+                               "that branches to a shared return block a "
+                               "return of its own, so that instrumentation "
+                               "of the shared block cannot separate them."));
 
 // Register CSI prep as a pass
 char PrepareCSI::ID = 0;
@@ -110,17 +140,167 @@ void PrepareCSI::addInstrumentationType(Function &F, const string &type) {
 #endif
 }
 
+unsigned PrepareCSI::getPathArraySize(const Function &F) const {
+  const map<const Function*, unsigned>::const_iterator found =
+     pathArraySizes.find(&F);
+  if (found == pathArraySizes.end())
+    return 0;
+  else
+    return found->second;
+}
+
+void PrepareCSI::setPathArraySize(Function &F, unsigned size) {
+  if (size > 0)
+    pathArraySizes[&F] = size;
+}
+
+// Gets (or creates) a per-thread countdown to the next sampled call, and
+// the period it is reset to after each sample.  A period of 0 or less
+// samples every call; programs may overwrite a period (such as
+// __CSI_pt_sample_period) at run time to tune the sampling rate.
+static GlobalVariable* getCountdown(Module& M, const char* name){
+  GlobalVariable* countdown = M.getGlobalVariable(name);
+  if(!countdown){
+    IntegerType* tInt = Type::getInt32Ty(M.getContext());
+    countdown = new GlobalVariable(M, tInt, false,
+                                   GlobalValue::WeakAnyLinkage,
+                                   ConstantInt::get(tInt, 0),
+                                   name, NULL,
+#if LLVM_VERSION < 30200
+                                   true
+#else
+                                   GlobalVariable::GeneralDynamicTLSModel
+#endif
+                                   );
+  }
+  return(countdown);
+}
+
+static GlobalVariable* getPeriod(Module& M, const char* name,
+                                 unsigned value){
+  GlobalVariable* period = M.getGlobalVariable(name);
+  if(!period){
+    IntegerType* tInt = Type::getInt32Ty(M.getContext());
+    period = new GlobalVariable(M, tInt, false, GlobalValue::WeakAnyLinkage,
+                                ConstantInt::get(tInt, value), name);
+  }
+  return(period);
+}
+
+// Creates a block that tail calls replica with F's arguments and returns
+static BasicBlock* createReplicaCall(LLVMContext& C, Function* F,
+                                     Function* replica){
+  vector<Value*> callArgs;
+  for(Function::arg_iterator k = F->arg_begin(), ke = F->arg_end(); k != ke; ++k)
+    callArgs.push_back(&*k);
+
+  BasicBlock* bb = BasicBlock::Create(C, "call", F);
+  CallInst* oneCall = CallInst::Create(replica, callArgs,
+     (F->getReturnType()->isVoidTy()) ? "" : "theCall", bb);
+  oneCall->setTailCall(true);
+  if(F->getReturnType()->isVoidTy())
+    ReturnInst::Create(C, bb);
+  else
+    ReturnInst::Create(C, oneCall, bb);
+  return(bb);
+}
+
+// Creates a block that runs traced when the per-thread countdown has
+// expired (resetting the countdown), and untraced otherwise
+static BasicBlock* createSampledCall(LLVMContext& C, Function* F,
+                                     Function* traced, Function* untraced){
+  Module& M = *F->getParent();
+  GlobalVariable* countdown = getCountdown(M, "__CSI_pt_countdown");
+  IntegerType* tInt = Type::getInt32Ty(C);
+
+  BasicBlock* bb = BasicBlock::Create(C, "sample", F);
+  BasicBlock* tracedCall = createReplicaCall(C, F, traced);
+  BasicBlock* untracedCall = createReplicaCall(C, F, untraced);
+
+  LoadInst* remaining = new LoadInst(countdown, "countdown", bb);
+  Value* skip = new ICmpInst(*bb, CmpInst::ICMP_SGT, remaining,
+                             ConstantInt::get(tInt, 0), "skipSample");
+  BranchInst::Create(untracedCall, tracedCall, skip, bb);
+
+  Instruction* untracedFirst = &untracedCall->front();
+  Value* decremented = BinaryOperator::Create(Instruction::Add, remaining,
+                                              ConstantInt::get(tInt, -1),
+                                              "countdown", untracedFirst);
+  new StoreInst(decremented, countdown, untracedFirst);
+
+  Instruction* tracedFirst = &tracedCall->front();
+  LoadInst* period = new LoadInst(getPeriod(M, "__CSI_pt_sample_period",
+                                            SamplePeriod),
+                                  "period", tracedFirst);
+  Value* reset = BinaryOperator::Create(Instruction::Add, period,
+                                        ConstantInt::get(tInt, -1),
+                                        "countdown", tracedFirst);
+  new StoreInst(reset, countdown, tracedFirst);
+
+  return(bb);
+}
+
 Function* PrepareCSI::switchIndirect(Function* F, GlobalVariable* switcher,
-                                     vector<Function*>& replicas){
+                                     vector<Function*>& replicas,
+                                     vector<Function*>& untraced,
+                                     GlobalVariable* calls){
   F->dropAllReferences();
   
   BasicBlock* newEntry = BasicBlock::Create(*Context, "newEntry", F);
-  vector<Value*> callArgs;
-  for(Function::arg_iterator k = F->arg_begin(), ke = F->arg_end(); k != ke; ++k)
-    callArgs.push_back(&*k);
+  BasicBlock* dispatch = newEntry;
+  
+  // calls are counted in samples: a per-thread countdown expires once every
+  // __CSI_calls_period calls, and only then is the shared counter credited
+  // with the whole period (and the runtime library told), so that counting
+  // seldom writes a cache line that other threads use.  The count need not
+  // be exact, so threads may race to update it.
+  if(calls){
+    Module& M = *F->getParent();
+    IntegerType* tCountdown = Type::getInt32Ty(*Context);
+    GlobalVariable* countdown = getCountdown(M, "__CSI_calls_countdown");
+    dispatch = BasicBlock::Create(*Context, "dispatch", F);
+    BasicBlock* credit = BasicBlock::Create(*Context, "countCalls", F);
+
+    LoadInst* remaining = new LoadInst(countdown, "callCountdown", newEntry);
+    Value* next = BinaryOperator::Create(Instruction::Add, remaining,
+                                         ConstantInt::get(tCountdown, -1),
+                                         "callCountdown", newEntry);
+    new StoreInst(next, countdown, newEntry);
+    Value* expired = new ICmpInst(*newEntry, CmpInst::ICMP_SLT, next,
+                                  ConstantInt::get(tCountdown, 0),
+                                  "countCalls");
+    BranchInst::Create(credit, dispatch, expired, newEntry);
+
+    LoadInst* period = new LoadInst(getPeriod(M, "__CSI_calls_period",
+                                              CallPeriod),
+                                    "callPeriod", credit);
+    Value* positive = new ICmpInst(*credit, CmpInst::ICMP_SGT, period,
+                                   ConstantInt::get(tCountdown, 0),
+                                   "positivePeriod");
+    Value* sample = SelectInst::Create(positive, period,
+                                       ConstantInt::get(tCountdown, 1),
+                                       "callSample", credit);
+    Value* reset = BinaryOperator::Create(Instruction::Add, sample,
+                                          ConstantInt::get(tCountdown, -1),
+                                          "callCountdown", credit);
+    new StoreInst(reset, countdown, credit);
+    LoadInst* oldCalls = new LoadInst(calls, "oldCalls", credit);
+    Value* newCalls =
+      BinaryOperator::Create(Instruction::Add, oldCalls,
+                             new ZExtInst(sample, oldCalls->getType(),
+                                          "callSample", credit),
+                             "newCalls", credit);
+    new StoreInst(newCalls, calls, credit);
+    // (which also lets the runtime library restart its governor after fork)
+    FunctionType* tickType = FunctionType::get(Type::getVoidTy(*Context),
+                                               false);
+    CallInst::Create(M.getOrInsertFunction("__CSI_governor_tick", tickType),
+                     "", credit);
+    BranchInst::Create(dispatch, credit);
+  }
   
   // set up the switch
-  LoadInst* whichCall = new LoadInst(switcher, "chooseCall", true, newEntry);
+  LoadInst* whichCall = new LoadInst(switcher, "chooseCall", true, dispatch);
   SwitchInst* callSwitch = NULL;
   
   // stuff we need
@@ -130,10 +310,12 @@ Function* PrepareCSI::switchIndirect(Function* F, GlobalVariable* switcher,
   bool aZero = false;
   for(unsigned int i = 0; i < replicas.size(); ++i){
     Function* newF = replicas[i];
-    BasicBlock* bb = BasicBlock::Create(*Context, "call", F);
+    BasicBlock* bb = untraced[i]
+      ? createSampledCall(*Context, F, newF, untraced[i])
+      : createReplicaCall(*Context, F, newF);
     if(callSwitch == NULL){
       callSwitch = SwitchInst::Create(whichCall, bb, replicas.size(),
-                                      newEntry);
+                                      dispatch);
     }
     string funcName = newF->getName().str();
 
@@ -147,14 +329,6 @@ Function* PrepareCSI::switchIndirect(Function* F, GlobalVariable* switcher,
     }
     else
       callSwitch->addCase(ConstantInt::get(tInt, i+1), bb);
-
-    CallInst* oneCall = CallInst::Create(newF, callArgs,
-       (F->getReturnType()->isVoidTy()) ? "" : "theCall", bb);
-    oneCall->setTailCall(true);
-    if(F->getReturnType()->isVoidTy())
-      ReturnInst::Create(*Context, bb);
-    else
-      ReturnInst::Create(*Context, oneCall, bb);
   }
   // note that we intentionally started numbering the cases from 1 so that the
   // zero case is reserved for the uninstrumented variant (if there is one)
@@ -222,6 +396,162 @@ Function* PrepareCSI::ifuncIndirect(Function* F, GlobalVariable* switcher,
   return(newF);
 }
 
+// Writes a scheme as it appears in a schema, such as "{CC,PT}"
+static string schemeString(const set<string>& scheme){
+  string result = "{";
+  for(set<string>::const_iterator i = scheme.begin(), e = scheme.end(); i != e; ++i){
+    if(i != scheme.begin())
+      result += ',';
+    result += *i;
+  }
+  return(result + '}');
+}
+
+// Adds an entry for a function's switcher to section __CSI_variants: the
+// switcher's address, the function's name, the scheme selected by each
+// switcher value, separated by semicolons (and empty for unused values),
+// and the function's call counter, if any.  This numbering must match that
+// of switchIndirect.
+static void describeVariants(Module& M, GlobalVariable* switcher,
+                             StringRef name,
+                             const set<set<string> >& replicas,
+                             GlobalVariable* calls){
+  LLVMContext& C = M.getContext();
+  string none;
+  string schemes;
+  for(set<set<string> >::const_iterator i = replicas.begin(), e = replicas.end(); i != e; ++i){
+    schemes += ';';
+    if(i->empty())
+      none = schemeString(*i);
+    else
+      schemes += schemeString(*i);
+  }
+  schemes = none + schemes;
+
+  Constant* nameInit = ConstantDataArray::getString(C, name);
+  GlobalVariable* nameGlobal =
+    new GlobalVariable(M, nameInit->getType(), true,
+                       GlobalValue::PrivateLinkage, nameInit,
+                       "__CSI_variant_name");
+  Constant* schemesInit = ConstantDataArray::getString(C, schemes);
+  GlobalVariable* schemesGlobal =
+    new GlobalVariable(M, schemesInit->getType(), true,
+                       GlobalValue::PrivateLinkage, schemesInit,
+                       "__CSI_variant_schemes");
+
+  Type* tBytePtr = Type::getInt8PtrTy(C);
+  Constant* fields[] = {
+    switcher,
+    ConstantExpr::getBitCast(nameGlobal, tBytePtr),
+    ConstantExpr::getBitCast(schemesGlobal, tBytePtr),
+    calls ? static_cast<Constant*>(calls)
+          : ConstantPointerNull::get(Type::getInt64PtrTy(C)),
+  };
+  Constant* entryInit = ConstantStruct::getAnon(C, fields);
+  GlobalVariable* entry =
+    new GlobalVariable(M, entryInit->getType(), true,
+                       GlobalValue::PrivateLinkage, entryInit,
+                       "__CSI_variant");
+  entry->setSection("__CSI_variants");
+  entry->setAlignment(8);
+  vector<GlobalValue*> used(1, entry);
+  markUsed(M, used);
+}
+
+// Whether F's dispatcher can be a patchable jump: the jump is x86 code in
+// ELF assembler syntax, and a function that is only available externally
+// must not be defined here
+static bool canPatch(const Module& M, const Function& F){
+  const Triple triple(M.getTargetTriple());
+  const Triple::ArchType arch = triple.getArch();
+#if LLVM_VERSION < 30500
+  const bool elf = !triple.isOSDarwin() && !triple.isOSWindows();
+#else
+  const bool elf = triple.isOSBinFormatELF();
+#endif
+  return((arch == Triple::x86 || arch == Triple::x86_64) && elf &&
+         !F.hasAvailableExternallyLinkage());
+}
+
+static string asmSymbol(StringRef name){
+  return('"' + name.str() + '"');
+}
+
+Function* PrepareCSI::patchIndirect(Function* F, GlobalVariable* switcher,
+                                    vector<Function*>& replicas){
+  Module& M = *F->getParent();
+  IntegerType* tInt = Type::getInt32Ty(*Context);
+  PointerType* tBytePtr = Type::getInt8PtrTy(*Context);
+
+  // number the variants as switchIndirect does
+  vector<Function*> byValue(replicas.size() + 1, static_cast<Function*>(NULL));
+  bool aZero = false;
+  for(unsigned int i = 0; i < replicas.size(); ++i){
+    Function* newF = replicas[i];
+    string funcName = newF->getName().str();
+    if(funcName.length() > 5 &&
+       funcName.substr(funcName.length()-5, 5) == "$none"){
+      byValue[0] = newF;
+      aZero = true;
+    }
+    else
+      byValue[i+1] = newF;
+    // the jump reaches each variant directly, even in a shared library
+    if(!newF->hasLocalLinkage())
+      newF->setVisibility(GlobalValue::HiddenVisibility);
+  }
+  if(!aZero)
+    switcher->setInitializer(ConstantInt::get(tInt, 1));
+  Function* initial = byValue[aZero ? 0 : 1];
+
+  // F itself becomes the sled: a five-byte jump (never a shorter one) to the
+  // variant selected by the switcher's initial value
+  const string name = asmSymbol(F->getName());
+  string sled = "\t.text\n\t.p2align 4\n";
+  if(F->isWeakForLinker())
+    sled += "\t.weak " + name + '\n';
+  else if(!F->hasLocalLinkage())
+    sled += "\t.globl " + name + '\n';
+  if(F->hasHiddenVisibility())
+    sled += "\t.hidden " + name + '\n';
+  else if(F->hasProtectedVisibility())
+    sled += "\t.protected " + name + '\n';
+  sled += "\t.type " + name + ",@function\n" + name + ":\n"
+          "\t.byte 0xe9\n"
+          "\t.long " + asmSymbol(initial->getName()) + " - . - 4\n"
+          "\t.size " + name + ", 5\n";
+  F->deleteBody();
+  M.appendModuleInlineAsm(sled);
+
+  // describe the sled to the runtime library: the sled, its switcher, and
+  // the variant for each switcher value (or null, if none)
+  vector<Constant*> targets;
+  for(vector<Function*>::iterator i = byValue.begin(), e = byValue.end(); i != e; ++i)
+    targets.push_back(*i ? ConstantExpr::getBitCast(*i, tBytePtr)
+                         : ConstantPointerNull::get(tBytePtr));
+  ArrayType* targetsType = ArrayType::get(tBytePtr, targets.size());
+  GlobalVariable* targetsGlobal =
+    new GlobalVariable(M, targetsType, true, GlobalValue::PrivateLinkage,
+                       ConstantArray::get(targetsType, targets),
+                       "__CSI_sled_targets");
+  Constant* fields[] = {
+    ConstantExpr::getBitCast(F, tBytePtr),
+    switcher,
+    ConstantInt::get(Type::getInt64Ty(*Context), targets.size()),
+    ConstantExpr::getBitCast(targetsGlobal, PointerType::getUnqual(tBytePtr)),
+  };
+  Constant* entryInit = ConstantStruct::getAnon(*Context, fields);
+  GlobalVariable* entry =
+    new GlobalVariable(M, entryInit->getType(), true,
+                       GlobalValue::PrivateLinkage, entryInit, "__CSI_sled");
+  entry->setSection("__CSI_sleds");
+  entry->setAlignment(8);
+  vector<GlobalValue*> used(1, entry);
+  markUsed(M, used);
+
+  return(F);
+}
+
 void printScheme(vector<pair<string, set<set<string> > > >& schemeData){
   dbgs() << "------Scheme------\n";
   for(vector<pair<string, set<set<string> > > >::iterator i = schemeData.begin(), e = schemeData.end(); i != e; ++i){
@@ -275,7 +605,21 @@ static void verifyScheme(const vector<pair<string, set<set<string> > > >& scheme
   }
 }
 
-static vector<pair<string, set<set<string> > > > readScheme(istream& in){
+// Reads a "[PT=n]" path array size entry from a scheme line
+static unsigned readPathArraySize(const string& entry){
+  const string size = entry.substr(4, entry.length() - 5);
+  if(size.empty() || size.find_first_not_of("0123456789") != string::npos)
+    report_fatal_error("invalid path array size in entry '" + entry + "' in instrumentation schema", false);
+  
+  const unsigned long result = strtoul(size.c_str(), NULL, 10);
+  if(result == 0 || result > UINT_MAX)
+    report_fatal_error("path array size out of range in entry '" + entry + "' in instrumentation schema", false);
+  return(result);
+}
+
+// Reads the scheme, one entry per line.  pathSizes receives the path array
+// size given on each line (or 0 if none was given).
+static vector<pair<string, set<set<string> > > > readScheme(istream& in, vector<unsigned>& pathSizes){
   vector<string> lines;
   string s;
   while(getline(in, s)){
@@ -297,9 +641,14 @@ static vector<pair<string, set<set<string> > > > readScheme(istream& in){
     
     string fnPattern = entries[0];
     set<set<string> > schemes;
+    unsigned pathSize = 0;
     for(vector<string>::iterator j = ++entries.begin(), je = entries.end(); j != je; ++j){
       string scheme = *j;
       transform(scheme.begin(), scheme.end(), scheme.begin(), ::toupper);
+      if(scheme.compare(0, 4, "[PT=") == 0 && scheme[scheme.length()-1] == ']'){
+        pathSize = readPathArraySize(scheme);
+        continue;
+      }
       if(scheme[0] != '{' || scheme[scheme.length()-1] != '}')
         report_fatal_error("invalid formatting for entry '" + scheme + "' in instrumentation schema", false);
       scheme.erase(0, 1);
@@ -315,7 +664,10 @@ static vector<pair<string, set<set<string> > > > readScheme(istream& in){
       schemes.insert(methodsSet);
     }
     
+    if(schemes.empty())
+      report_fatal_error("invalid formatting for line '" + *i + "' in instrumentation schema", false);
     result.push_back(make_pair(fnPattern, schemes));
+    pathSizes.push_back(pathSize);
   }
   
   return(result);
@@ -327,18 +679,109 @@ static void labelInstructions(Function& F){
     attachCSILabelToInstruction(*i, csi_inst::to_string(label++));
 }
 
+// Returns the call just before an unconditional branch to a shared return
+// block, if that call's result (if any) is what the block returns
+static CallInst* callBeforeReturn(BasicBlock& pred, PHINode* returned){
+  BranchInst* branch = dyn_cast<BranchInst>(pred.getTerminator());
+  if(!branch || branch->isConditional())
+    return(NULL);
+
+  // skip over any debug intrinsics between the call and the branch
+  BasicBlock::iterator i(branch);
+  while(i != pred.begin()){
+    --i;
+    if(isa<DbgInfoIntrinsic>(&*i))
+      continue;
+
+    CallInst* call = dyn_cast<CallInst>(&*i);
+    if(!call || call->isInlineAsm() || isa<IntrinsicInst>(call))
+      return(NULL);
+    if(returned && returned->getIncomingValueForBlock(&pred) != call)
+      return(NULL);
+    return(call);
+  }
+  return(NULL);
+}
+
+// Folds each block holding nothing but a return (and the phi node of its
+// value) into the predecessors whose last act is a call.  Code generation
+// does the same before emitting tail calls, but by then instrumentation of
+// the shared block would sit between the call and the return.
+static void duplicateTailReturns(Function& F){
+  vector<BasicBlock*> blocks;
+  for(Function::iterator b = F.begin(), e = F.end(); b != e; ++b)
+    blocks.push_back(&*b);
+
+  for(vector<BasicBlock*>::iterator b = blocks.begin(), e = blocks.end(); b != e; ++b){
+    BasicBlock* block = *b;
+    ReturnInst* ret = dyn_cast<ReturnInst>(block->getTerminator());
+    if(!ret)
+      continue;
+    PHINode* returned = NULL;
+    if(Value* value = ret->getReturnValue()){
+      returned = dyn_cast<PHINode>(value);
+      if(!returned || returned->getParent() != block)
+        continue;
+    }
+    bool onlyReturn = true;
+    for(BasicBlock::iterator i = block->begin(), ie = block->end(); i != ie; ++i)
+      if(&*i != ret && &*i != returned && !isa<DbgInfoIntrinsic>(&*i))
+        onlyReturn = false;
+    if(!onlyReturn)
+      continue;
+
+    vector<BasicBlock*> preds(pred_begin(block), pred_end(block));
+    for(vector<BasicBlock*>::iterator p = preds.begin(), pe = preds.end(); p != pe; ++p){
+      CallInst* call = callBeforeReturn(**p, returned);
+      if(!call)
+        continue;
+      TerminatorInst* branch = (*p)->getTerminator();
+      ReturnInst* own = ReturnInst::Create(F.getContext(),
+                                           returned ? call : NULL, branch);
+      own->setDebugLoc(ret->getDebugLoc());
+      branch->eraseFromParent();
+      block->removePredecessor(*p);
+    }
+    if(pred_begin(block) == pred_end(block))
+      block->eraseFromParent();
+  }
+}
+
+// Splits each critical edge of F.  Path tracing splits the critical edges
+// that it instruments, so a function traced in only some variants is split
+// beforehand: otherwise its traced variants would have more basic blocks
+// than their untraced twins, and the two could not share coverage arrays.
+static void splitCriticalEdges(Function& F){
+  vector<BasicBlock*> blocks;
+  for(Function::iterator b = F.begin(), e = F.end(); b != e; ++b)
+    blocks.push_back(&*b);
+
+  for(vector<BasicBlock*>::iterator b = blocks.begin(), e = blocks.end(); b != e; ++b){
+    TerminatorInst* terminator = (*b)->getTerminator();
+    for(unsigned succ = 0, n = terminator->getNumSuccessors(); succ < n; ++succ)
+      SplitCriticalEdge(terminator, succ);
+  }
+}
+
 // Entry point of the module
 bool PrepareCSI::runOnModule(Module &M){
-  // first, label all instructions in all functions in the module (so later
+  // calls in tail position get returns of their own before anything else
+  // changes, so that every variant sees the same blocks
+  if(TailCalls)
+    for(Module::iterator F = M.begin(), e = M.end(); F != e; ++F)
+      duplicateTailReturns(*F);
+
+  // then, label all instructions in all functions in the module (so later
   // passes can have a unique identifier for each instruction)
   for(Module::iterator F = M.begin(), e = M.end(); F != e; ++F)
     labelInstructions(*F);
 
   // then, proceed with reading in scheme data
   vector<pair<string, set<set<string> > > > schemeData;
+  vector<unsigned> schemePathSizes;
   if(VariantsFile.empty()){
     outs() << "Reading stdin for instrumentation scheme...\n";
-    schemeData = readScheme(cin);
+    schemeData = readScheme(cin, schemePathSizes);
     outs() << "Finished reading stdin for scheme\n";
   }
   else{
@@ -346,7 +789,7 @@ bool PrepareCSI::runOnModule(Module &M){
     if(!inFile || !inFile.is_open())
       report_fatal_error("cannot open specified instrumentation scheme file: " +
                          VariantsFile);
-    schemeData = readScheme(inFile);
+    schemeData = readScheme(inFile, schemePathSizes);
   }
   
   DEBUG(printScheme(schemeData));
@@ -361,6 +804,7 @@ bool PrepareCSI::runOnModule(Module &M){
   
   // Find the matching pattern for each function
   map<Function*, set<set<string> > > matches;
+  map<Function*, unsigned> matchPathSizes;
   for(Module::iterator F = M.begin(), E = M.end(); F != E; ++F){
     if(F->isDeclaration() || F->isIntrinsic())
       continue;
@@ -368,6 +812,7 @@ bool PrepareCSI::runOnModule(Module &M){
     for(vector<pair<string, set<set<string> > > >::iterator i = schemeData.begin(), e = schemeData.end(); i != e; ++i){
       if(patternMatch(F->getName(), i->first)){
         matches[&*F] = i->second;
+        matchPathSizes[&*F] = schemePathSizes[i - schemeData.begin()];
         found = true;
         break;
       }
@@ -411,7 +856,20 @@ bool PrepareCSI::runOnModule(Module &M){
       }
     }
     
-    switch (replicas.size()) {
+    // when sampling, each scheme with path tracing also needs a twin without
+    // it, which runs whenever the call is not sampled
+    set<set<string> > twins;
+    if(SamplePeriod > 0){
+      for(set<set<string> >::const_iterator j = replicas.begin(), je = replicas.end(); j != je; ++j){
+        if(j->count("PT")){
+          set<string> twin = *j;
+          twin.erase("PT");
+          twins.insert(twin);
+        }
+      }
+    }
+    
+    switch (twins.empty() ? replicas.size() : replicas.size() + 1) {
     case 0:
       continue;
     case 1: {
@@ -419,6 +877,7 @@ bool PrepareCSI::runOnModule(Module &M){
       const set<string>& scheme = *(replicas.begin());
       for(set<string>::iterator j = scheme.begin(), je = scheme.end(); j != je; ++j)
         addInstrumentationType(*F, *j);
+      setPathArraySize(*F, matchPathSizes[F]);
       break;
     }
     default:
@@ -429,9 +888,13 @@ bool PrepareCSI::runOnModule(Module &M){
         continue;
       }
       
-      // make a function for each scheme
-      vector<Function*> funcReplicas;
-      for(set<set<string> >::iterator j = replicas.begin(), je = replicas.end(); j != je; ++j){
+      // make a function for each scheme (and each sampling twin)
+      if(!twins.empty())
+        splitCriticalEdges(*F);
+      set<set<string> > allSchemes = replicas;
+      allSchemes.insert(twins.begin(), twins.end());
+      map<set<string>, Function*> schemeReplicas;
+      for(set<set<string> >::iterator j = allSchemes.begin(), je = allSchemes.end(); j != je; ++j){
         ValueToValueMapTy valueMap;
         SmallVector<ReturnInst*, 1> returns;
         Function* newF = CloneFunction(F, valueMap,
@@ -447,12 +910,31 @@ bool PrepareCSI::runOnModule(Module &M){
           name += '$' + *k;
           addInstrumentationType(*newF, *k);
         }
+        setPathArraySize(*newF, matchPathSizes[F]);
         newF->setName(name);
         
+#if LLVM_VERSION < 30900
         // NOTE: this does not preserve function ordering, thus it could
         // randomly slightly impact performance positively or negatively
+        // (newer versions of CloneFunction add the clone to the module)
         F->getParent()->getFunctionList().push_back(newF);
-        funcReplicas.push_back(newF);
+#endif
+        schemeReplicas[*j] = newF;
+      }
+      
+      // only the requested schemes are selectable by the switcher; twins are
+      // reached through sampling
+      vector<Function*> funcReplicas;
+      vector<Function*> untracedReplicas;
+      for(set<set<string> >::iterator j = replicas.begin(), je = replicas.end(); j != je; ++j){
+        funcReplicas.push_back(schemeReplicas[*j]);
+        Function* twin = NULL;
+        if(!twins.empty() && j->count("PT")){
+          set<string> twinScheme = *j;
+          twinScheme.erase("PT");
+          twin = schemeReplicas[twinScheme];
+        }
+        untracedReplicas.push_back(twin);
       }
       
       // assign this function a global switcher variable
@@ -462,15 +944,29 @@ bool PrepareCSI::runOnModule(Module &M){
          F->hasAvailableExternallyLinkage()
          ? GlobalValue::WeakAnyLinkage
          : GlobalValue::ExternalLinkage;
+      // switchers stay writable, so that programs (and the runtime library)
+      // may choose a different variant while running
       GlobalVariable * const functionGlobal =
-         new GlobalVariable(M, tInt, true, linkage,
+         new GlobalVariable(M, tInt, false, linkage,
                             ConstantInt::get(tInt, 0), globalName);
       
       functionGlobal->setSection("__CSI_func_inst");
 
+      // counters are written on every call, so keep them away from the
+      // read-mostly switchers
+      GlobalVariable* callsGlobal = NULL;
+      if(VariantTable && CountCalls){
+        IntegerType* tCount = Type::getInt64Ty(*Context);
+        callsGlobal = new GlobalVariable(M, tCount, false, linkage,
+                                         ConstantInt::get(tCount, 0),
+                                         "__CSI_calls_"+getUniqueCFunctionName(*F));
+        callsGlobal->setSection("__CSI_calls");
+      }
+
       // set up the trampoline call for this function
       switch(TrampolineStyle){
-        case Ifunc: if(F->getLinkage() != GlobalValue::InternalLinkage){
+        case Ifunc: if(F->getLinkage() != GlobalValue::InternalLinkage &&
+                       twins.empty()){
                       // we may be able to change linkage on static functions so
                       // they can be used with ifunc, but this has the potential
                       // for name collisions, and the performance impact should
@@ -478,8 +974,24 @@ bool PrepareCSI::runOnModule(Module &M){
                       ifuncIndirect(F, functionGlobal, funcReplicas);
                       break;
                     }
+                    // intentional fallthrough (an ifunc resolver runs only
+                    // once, so it cannot sample either)
+        case Patch: if(TrampolineStyle == Patch && twins.empty() &&
+                       canPatch(M, *F)){
+                      // a jump does not count calls
+                      if(VariantTable)
+                        describeVariants(M, functionGlobal, F->getName(),
+                                         replicas, NULL);
+                      patchIndirect(F, functionGlobal, funcReplicas);
+                      break;
+                    }
                     // intentional fallthrough
-        case Std:   switchIndirect(F, functionGlobal, funcReplicas); break;
+        case Std:   if(VariantTable)
+                      describeVariants(M, functionGlobal, F->getName(),
+                                       replicas, callsGlobal);
+                    switchIndirect(F, functionGlobal, funcReplicas,
+                                   untracedReplicas, callsGlobal);
+                    break;
         default:    llvm_unreachable_internal("bad indirect function style value");
       }
     }
@@ -53,18 +53,33 @@ private:
   std::map<const llvm::Function*, std::set<std::string> > functionSchemes;
 #endif
   
+  // path array sizes requested by the scheme ("[PT=n]" entries)
+  std::map<const llvm::Function*, unsigned> pathArraySizes;
+  
   // functions to create the trampoline function
   // NOTE: this returns a function which is now F (but as a trampoline).  The
   // return value may or may not be F, and, in fact, it is possible after this
   // call that F no longer exists.  All future references to F should be changed
   // to the return value.  The function will, however, fix all existing
   // references to F (in the bitcode).
+  // (switchIndirect also handles sampled path tracing: if untraced[i] is
+  // not NULL, a per-thread countdown chooses between replicas[i] and
+  // untraced[i] on each call.  If calls is not NULL, each call also adds
+  // one to it)
   llvm::Function* switchIndirect(llvm::Function* F,
                                  llvm::GlobalVariable* switcher,
-                                 std::vector<llvm::Function*>& replicas);
+                                 std::vector<llvm::Function*>& replicas,
+                                 std::vector<llvm::Function*>& untraced,
+                                 llvm::GlobalVariable* calls);
   llvm::Function* ifuncIndirect(llvm::Function* F,
                                 llvm::GlobalVariable* switcher,
                                 std::vector<llvm::Function*>& replicas);
+  // (patchIndirect replaces F's body with a direct jump to one replica,
+  // described in section __CSI_sleds, which the runtime library retargets
+  // whenever asked to apply a changed switcher)
+  llvm::Function* patchIndirect(llvm::Function* F,
+                                llvm::GlobalVariable* switcher,
+                                std::vector<llvm::Function*>& replicas);
   
   // Analyzes all functions, duplicates, and creates the dispatcher
   bool runOnModule(llvm::Module &M);
@@ -80,9 +95,16 @@ public:
   // does the specified function require the specified instrumentation?
   bool hasInstrumentationType(const llvm::Function &, const std::string &type) const;
   
+  // the path array size requested for the specified function by the scheme,
+  // or 0 if the scheme leaves the choice to path tracing
+  unsigned getPathArraySize(const llvm::Function &) const;
+  
 private:
   // mark the specified function as requiring the specified instrumentation
   void addInstrumentationType(llvm::Function &F, const std::string &type);
+  
+  // record the scheme's path array size for the specified function
+  void setPathArraySize(llvm::Function &F, unsigned size);
 };
 } // end csi_inst namespace
 
@@ -0,0 +1,216 @@
+//===------------------------------ Probes.cpp ----------------------------===//
+//
+// These module passes let the optimizer move and merge the memory accesses
+// of CSI instrumentation ("probes"), and then restore their strictness once
+// optimization is done.
+//
+//===----------------------------------------------------------------------===//
+//
+// Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+#define DEBUG_TYPE "probes"
+
+#include "Probes.h"
+#include "Utils.hpp"
+
+#include <llvm/Support/Debug.h>
+#include <llvm/Support/raw_ostream.h>
+
+#if LLVM_VERSION < 30300
+#include <llvm/InlineAsm.h>
+#else
+#include <llvm/IR/InlineAsm.h>
+#endif
+
+#include "llvm_proxy/InstIterator.h"
+#include "llvm_proxy/IntrinsicInst.h"
+#include "llvm_proxy/Module.h"
+
+#include <map>
+#include <set>
+
+using namespace csi_inst;
+using namespace llvm;
+using namespace std;
+
+char RelaxProbes::ID = 0;
+static RegisterPass<RelaxProbes> X("csi-probes",
+                "Let optimization move and merge instrumentation probes",
+                false, false);
+
+char LowerProbes::ID = 0;
+static RegisterPass<LowerProbes> Y("csi-lower-probes",
+                "Lower optimized instrumentation probes to strict accesses",
+                false, false);
+
+// Takes the address of memory whose contents must be treated as observed
+static const char * const KEEP_FUNCTION = "__CSI_probe_keep";
+
+static void setOrdering(StoreInst &store, bool atomic){
+#if LLVM_VERSION < 30900
+  store.setOrdering(atomic ? Unordered : NotAtomic);
+#else
+  store.setOrdering(atomic ? AtomicOrdering::Unordered
+                           : AtomicOrdering::NotAtomic);
+#endif
+}
+
+static bool isUnordered(const StoreInst &store){
+#if LLVM_VERSION < 30900
+  return(store.getOrdering() == Unordered);
+#else
+  return(store.getOrdering() == AtomicOrdering::Unordered);
+#endif
+}
+
+static bool storesToCoverage(StoreInst &store){
+  GlobalVariable* global =
+    dyn_cast<GlobalVariable>(underlyingObject(store.getPointerOperand()));
+  return(global && isCoverageGlobal(*global));
+}
+
+bool RelaxProbes::runOnModule(Module &M){
+  Type* tBytePtr = Type::getInt8PtrTy(M.getContext());
+  Type* keepArgs[] = { tBytePtr };
+  FunctionType* keepType = FunctionType::get(Type::getVoidTy(M.getContext()),
+                                             keepArgs, false);
+  Constant* keep = NULL;
+
+  bool changed = false;
+  for(Module::iterator F = M.begin(), E = M.end(); F != E; ++F){
+    if(F->isDeclaration())
+      continue;
+
+    // keep each local observed, from just after its alloca: instrumentation
+    // may have initialized earlier locals before allocating later ones
+    set<Value*> locals;
+    BasicBlock& entry = F->getEntryBlock();
+    for(BasicBlock::iterator i = entry.begin(), e = entry.end(); i != e; ++i)
+      if(AllocaInst* alloca = dyn_cast<AllocaInst>(&*i))
+        if(isInstrumentationLocal(*alloca))
+          locals.insert(alloca);
+    for(set<Value*>::iterator i = locals.begin(), e = locals.end(); i != e; ++i){
+      if(!keep){
+        keep = M.getOrInsertFunction(KEEP_FUNCTION, keepType);
+        if(Function* keepFunction = dyn_cast<Function>(keep))
+          keepFunction->setDoesNotThrow();
+      }
+      BasicBlock::iterator keepPoint(cast<Instruction>(*i));
+      ++keepPoint;
+      BitCastInst* bytes = new BitCastInst(*i, tBytePtr, "", &*keepPoint);
+      Value * const args[] = { bytes };
+      CallInst::Create(keep, args, "", &*keepPoint);
+    }
+
+    for(inst_iterator i = inst_begin(*F), e = inst_end(*F); i != e; ++i){
+      if(LoadInst* load = dyn_cast<LoadInst>(&*i)){
+        if(load->isVolatile() &&
+           locals.count(underlyingObject(load->getPointerOperand())))
+          load->setVolatile(false);
+      }
+      else if(StoreInst* store = dyn_cast<StoreInst>(&*i)){
+        if(store->isVolatile() &&
+           locals.count(underlyingObject(store->getPointerOperand())))
+          store->setVolatile(false);
+        else if(isUnordered(*store) &&
+                isa<Constant>(store->getValueOperand()) &&
+                storesToCoverage(*store))
+          setOrdering(*store, false);
+        else
+          continue;
+        changed = true;
+      }
+    }
+    changed |= !locals.empty();
+  }
+
+  return(changed);
+}
+
+bool LowerProbes::runOnModule(Module &M){
+  bool changed = false;
+
+  // find the memory kept observed in each function
+  map<Function*, set<Value*> > kept;
+  vector<CallInst*> keepCalls;
+  if(Function* keep = M.getFunction(KEEP_FUNCTION)){
+#if LLVM_VERSION < 30500
+    for(Value::use_iterator i = keep->use_begin(), e = keep->use_end(); i != e; ++i)
+#else
+    for(Value::user_iterator i = keep->user_begin(), e = keep->user_end(); i != e; ++i)
+#endif
+      if(CallInst* call = dyn_cast<CallInst>(*i)){
+        kept[call->getParent()->getParent()].insert(
+          underlyingObject(call->getArgOperand(0)));
+        keepCalls.push_back(call);
+      }
+
+    // an empty statement that reads its argument and may touch any memory
+    InlineAsm* anchor = InlineAsm::get(keep->getFunctionType(), "",
+                                       "r,~{memory}", true);
+    for(vector<CallInst*>::iterator i = keepCalls.begin(), e = keepCalls.end(); i != e; ++i){
+      Value * const args[] = { (*i)->getArgOperand(0) };
+      CallInst::Create(anchor, args, "", *i);
+      (*i)->eraseFromParent();
+    }
+    if(keep->use_empty())
+      keep->eraseFromParent();
+    changed = !keepCalls.empty();
+  }
+
+  for(Module::iterator F = M.begin(), E = M.end(); F != E; ++F){
+    if(F->isDeclaration())
+      continue;
+    const set<Value*>& objects = kept[&*F];
+
+    for(inst_iterator i = inst_begin(*F), e = inst_end(*F); i != e; ++i){
+      if(LoadInst* load = dyn_cast<LoadInst>(&*i)){
+        if(!load->isVolatile() &&
+           objects.count(underlyingObject(load->getPointerOperand()))){
+          load->setVolatile(true);
+          changed = true;
+        }
+      }
+      else if(StoreInst* store = dyn_cast<StoreInst>(&*i)){
+        if(objects.count(underlyingObject(store->getPointerOperand()))){
+          store->setVolatile(true);
+          changed = true;
+        }
+        else if(!store->isAtomic() && storesToCoverage(*store)){
+          // optimization may have merged stores into wider ones; only
+          // those that are still atomic-sized can be unordered again
+          Type& type = *store->getValueOperand()->getType();
+          const uint64_t bytes = getTypeStoreSize(M, type);
+          if(type.isIntegerTy() && (bytes & (bytes - 1)) == 0 && bytes <= 8 &&
+             (!store->getAlignment() || store->getAlignment() >= bytes)){
+            setOrdering(*store, true);
+            changed = true;
+          }
+        }
+      }
+      else if(MemIntrinsic* memory = dyn_cast<MemIntrinsic>(&*i)){
+        if(objects.count(underlyingObject(memory->getRawDest()))){
+          memory->setVolatile(ConstantInt::getTrue(M.getContext()));
+          changed = true;
+        }
+      }
+    }
+    DEBUG(if(!objects.empty())
+            dbgs() << "Function " << F->getName() << ": lowered probes on "
+                   << objects.size() << " kept objects\n");
+  }
+
+  return(changed);
+}
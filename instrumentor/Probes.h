@@ -0,0 +1,74 @@
+//===------------------------------- Probes.h -----------------------------===//
+//
+// These module passes let the optimizer move and merge the memory accesses
+// of CSI instrumentation ("probes"), and then restore their strictness once
+// optimization is done.
+//
+//===----------------------------------------------------------------------===//
+//
+// Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+#ifndef CSI_PROBES_H
+#define CSI_PROBES_H
+
+#include "PassName.h"
+
+#include <llvm/Pass.h>
+
+namespace csi_inst {
+
+// ---------------------------------------------------------------------------
+// RelaxProbes is a module pass that must run after all instrumentation, but
+// before ShadowStack.  Each instrumentation local is passed once, on entry,
+// to the marker function __CSI_probe_keep, so that the optimizer must assume
+// its contents are observed.  Volatile accesses to the locals then become
+// ordinary ones, and the unordered stores of constants to global coverage
+// arrays become non-atomic.
+// ---------------------------------------------------------------------------
+class RelaxProbes : public llvm::ModulePass {
+private:
+  bool runOnModule(llvm::Module &M);
+
+public:
+  static char ID; // Pass identification, replacement for typeid
+  RelaxProbes() : ModulePass(ID) {}
+
+  virtual PassName getPassName() const {
+    return "CSI Relaxation of Instrumentation Probes";
+  }
+};
+
+// ---------------------------------------------------------------------------
+// LowerProbes is a module pass that runs on optimized bitcode.  Accesses to
+// memory passed to __CSI_probe_keep become volatile again, stores to global
+// coverage arrays become unordered again, and each marker call becomes an
+// empty inline assembly statement, which still keeps its argument observed
+// but emits no code.
+// ---------------------------------------------------------------------------
+class LowerProbes : public llvm::ModulePass {
+private:
+  bool runOnModule(llvm::Module &M);
+
+public:
+  static char ID; // Pass identification, replacement for typeid
+  LowerProbes() : ModulePass(ID) {}
+
+  virtual PassName getPassName() const {
+    return "CSI Lowering of Instrumentation Probes";
+  }
+};
+} // end csi_inst namespace
+
+#endif
@@ -0,0 +1,339 @@
+//===--------------------------- ShadowStack.cpp --------------------------===//
+//
+// This module pass moves the stack-local variables of the other CSI
+// instrumentation passes into one record per frame on a per-thread shadow
+// stack, which is owned by the CSI runtime library.
+//
+//===----------------------------------------------------------------------===//
+//
+// Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+#define DEBUG_TYPE "shadow-stack"
+
+#include "ShadowStack.h"
+#include "Utils.hpp"
+
+#include <llvm/Support/Debug.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "llvm_proxy/IntrinsicInst.h"
+#include "llvm_proxy/IRBuilder.h"
+#include "llvm_proxy/Module.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <sstream>
+
+using namespace csi_inst;
+using namespace llvm;
+using namespace std;
+
+namespace {
+  // Whether a local is not among those zeroed on entry
+  struct NotZeroed {
+    const set<AllocaInst*>& zeroed;
+    NotZeroed(const set<AllocaInst*>& zeroed) : zeroed(zeroed) {}
+    bool operator()(AllocaInst* local) const {
+      return !zeroed.count(local);
+    }
+  };
+}
+
+char ShadowStack::ID = 0;
+static RegisterPass<ShadowStack> X("shadow-stack",
+                "Move instrumentation variables to a per-thread shadow stack",
+                false, false);
+
+// Words in each record's header: function address, layout, and size
+static const uint64_t HEADER_WORDS = 3;
+
+static GlobalVariable* declareThreadLocal(Module& M, Type* type,
+                                          const char* name){
+  GlobalVariable* global = M.getGlobalVariable(name);
+  if(!global)
+    global = new GlobalVariable(M, type, false, GlobalValue::ExternalLinkage,
+                                NULL, name, NULL,
+#if LLVM_VERSION < 30200
+                                true
+#else
+                                GlobalVariable::GeneralDynamicTLSModel
+#endif
+                                );
+  return(global);
+}
+
+void ShadowStack::declareRuntime(Module &M){
+  Type* tBytePtr = Type::getInt8PtrTy(*Context);
+  shadowTop = declareThreadLocal(M, tBytePtr, "__CSI_shadow_top");
+  shadowLimit = declareThreadLocal(M, tBytePtr, "__CSI_shadow_limit");
+
+  Type* growArgs[] = { Type::getInt64Ty(*Context) };
+  FunctionType* growType = FunctionType::get(tBytePtr, growArgs, false);
+  shadowGrow = M.getOrInsertFunction("__CSI_shadow_grow", growType);
+}
+
+// Whether inst zeroes all of local (as createZeroedLocalArray and the
+// path hash table do on entry)
+static bool zeroesLocal(const Module &M, Instruction &inst,
+                        AllocaInst &local){
+  MemSetInst* memset = dyn_cast<MemSetInst>(&inst);
+  if(!memset || memset->getDest()->stripPointerCasts() != &local)
+    return false;
+  ConstantInt* value = dyn_cast<ConstantInt>(memset->getValue());
+  ConstantInt* length = dyn_cast<ConstantInt>(memset->getLength());
+  return value && value->isZero() && length &&
+         length->getZExtValue() ==
+           getTypeStoreSize(M, *local.getAllocatedType());
+}
+
+void ShadowStack::moveToShadowStack(Function &F,
+                                    vector<AllocaInst*> locals){
+  Module& M = *F.getParent();
+  IntegerType* tWord = Type::getInt64Ty(*Context);
+  Type* tBytePtr = Type::getInt8PtrTy(*Context);
+  BasicBlock& entry = F.getEntryBlock();
+
+  // locals zeroed on entry go last, so that one memset clears them all
+  set<AllocaInst*> zeroed;
+  vector<Instruction*> memsets;
+  for(BasicBlock::iterator i = entry.begin(), e = entry.end(); i != e; ++i)
+    for(vector<AllocaInst*>::iterator l = locals.begin(), le = locals.end(); l != le; ++l)
+      if(zeroesLocal(M, *i, **l)){
+        zeroed.insert(*l);
+        memsets.push_back(&*i);
+        break;
+      }
+  for(vector<Instruction*>::iterator i = memsets.begin(), e = memsets.end(); i != e; ++i){
+    Instruction* dest = dyn_cast<Instruction>(cast<MemSetInst>(*i)->getRawDest());
+    (*i)->eraseFromParent();
+    if(dest && dest->use_empty() && !isa<AllocaInst>(dest))
+      dest->eraseFromParent();
+  }
+  vector<AllocaInst*>::iterator firstZeroed =
+    stable_partition(locals.begin(), locals.end(), NotZeroed(zeroed));
+
+  // lay out the record: the header, then each local in its own 8-byte
+  // aligned slot, padded so that records stay 16-byte aligned
+  vector<uint64_t> offsets;
+  ostringstream layout;
+  uint64_t size = HEADER_WORDS * 8;
+  uint64_t zeroedOffset = 0;
+  for(vector<AllocaInst*>::iterator i = locals.begin(), e = locals.end(); i != e; ++i){
+    const uint64_t bytes = getTypeStoreSize(M, *(*i)->getAllocatedType());
+    if(i != locals.begin())
+      layout << ';';
+    layout << (*i)->getName().str() << '=' << size << '+' << bytes;
+    if(i == firstZeroed)
+      zeroedOffset = size;
+    offsets.push_back(size);
+    size += (bytes + 7) & ~7ULL;
+  }
+  size = (size + 15) & ~15ULL;
+  DEBUG(dbgs() << "Function " << F.getName() << ": " << size
+               << "-byte record " << layout.str() << '\n');
+
+  // keep every other static alloca in the entry block, ahead of the push
+  vector<AllocaInst*> allocas;
+  Instruction* pushPoint = NULL;
+  for(BasicBlock::iterator i = entry.begin(), e = entry.end(); i != e; ++i){
+    AllocaInst* alloca = dyn_cast<AllocaInst>(&*i);
+    if(alloca && isa<Constant>(alloca->getArraySize())){
+      if(pushPoint && !isInstrumentationLocal(*alloca))
+        allocas.push_back(alloca);
+    }
+    else if(!pushPoint && !isa<DbgInfoIntrinsic>(&*i))
+      pushPoint = &*i;
+  }
+  for(vector<AllocaInst*>::iterator i = allocas.begin(), e = allocas.end(); i != e; ++i)
+    (*i)->moveBefore(pushPoint);
+
+  // push: bump the stack top, unless the record does not fit (or this
+  // thread has no shadow stack yet), in which case the runtime allocates it
+  LoadInst* top = new LoadInst(shadowTop, "shadowTop", pushPoint);
+  Value * const endIndices[] = {
+    ConstantInt::get(tWord, size),
+  };
+  GetElementPtrInst* end = GetElementPtrInst::Create(top, endIndices,
+                                                     "shadowEnd", pushPoint);
+  LoadInst* limit = new LoadInst(shadowLimit, "shadowLimit", pushPoint);
+  ICmpInst* full = new ICmpInst(pushPoint, CmpInst::ICMP_UGT, end, limit,
+                                "shadowFull");
+
+  BasicBlock* pushed = entry.splitBasicBlock(pushPoint, "shadow.pushed");
+  BasicBlock* grow = BasicBlock::Create(*Context, "shadow.grow", &F, pushed);
+  BasicBlock* bumped = &entry;
+  if(firstZeroed != locals.end()){
+    // a grown record is fresh from the runtime's mmap, so it is already
+    // zero; only a reused one is cleared
+    bumped = BasicBlock::Create(*Context, "shadow.clear", &F, grow);
+    Value * const zeroedIndices[] = {
+      ConstantInt::get(tWord, zeroedOffset),
+    };
+    GetElementPtrInst* zeroedSlots =
+      GetElementPtrInst::CreateInBounds(top, zeroedIndices, "shadowZeroed",
+                                        bumped);
+    IRBuilder<> builder(bumped);
+    builder.CreateMemSet(zeroedSlots, builder.getInt8(0), size - zeroedOffset,
+                         8, true);
+    builder.CreateBr(pushed);
+  }
+  entry.getTerminator()->eraseFromParent();
+  BranchInst::Create(grow, bumped == &entry ? pushed : bumped, full, &entry);
+  Value * const growArgs[] = {
+    ConstantInt::get(tWord, size),
+  };
+  CallInst* grown = CallInst::Create(shadowGrow, growArgs, "shadowGrown", grow);
+  BranchInst::Create(pushed, grow);
+
+  PHINode* record = PHINode::Create(tBytePtr, 2, "shadowRecord",
+                                    &*pushed->begin());
+  record->addIncoming(top, bumped);
+  record->addIncoming(grown, grow);
+  Instruction* recordPoint = &*pushed->getFirstInsertionPt();
+
+  // fill in the header before publishing the new top, so that a walker
+  // never sees a record without one
+  Constant* layoutInit = ConstantDataArray::getString(*Context, layout.str());
+  GlobalVariable* layoutGlobal =
+    new GlobalVariable(M, layoutInit->getType(), true,
+                       GlobalValue::PrivateLinkage, layoutInit,
+                       "__CSI_shadow_layout");
+  Constant* header[HEADER_WORDS] = {
+    ConstantExpr::getPtrToInt(&F, tWord),
+    ConstantExpr::getPtrToInt(layoutGlobal, tWord),
+    ConstantInt::get(tWord, size),
+  };
+  BitCastInst* headerWords =
+    new BitCastInst(record, PointerType::getUnqual(tWord), "shadowHeader",
+                    recordPoint);
+  for(uint64_t i = 0; i < HEADER_WORDS; ++i){
+    Value * const wordIndices[] = {
+      ConstantInt::get(tWord, i),
+    };
+    GetElementPtrInst* word =
+      GetElementPtrInst::CreateInBounds(headerWords, wordIndices,
+                                        "shadowHeaderWord", recordPoint);
+    new StoreInst(header[i], word, true, recordPoint);
+  }
+  Value * const topIndices[] = {
+    ConstantInt::get(tWord, size),
+  };
+  GetElementPtrInst* newTop =
+    GetElementPtrInst::CreateInBounds(record, topIndices, "shadowNewTop",
+                                      recordPoint);
+  new StoreInst(newTop, shadowTop, true, recordPoint);
+
+  // replace each local with its slot
+  map<Value*, uint64_t> slotOffsets;
+  for(size_t i = 0; i < locals.size(); ++i){
+    Value * const slotIndices[] = {
+      ConstantInt::get(tWord, offsets[i]),
+    };
+    GetElementPtrInst* slot =
+      GetElementPtrInst::CreateInBounds(record, slotIndices, "shadowSlot",
+                                        recordPoint);
+    BitCastInst* local = new BitCastInst(slot, locals[i]->getType(), "",
+                                         recordPoint);
+    local->takeName(locals[i]);
+    locals[i]->replaceAllUsesWith(local);
+    locals[i]->eraseFromParent();
+    slotOffsets[local] = offsets[i];
+  }
+
+#if LLVM_VERSION >= 30700
+  // describe each local to debuggers as an offset into the record, rather
+  // than through a cast that need not survive code generation
+  for(Function::iterator bb = F.begin(), e = F.end(); bb != e; ++bb)
+    for(BasicBlock::iterator i = bb->begin(), ie = bb->end(); i != ie; ++i){
+      Value* location;
+      DIExpression* expression;
+      if(DbgDeclareInst* declare = dyn_cast<DbgDeclareInst>(&*i)){
+        location = declare->getAddress();
+        expression = declare->getExpression();
+      }
+      else if(DbgValueInst* value = dyn_cast<DbgValueInst>(&*i)){
+        location = value->getValue();
+        expression = value->getExpression();
+      }
+      else
+        continue;
+      map<Value*, uint64_t>::iterator slot = slotOffsets.find(location);
+      if(slot == slotOffsets.end())
+        continue;
+
+      vector<uint64_t> elements;
+#if LLVM_VERSION < 50000
+      elements.push_back(dwarf::DW_OP_plus);
+#else
+      elements.push_back(dwarf::DW_OP_plus_uconst);
+#endif
+      elements.push_back(slot->second);
+      elements.insert(elements.end(), expression->getElements().begin(),
+                      expression->getElements().end());
+      CallInst* call = cast<CallInst>(&*i);
+      call->setArgOperand(0, MetadataAsValue::get(*Context,
+                                 ValueAsMetadata::get(record)));
+      call->setArgOperand(call->getNumArgOperands() - 1,
+                          MetadataAsValue::get(*Context,
+                            DIExpression::get(*Context, elements)));
+    }
+#endif
+
+  // debug intrinsics left in the entry block may now describe slots
+  vector<Instruction*> debugInsts;
+  for(BasicBlock::iterator i = entry.begin(), e = entry.end(); i != e; ++i)
+    if(isa<DbgInfoIntrinsic>(&*i))
+      debugInsts.push_back(&*i);
+  for(vector<Instruction*>::iterator i = debugInsts.begin(), e = debugInsts.end(); i != e; ++i)
+    (*i)->moveBefore(recordPoint);
+
+  // pop: restore the stack top on every exit.  A call in tail position
+  // reuses this frame, so the record is popped before it.
+  for(Function::iterator bb = F.begin(), e = F.end(); bb != e; ++bb){
+    Instruction* exit = bb->getTerminator();
+    if(!isa<ReturnInst>(exit) && !isa<ResumeInst>(exit))
+      continue;
+    if(CallInst* call = tailCall(*bb))
+      exit = call;
+    new StoreInst(record, shadowTop, true, exit);
+  }
+}
+
+bool ShadowStack::runOnModule(Module &M){
+  Context = &M.getContext();
+
+  bool changed = false;
+  for(Module::iterator F = M.begin(), E = M.end(); F != E; ++F){
+    if(F->isDeclaration())
+      continue;
+
+    vector<AllocaInst*> locals;
+    BasicBlock& entry = F->getEntryBlock();
+    for(BasicBlock::iterator i = entry.begin(), e = entry.end(); i != e; ++i)
+      if(AllocaInst* alloca = dyn_cast<AllocaInst>(&*i))
+        if(isInstrumentationLocal(*alloca))
+          locals.push_back(alloca);
+    if(locals.empty())
+      continue;
+
+    if(!shadowTop)
+      declareRuntime(M);
+    moveToShadowStack(*F, locals);
+    changed = true;
+  }
+
+  return changed;
+}
@@ -0,0 +1,75 @@
+//===---------------------------- ShadowStack.h ---------------------------===//
+//
+// This module pass moves the stack-local variables of the other CSI
+// instrumentation passes into one record per frame on a per-thread shadow
+// stack, which is owned by the CSI runtime library.
+//
+//===----------------------------------------------------------------------===//
+//
+// Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//===----------------------------------------------------------------------===//
+#ifndef CSI_SHADOW_STACK_H
+#define CSI_SHADOW_STACK_H
+
+#include "PassName.h"
+
+#include <llvm/Pass.h>
+
+#include "llvm_proxy/Instructions.h"
+
+#include <vector>
+
+namespace csi_inst {
+
+// ---------------------------------------------------------------------------
+// ShadowStack is a module pass that must run after all other instrumentation.
+// Each record starts with a header of three 64-bit words (the function's
+// address, the address of a string describing the record's layout, and the
+// record's size in bytes), followed by the relocated variables.  Variables
+// that are zeroed on entry come last, so that a single memset clears them.
+// ---------------------------------------------------------------------------
+class ShadowStack : public llvm::ModulePass {
+private:
+  // Current context for multi threading support.
+  llvm::LLVMContext* Context;
+
+  // The runtime's per-thread stack top and limit, and its allocator for
+  // records that do not fit below the limit
+  llvm::GlobalVariable* shadowTop;
+  llvm::GlobalVariable* shadowLimit;
+  llvm::Constant* shadowGrow;
+
+  // Declares the runtime's variables and functions in M
+  void declareRuntime(llvm::Module &M);
+
+  // Pushes a record for F's instrumentation locals on entry, pops it on
+  // exit, and replaces each of the locals with its slot in the record
+  void moveToShadowStack(llvm::Function &F,
+                         std::vector<llvm::AllocaInst*> locals);
+
+  bool runOnModule(llvm::Module &M);
+
+public:
+  static char ID; // Pass identification, replacement for typeid
+  ShadowStack() : ModulePass(ID), Context(NULL), shadowTop(NULL),
+                  shadowLimit(NULL), shadowGrow(NULL) {}
+
+  virtual PassName getPassName() const {
+    return "CSI Shadow Stack for Instrumentation Variables";
+  }
+};
+} // end csi_inst namespace
+
+#endif
@@ -30,6 +30,7 @@
 #include "llvm_proxy/DebugInfo.h"
 #include "llvm_proxy/InstIterator.h"
 #include "llvm_proxy/IRBuilder.h"
+#include "llvm_proxy/IntrinsicInst.h"
 
 #include <llvm/Support/Debug.h>
 #include <llvm/Support/raw_ostream.h>
@@ -272,10 +273,26 @@ Instruction *csi_inst::insertDeclare(DIBuilder &builder, Value *var, DILocalVari
 }
 
 
+Instruction *csi_inst::insertDbgValue(DIBuilder &builder, Value *value, DILocalVariable *varInfo, bool indirect, const DebugLoc &location, Instruction *before)
+{
+  const uint64_t deref[] = { dwarf::DW_OP_deref };
+  DIExpression * const expression {
+    indirect
+      ? builder.createExpression(ArrayRef<uint64_t>(deref))
+      : builder.createExpression()
+  };
+#if LLVM_VERSION < 60000
+  return builder.insertDbgValueIntrinsic(value, 0, varInfo, expression, location, before);
+#else
+  return builder.insertDbgValueIntrinsic(value, varInfo, expression, location, before);
 #endif
+}
 
 
-static uint64_t getTypeStoreSize(const Module &module, Type &type)
+#endif
+
+
+uint64_t csi_inst::getTypeStoreSize(const Module &module, Type &type)
 {
 #if LLVM_VERSION < 30200
   return TargetData(&module).getTypeStoreSize(&type);
@@ -289,6 +306,32 @@ static uint64_t getTypeStoreSize(const Module &module, Type &type)
 }
 
 
+// describe a local instrumentation variable to debuggers
+static void describeLocal(Function &function,
+                          AllocaInst &allocation,
+                          const string &name,
+                          DIBuilder &debugBuilder,
+#if LLVM_VERSION < 30700
+                          const DIType &typeInfo,
+#else
+                          DIType *typeInfo,
+#endif
+                          const DebugLoc &location,
+                          Instruction &before)
+{
+#if LLVM_VERSION < 30700
+  const MDNode * const scope = location.getScope(function.getContext());
+  const DIVariable varInfo = createAutoVariable(debugBuilder, DIDescriptor(scope), name, DIFile(scope), 0, typeInfo);
+#else
+  (void) function;
+  DIScope * const scope { location->getScope() };
+  DIFile * const file { scope->getFile() };
+  DILocalVariable * const varInfo { createAutoVariable(debugBuilder, scope, name, file, 0, typeInfo) };
+#endif
+  insertDeclare(debugBuilder, &allocation, varInfo, location, &before);
+}
+
+
 AllocaInst *csi_inst::createZeroedLocalArray(Function &function,
                                              ArrayType &arrayType,
                                              const string &name,
@@ -316,21 +359,46 @@ AllocaInst *csi_inst::createZeroedLocalArray(Function &function,
     const uint64_t elementCount = arrayType.getNumElements();
 #if LLVM_VERSION < 30700
     const DIType arrayTypeInfo = createArrayType(debugBuilder, elementCount, elementTypeInfo);
-    const MDNode * const scope = location.getScope(module.getContext());
-    const DIVariable arrayVarInfo = createAutoVariable(debugBuilder, DIDescriptor(scope), name, DIFile(scope), 0, arrayTypeInfo);
 #else
     DIType * const arrayTypeInfo { createArrayType(debugBuilder, elementCount, elementTypeInfo) };
-    DIScope * const scope { location->getScope() };
-    DIFile * const file { scope->getFile() };
-    DILocalVariable * const arrayVarInfo { createAutoVariable(debugBuilder, scope, name, file, 0, arrayTypeInfo) };
 #endif
-    insertDeclare(debugBuilder, arrayAllocation, arrayVarInfo, location, &*entryInst);
+    describeLocal(function, *arrayAllocation, name, debugBuilder, arrayTypeInfo, location, *entryInst);
   }
 
   // return allocated array to caller for further use
   return arrayAllocation;
 }
 
+
+AllocaInst *csi_inst::createZeroedLocalMask(Function &function,
+                                            IntegerType &maskType,
+                                            const string &name,
+                                            DIBuilder &debugBuilder,
+#if LLVM_VERSION < 30700
+                                            const DIType &maskTypeInfo,
+#else
+                                            DIType *maskTypeInfo,
+#endif
+                                            bool silent)
+{
+  // find proper insertion point for new alloca and other supporting instructions
+  const BasicBlock::iterator entryInst = function.getEntryBlock().getFirstInsertionPt();
+  IRBuilder<> builder(&*entryInst);
+
+  // allocate stack space for the mask and clear it with a single store
+  AllocaInst * const maskAllocation = builder.CreateAlloca(&maskType, NULL, name);
+  builder.CreateStore(ConstantInt::get(&maskType, 0), maskAllocation, true);
+
+  // set up debug metadata
+  const DebugLoc &location = findEarlyDebugLoc(function, silent);
+  if (!isUnknown(location))
+    describeLocal(function, *maskAllocation, name, debugBuilder, maskTypeInfo, location, *entryInst);
+
+  // return allocated mask to caller for further use
+  return maskAllocation;
+}
+
+
 void csi_inst::attachCSILabelToInstruction(Instruction& inst,
                                            const string& label){
   // based on: http://stackoverflow.com/questions/13425794/adding-metadata-to-instructions-in-llvm-ir
@@ -339,6 +407,111 @@ void csi_inst::attachCSILabelToInstruction(Instruction& inst,
   inst.setMetadata("CSI.label", labelMD);
 }
 
+CallInst *csi_inst::tailCall(BasicBlock &block)
+{
+  ReturnInst * const ret = dyn_cast<ReturnInst>(block.getTerminator());
+  if (!ret)
+    return NULL;
+
+  // skip over any debug intrinsics between the call and the return
+  BasicBlock::iterator i(ret);
+  while (i != block.begin()) {
+    --i;
+    if (isa<DbgInfoIntrinsic>(&*i))
+      continue;
+
+    CallInst * const call = dyn_cast<CallInst>(&*i);
+    if (!call || call->isInlineAsm() || isa<IntrinsicInst>(call))
+      return NULL;
+    const Value * const returned = ret->getReturnValue();
+    if (returned && returned != call)
+      return NULL;
+    return call;
+  }
+  return NULL;
+}
+
+void csi_inst::markUsed(Module &module, const vector<GlobalValue *> &values)
+{
+  Type * const bytePtr = Type::getInt8PtrTy(module.getContext());
+
+  // llvm.used cannot grow in place, so rebuild it with the new entries
+  vector<Constant *> used;
+  if (GlobalVariable * const old = module.getGlobalVariable("llvm.used")) {
+    if (old->hasInitializer())
+      if (const ConstantArray * const entries = dyn_cast<ConstantArray>(old->getInitializer()))
+        for (unsigned i = 0; i < entries->getNumOperands(); ++i)
+          used.push_back(entries->getOperand(i));
+    old->eraseFromParent();
+  }
+  for (vector<GlobalValue *>::const_iterator i = values.begin(), e = values.end(); i != e; ++i)
+    used.push_back(ConstantExpr::getBitCast(*i, bytePtr));
+
+  ArrayType * const usedType = ArrayType::get(bytePtr, used.size());
+  GlobalVariable * const global =
+    new GlobalVariable(module, usedType, false, GlobalValue::AppendingLinkage,
+                       ConstantArray::get(usedType, used), "llvm.used");
+  global->setSection("llvm.metadata");
+}
+
+// The stack-local variables of CSI instrumentation
+static const char * const INSTRUMENTATION_LOCALS[] = {
+  "__PT_pathArr",
+  "__PT_arrIndex",
+  "__PT_curPath",
+  "__BBC_arr",
+  "__CC_arr",
+};
+
+bool csi_inst::isInstrumentationLocal(const AllocaInst &alloca)
+{
+  const size_t count = sizeof(INSTRUMENTATION_LOCALS) /
+                       sizeof(INSTRUMENTATION_LOCALS[0]);
+  for (size_t i = 0; i < count; ++i)
+    if (alloca.getName() == INSTRUMENTATION_LOCALS[i])
+      return true;
+  return false;
+}
+
+// The prefixes of global coverage arrays
+static const char * const COVERAGE_PREFIXES[] = {
+  "__FC_arr_",
+  "__CC_arr_",
+  "__BBC_arr_",
+};
+
+bool csi_inst::isCoverageGlobal(const GlobalVariable &global)
+{
+  if (!global.hasInitializer())
+    return false;
+  const size_t count = sizeof(COVERAGE_PREFIXES) /
+                       sizeof(COVERAGE_PREFIXES[0]);
+  for (size_t i = 0; i < count; ++i)
+    if (global.getName().startswith(COVERAGE_PREFIXES[i]))
+      return true;
+  return false;
+}
+
+Value *csi_inst::underlyingObject(Value *pointer)
+{
+  while (true)
+    {
+      if (GetElementPtrInst * const gep = dyn_cast<GetElementPtrInst>(pointer))
+        pointer = gep->getPointerOperand();
+      else if (BitCastInst * const cast = dyn_cast<BitCastInst>(pointer))
+        pointer = cast->getOperand(0);
+      else if (ConstantExpr * const expr = dyn_cast<ConstantExpr>(pointer))
+        {
+          if (expr->getOpcode() != Instruction::GetElementPtr &&
+              expr->getOpcode() != Instruction::BitCast)
+            return pointer;
+          pointer = expr->getOperand(0);
+        }
+      else
+        return pointer;
+    }
+}
+
 #if __cplusplus >= 201103L
 
 string csi_inst::to_string(int val) {
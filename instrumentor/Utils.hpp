@@ -32,12 +32,15 @@
 
 #include <set>
 #include <string>
+#include <vector>
 
 namespace llvm {
   class AllocaInst;
   class ArrayType;
+  class CallInst;
   class DIBasicType;
   class DILocalVariable;
+  class IntegerType;
   class ModulePass;
 }
 
@@ -90,6 +93,8 @@ inline llvm::BasicBlock::iterator prevInst(llvm::Instruction* const instruction)
 
   llvm::AllocaInst *createZeroedLocalArray(llvm::Function &, llvm::ArrayType &, const std::string &name, llvm::DIBuilder &, const llvm::DIType &, bool);
 
+  llvm::AllocaInst *createZeroedLocalMask(llvm::Function &, llvm::IntegerType &, const std::string &name, llvm::DIBuilder &, const llvm::DIType &, bool);
+
 #else
 
   inline bool isUnknown(const llvm::DebugLoc &location)
@@ -108,12 +113,39 @@ inline llvm::BasicBlock::iterator prevInst(llvm::Instruction* const instruction)
 
   llvm::Instruction *insertDeclare(llvm::DIBuilder &, llvm::Value *, llvm::DILocalVariable *, const llvm::DebugLoc &, llvm::Instruction *);
 
+  // describe a variable's current value (or, if indirect, the memory
+  // location holding it) from this point onward
+  llvm::Instruction *insertDbgValue(llvm::DIBuilder &, llvm::Value *, llvm::DILocalVariable *, bool indirect, const llvm::DebugLoc &, llvm::Instruction *);
+
   llvm::AllocaInst *createZeroedLocalArray(llvm::Function &, llvm::ArrayType &, const std::string &name, llvm::DIBuilder &, llvm::DIType *, bool);
+
+  // like createZeroedLocalArray, but for a single integer of coverage bits
+  llvm::AllocaInst *createZeroedLocalMask(llvm::Function &, llvm::IntegerType &, const std::string &name, llvm::DIBuilder &, llvm::DIType *, bool);
 #endif
 
   void attachCSILabelToInstruction(llvm::Instruction&,
                                    const std::string& label);
 
+  // the call (if any) in tail position in this block: the last real
+  // instruction before a return, whose result (if any) it returns
+  llvm::CallInst *tailCall(llvm::BasicBlock &);
+
+  // the number of bytes stored by a value of the given type
+  uint64_t getTypeStoreSize(const llvm::Module &, llvm::Type &);
+
+  // keep the given globals through optimization, even if nothing uses them
+  void markUsed(llvm::Module &, const std::vector<llvm::GlobalValue *> &);
+
+  // whether this is one of the stack-local variables of CSI instrumentation
+  // (see variables.html)
+  bool isInstrumentationLocal(const llvm::AllocaInst &);
+
+  // whether this is a global coverage array defined in this module
+  bool isCoverageGlobal(const llvm::GlobalVariable &);
+
+  // the object a pointer points into, looking through casts and GEPs
+  llvm::Value *underlyingObject(llvm::Value *);
+
   // We don't yet require C++11, so we'll use our own "to_string" functions
   std::string to_string(int val);
   std::string to_string(unsigned int val);
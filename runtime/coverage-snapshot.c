@@ -0,0 +1,303 @@
+/*===------------------------- coverage-snapshot.c -------------------------===*
+ *
+ * Snapshots, resets, and compares the global coverage arrays of programs
+ * compiled with -coverage-snapshots, so long-running programs can report
+ * what ran in a given interval.
+ *
+ *===-----------------------------------------------------------------------===*
+ *
+ * Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *===-----------------------------------------------------------------------===*/
+#include "csi-rt.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+#ifndef O_NOFOLLOW
+#define O_NOFOLLOW 0
+#endif
+
+/* Coverage is scanned SCAN_BYTES at a time, as generic vectors that the
+   compiler lowers to the target's SIMD registers.  Most of a large
+   program's coverage is unchanged between snapshots, and is skipped whole. */
+typedef uint64_t lanes __attribute__((vector_size(16)));
+#define SCAN_BYTES 64
+
+extern char __start___CSI_cov[] __attribute__((weak));
+extern char __stop___CSI_cov[] __attribute__((weak));
+extern char __start___CSI_cov_hot[] __attribute__((weak));
+extern char __stop___CSI_cov_hot[] __attribute__((weak));
+
+/* Buffers for __CSI_cov_emit, allocated at startup so that it needs no
+   allocation itself */
+static unsigned char *emitPrevious;
+static unsigned char *emitCurrent;
+static struct __CSI_cov_change *emitChanges;
+static uint64_t emitSequence;
+static int emitBusy;
+static int signalReset = 1;
+static const char *signalDir;
+static int signalFd = -1;
+
+
+/* Whether any of the SCAN_BYTES at current has bits that are not set in
+   those at previous, or has any bits set if previous is NULL */
+static inline int anyGained(const unsigned char *previous,
+                            const unsigned char *current)
+{
+  lanes gained = { 0, 0 };
+  unsigned i;
+  for (i = 0; i < SCAN_BYTES; i += sizeof(lanes)) {
+    lanes now, before = { 0, 0 };
+    memcpy(&now, current + i, sizeof(now));
+    if (previous)
+      memcpy(&before, previous + i, sizeof(before));
+    gained |= now & ~before;
+  }
+  return (gained[0] | gained[1]) != 0;
+}
+
+
+static inline unsigned char takeByte(unsigned char *address)
+{
+  return __atomic_load_n(address, __ATOMIC_RELAXED) ?
+    __atomic_exchange_n(address, 0, __ATOMIC_RELAXED) : 0;
+}
+
+
+/* Copies size bytes of coverage from start into out and clears them.  Each
+   byte is taken with an atomic exchange of its word, so every write made
+   while this runs lands either in out or in the array for next time. */
+static void takeSection(unsigned char *out, char *start, uint64_t size)
+{
+  unsigned char * const bytes = (unsigned char *) start;
+  uint64_t i = 0, j;
+
+  for (; i < size && (uintptr_t) (bytes + i) % sizeof(uint64_t); ++i)
+    out[i] = takeByte(bytes + i);
+
+  for (; i + SCAN_BYTES <= size; i += SCAN_BYTES) {
+    if (!anyGained(NULL, bytes + i)) {
+      memset(out + i, 0, SCAN_BYTES);
+      continue;
+    }
+    for (j = i; j < i + SCAN_BYTES; j += sizeof(uint64_t)) {
+      uint64_t * const word = (uint64_t *) (bytes + j);
+      const uint64_t value = __atomic_load_n(word, __ATOMIC_RELAXED) ?
+        __atomic_exchange_n(word, 0, __ATOMIC_RELAXED) : 0;
+      memcpy(out + j, &value, sizeof(value));
+    }
+  }
+
+  for (; i < size; ++i)
+    out[i] = takeByte(bytes + i);
+}
+
+
+/* Appends a change for each byte in [begin, end) with bits in current
+   that are not in previous */
+static uint64_t collectChanges(const unsigned char *previous,
+                               const unsigned char *current,
+                               uint64_t begin, uint64_t end,
+                               struct __CSI_cov_change *changes,
+                               uint64_t count)
+{
+  uint64_t i;
+  for (i = begin; i < end; ++i) {
+    const unsigned char gained = current[i] & ~previous[i];
+    if (gained) {
+      changes[count].offset = i;
+      changes[count].bits = gained;
+      ++count;
+    }
+  }
+  return count;
+}
+
+
+uint64_t __CSI_cov_size(int section)
+{
+  switch (section) {
+  case CSI_COV_SECTION:
+    return __stop___CSI_cov - __start___CSI_cov;
+  case CSI_COV_HOT_SECTION:
+    return __stop___CSI_cov_hot - __start___CSI_cov_hot;
+  default:
+    return __CSI_cov_size(CSI_COV_SECTION) +
+      __CSI_cov_size(CSI_COV_HOT_SECTION);
+  }
+}
+
+
+void __CSI_cov_snapshot(unsigned char *buffer, int reset)
+{
+  const uint64_t coldSize = __CSI_cov_size(CSI_COV_SECTION);
+  const uint64_t hotSize = __CSI_cov_size(CSI_COV_HOT_SECTION);
+
+  if (reset) {
+    takeSection(buffer, __start___CSI_cov, coldSize);
+    takeSection(buffer + coldSize, __start___CSI_cov_hot, hotSize);
+  } else {
+    memcpy(buffer, __start___CSI_cov, coldSize);
+    memcpy(buffer + coldSize, __start___CSI_cov_hot, hotSize);
+  }
+}
+
+
+uint64_t __CSI_cov_delta(const unsigned char *previous,
+                         const unsigned char *current,
+                         struct __CSI_cov_change *changes)
+{
+  const uint64_t size = __CSI_cov_size(CSI_COV_ALL_SECTIONS);
+  uint64_t count = 0, offset = 0;
+
+  for (; offset + SCAN_BYTES <= size; offset += SCAN_BYTES)
+    if (anyGained(previous + offset, current + offset))
+      count = collectChanges(previous, current, offset, offset + SCAN_BYTES,
+                             changes, count);
+
+  return collectChanges(previous, current, offset, size, changes, count);
+}
+
+
+static int writeAll(int fd, const void *data, uint64_t size)
+{
+  const char *next = data;
+  while (size) {
+    const ssize_t written = write(fd, next, size);
+    if (written < 0)
+      return -1;
+    next += written;
+    size -= written;
+  }
+  return 0;
+}
+
+
+int __CSI_cov_emit(int fd, int reset)
+{
+  struct __CSI_cov_delta_header header;
+  int result;
+
+  if (!emitCurrent || __atomic_exchange_n(&emitBusy, 1, __ATOMIC_ACQUIRE))
+    return -1;
+
+  /* once reset, coverage is itself the change since the previous emit, and
+     the previous snapshot stays clear */
+  __CSI_cov_snapshot(emitCurrent, reset);
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CSI_COV_DELTA_MAGIC, sizeof(header.magic));
+  header.version = CSI_COV_DELTA_VERSION;
+  header.reset = reset != 0;
+  header.sequence = emitSequence++;
+  header.sizes[CSI_COV_SECTION] = __CSI_cov_size(CSI_COV_SECTION);
+  header.sizes[CSI_COV_HOT_SECTION] = __CSI_cov_size(CSI_COV_HOT_SECTION);
+  header.count = __CSI_cov_delta(emitPrevious, emitCurrent, emitChanges);
+  if (!reset)
+    memcpy(emitPrevious, emitCurrent, __CSI_cov_size(CSI_COV_ALL_SECTIONS));
+
+  result = writeAll(fd, &header, sizeof(header)) ||
+    writeAll(fd, emitChanges, header.count * sizeof(*emitChanges)) ? -1 : 0;
+
+  __atomic_store_n(&emitBusy, 0, __ATOMIC_RELEASE);
+  return result;
+}
+
+
+static void handleSignal(int signal)
+{
+  const int saved = errno;
+  (void) signal;
+  if (signalFd >= 0)
+    __CSI_cov_emit(signalFd, signalReset);
+  errno = saved;
+}
+
+
+/* Each process appends to a file named for its own ID, which it creates.
+   The directory may be shared with other users, so a file that is already
+   there is never followed or reused; the signal then emits nothing.  This
+   also runs in the child of a fork, where another thread may have held the
+   stdio locks, so it reports failure with write() alone. */
+static void openSignalFile(void)
+{
+  static const char cannot[] = "CSI: cannot create ";
+  static const char notWritten[] = "; coverage deltas are not written\n";
+  char path[4096];
+
+  if (signalFd >= 0)
+    close(signalFd);
+  signalFd = -1;
+  if (snprintf(path, sizeof(path), "%s/csi-%ld.delta", signalDir,
+               (long) getpid()) >= (int) sizeof(path))
+    return;
+  signalFd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_APPEND |
+                  O_CLOEXEC, 0644);
+  if (signalFd < 0 &&
+      !writeAll(STDERR_FILENO, cannot, sizeof(cannot) - 1) &&
+      !writeAll(STDERR_FILENO, path, strlen(path)))
+    writeAll(STDERR_FILENO, notWritten, sizeof(notWritten) - 1);
+}
+
+
+__attribute__((constructor))
+static void initCoverageSnapshots(void)
+{
+  const uint64_t size = __CSI_cov_size(CSI_COV_ALL_SECTIONS);
+  const char * const signalSetting = getenv("CSI_COV_SIGNAL");
+  const char * const resetSetting = getenv("CSI_COV_RESET");
+  const int signalNumber = signalSetting ? atoi(signalSetting) : 0;
+  /* two snapshots, then room for every byte to have changed */
+  const uint64_t changesOffset =
+    (2 * size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+  unsigned char *buffers;
+  struct sigaction action;
+
+  buffers = mmap(NULL, changesOffset + size * sizeof(*emitChanges) + 1,
+                 PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffers == MAP_FAILED)
+    return;
+  emitPrevious = buffers;
+  emitCurrent = buffers + size;
+  emitChanges = (struct __CSI_cov_change *) (buffers + changesOffset);
+
+  if (signalNumber <= 0)
+    return;
+  if (resetSetting)
+    signalReset = atoi(resetSetting) != 0;
+  signalDir = getenv("CSI_COV_DIR");
+  if (!signalDir || !*signalDir)
+    signalDir = "/tmp";
+  openSignalFile();
+  if (signalFd < 0)
+    return;
+  pthread_atfork(NULL, NULL, openSignalFile);
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handleSignal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(signalNumber, &action, NULL);
+}
@@ -0,0 +1,307 @@
+/*===---------------------------- crash-report.c ---------------------------===*
+ *
+ * Writes the CSI data of programs compiled with -crash-report to a small
+ * file when they crash, so that tracing data survives without a core dump.
+ *
+ *===-----------------------------------------------------------------------===*
+ *
+ * Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *===-----------------------------------------------------------------------===*/
+#define _GNU_SOURCE
+#include "csi-rt.h"
+
+#include <fcntl.h>
+#include <link.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+#ifndef O_NOFOLLOW
+#define O_NOFOLLOW 0
+#endif
+
+#ifndef NT_GNU_BUILD_ID
+#define NT_GNU_BUILD_ID 3
+#endif
+
+/* The longest build ID kept; GNU ld writes 20 bytes by default */
+#define MAX_BUILD_ID 64
+
+/* Bytes of alternate signal stack, so that a stack overflow in the main
+   thread can still be reported */
+#define CRASH_STACK_SIZE (64 * 1024)
+
+/* Linked in only when instrumented code uses the shadow stack or path ring */
+void __CSI_shadow_walk(__CSI_shadow_visitor, void *) __attribute__((weak));
+void __CSI_pt_ring_walk(__CSI_pt_ring_visitor, void *) __attribute__((weak));
+
+/* Instrumented code defines these too when it preserves tail calls */
+__thread uint64_t __CSI_pt_tail_paths[2 * CSI_PT_TAIL_SIZE]
+  __attribute__((weak));
+__thread uint64_t __CSI_pt_tail_count __attribute__((weak));
+
+extern char __start___CSI_cov[] __attribute__((weak));
+extern char __stop___CSI_cov[] __attribute__((weak));
+extern char __start___CSI_cov_hot[] __attribute__((weak));
+extern char __stop___CSI_cov_hot[] __attribute__((weak));
+
+static const int crashSignals[] = {
+  SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT, SIGTRAP,
+};
+
+static const char *crashDir;
+static char crashPath[4096];
+static unsigned char buildId[MAX_BUILD_ID];
+static size_t buildIdSize;
+
+
+/* Writes all of data, returning nonzero if any of it could not be */
+static int writeAll(int fd, const void *data, uint64_t size)
+{
+  const char *next = data;
+  while (size) {
+    const ssize_t written = write(fd, next, size);
+    if (written < 0)
+      return -1;
+    next += written;
+    size -= written;
+  }
+  return 0;
+}
+
+
+static int writeChunk(int fd, uint32_t kind, const void *data, uint64_t size)
+{
+  struct __CSI_crash_chunk chunk;
+  memset(&chunk, 0, sizeof(chunk));
+  chunk.kind = kind;
+  chunk.size = size;
+  return writeAll(fd, &chunk, sizeof(chunk)) || writeAll(fd, data, size);
+}
+
+
+struct walkState {
+  int fd;
+  int failed;
+};
+
+
+/* Each shadow stack record is followed by its layout string, so that the
+   report can be read without the executable */
+static void writeRecord(const struct __CSI_shadow_record *record, void *data)
+{
+  struct walkState * const state = data;
+  const char * const layout = (const char *) (uintptr_t) record->layout;
+  const uint64_t layoutSize = layout ? strlen(layout) + 1 : 0;
+  struct __CSI_crash_chunk chunk;
+
+  memset(&chunk, 0, sizeof(chunk));
+  chunk.kind = CSI_CRASH_SHADOW_RECORD;
+  chunk.size = record->size + layoutSize;
+  state->failed |= writeAll(state->fd, &chunk, sizeof(chunk)) ||
+    writeAll(state->fd, record, record->size) ||
+    writeAll(state->fd, layout, layoutSize);
+}
+
+
+static void writePath(uint64_t function, uint64_t path, void *data)
+{
+  struct walkState * const state = data;
+  const uint64_t pair[2] = { function, path };
+  state->failed |= writeChunk(state->fd, CSI_CRASH_PATH, pair, sizeof(pair));
+}
+
+
+/* Tail call pairs are written newest first.  As in the path ring, the
+   oldest slot may be half overwritten when a signal arrives, so it is left
+   out. */
+static int writeTailPaths(int fd)
+{
+  const uint64_t count = *(volatile uint64_t *) &__CSI_pt_tail_count;
+  const uint64_t pairs =
+    count < CSI_PT_TAIL_SIZE ? count : CSI_PT_TAIL_SIZE - 1;
+  uint64_t i;
+
+  for (i = 1; i <= pairs; ++i) {
+    const volatile uint64_t * const slot =
+      __CSI_pt_tail_paths + 2 * ((count - i) & (CSI_PT_TAIL_SIZE - 1));
+    const uint64_t pair[2] = { slot[0], slot[1] };
+    if (writeChunk(fd, CSI_CRASH_TAIL_PATH, pair, sizeof(pair)))
+      return -1;
+  }
+  return 0;
+}
+
+
+int __CSI_crash_write(int fd, int signal, const void *address)
+{
+  struct __CSI_crash_header header;
+  struct walkState state;
+  char executable[4096];
+  ssize_t length;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CSI_CRASH_MAGIC, sizeof(header.magic));
+  header.version = CSI_CRASH_VERSION;
+  header.signal = signal;
+  header.pid = getpid();
+  header.address = (uint64_t) (uintptr_t) address;
+  header.anchor = (uint64_t) (uintptr_t) __CSI_crash_write;
+  if (writeAll(fd, &header, sizeof(header)))
+    return -1;
+
+  length = readlink("/proc/self/exe", executable, sizeof(executable));
+  if (length > 0 && writeChunk(fd, CSI_CRASH_EXECUTABLE, executable, length))
+    return -1;
+  if (buildIdSize && writeChunk(fd, CSI_CRASH_BUILD_ID, buildId, buildIdSize))
+    return -1;
+
+  if (writeChunk(fd, CSI_CRASH_COVERAGE, __start___CSI_cov,
+                 __stop___CSI_cov - __start___CSI_cov) ||
+      writeChunk(fd, CSI_CRASH_COVERAGE_HOT, __start___CSI_cov_hot,
+                 __stop___CSI_cov_hot - __start___CSI_cov_hot))
+    return -1;
+
+  state.fd = fd;
+  state.failed = 0;
+  if (__CSI_shadow_walk)
+    __CSI_shadow_walk(writeRecord, &state);
+  if (__CSI_pt_ring_walk)
+    __CSI_pt_ring_walk(writePath, &state);
+  return state.failed || writeTailPaths(fd) ? -1 : 0;
+}
+
+
+static void handleCrash(int signal, siginfo_t *info, void *context)
+{
+  /* the directory may be shared with other users: never follow or reuse a
+     file that is already there */
+  const int fd = crashPath[0] ?
+    open(crashPath, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+         0644) : -1;
+  (void) context;
+
+  if (fd >= 0) {
+    __CSI_crash_write(fd, signal, info ? info->si_addr : NULL);
+    close(fd);
+  }
+
+  /* the handler is now the default one, which runs once this returns */
+  raise(signal);
+}
+
+
+/* Each process writes to a file named for its own ID */
+static void nameCrashPath(void)
+{
+  if (snprintf(crashPath, sizeof(crashPath), "%s/csi-%ld.crash", crashDir,
+               (long) getpid()) >= (int) sizeof(crashPath))
+    crashPath[0] = '\0';
+}
+
+
+int __CSI_crash_thread_init(void)
+{
+  stack_t stack;
+
+  memset(&stack, 0, sizeof(stack));
+  stack.ss_sp = mmap(NULL, CRASH_STACK_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  stack.ss_size = CRASH_STACK_SIZE;
+  if (stack.ss_sp == MAP_FAILED)
+    return -1;
+  if (sigaltstack(&stack, NULL)) {
+    munmap(stack.ss_sp, CRASH_STACK_SIZE);
+    return -1;
+  }
+  return 0;
+}
+
+
+/* Copies the GNU build ID of the executable (the first object listed), so
+   that a report can be matched to the build whose metadata describes it */
+static int findBuildId(struct dl_phdr_info *info, size_t size, void *unused)
+{
+  ElfW(Half) i;
+  (void) size;
+  (void) unused;
+
+  for (i = 0; i < info->dlpi_phnum; ++i) {
+    const ElfW(Phdr) * const segment = &info->dlpi_phdr[i];
+    const char *note, *end;
+    if (segment->p_type != PT_NOTE)
+      continue;
+    note = (const char *) (info->dlpi_addr + segment->p_vaddr);
+    end = note + segment->p_memsz;
+    while (note + sizeof(ElfW(Nhdr)) <= end) {
+      const ElfW(Nhdr) * const header = (const ElfW(Nhdr) *) note;
+      const char * const name = note + sizeof(*header);
+      const char * const desc = name + ((header->n_namesz + 3) & ~3);
+      if (header->n_type == NT_GNU_BUILD_ID && header->n_namesz == 4 &&
+          memcmp(name, "GNU", 4) == 0 && header->n_descsz <= MAX_BUILD_ID &&
+          desc + header->n_descsz <= end) {
+        memcpy(buildId, desc, header->n_descsz);
+        buildIdSize = header->n_descsz;
+        return 1;
+      }
+      note = desc + ((header->n_descsz + 3) & ~3);
+    }
+  }
+  return 1;
+}
+
+
+__attribute__((constructor))
+static void initCrashReport(void)
+{
+  const char * const setting = getenv("CSI_CRASH_REPORT");
+  struct sigaction action;
+  unsigned i;
+
+  if (setting && atoi(setting) == 0)
+    return;
+
+  crashDir = getenv("CSI_CRASH_DIR");
+  if (!crashDir || !*crashDir)
+    crashDir = "/tmp";
+  nameCrashPath();
+  if (!crashPath[0])
+    return;
+  pthread_atfork(NULL, NULL, nameCrashPath);
+  dl_iterate_phdr(findBuildId, NULL);
+
+  /* alternate stacks are per thread: other threads call this themselves */
+  __CSI_crash_thread_init();
+
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = handleCrash;
+  action.sa_flags = SA_SIGINFO | SA_RESETHAND | SA_ONSTACK;
+  sigemptyset(&action.sa_mask);
+
+  /* leave alone any signal the program already handles */
+  for (i = 0; i < sizeof(crashSignals) / sizeof(crashSignals[0]); ++i) {
+    struct sigaction previous;
+    if (sigaction(crashSignals[i], NULL, &previous) == 0 &&
+        !(previous.sa_flags & SA_SIGINFO) && previous.sa_handler == SIG_DFL)
+      sigaction(crashSignals[i], &action, NULL);
+  }
+}
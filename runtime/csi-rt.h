@@ -0,0 +1,360 @@
+/*===------------------------------- csi-rt.h ------------------------------===*
+ *
+ * Interface to the CSI runtime library, which instrumented programs need
+ * only when compiled with options that rely on it (such as -shadow-stack,
+ * -path-ring, -live-coverage, -coverage-snapshots, -crash-report,
+ * -runtime-variants, -overhead-governor, or --indirect-style=patch).
+ *
+ *===-----------------------------------------------------------------------===*
+ *
+ * Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *===-----------------------------------------------------------------------===*/
+#ifndef CSI_RT_H
+#define CSI_RT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*
+ * Per-thread shadow stack (-shadow-stack)
+ *
+ * Each instrumented frame pushes one record holding its instrumentation
+ * variables.  Records are contiguous, oldest first, from the thread's stack
+ * base up to __CSI_shadow_top.
+ */
+
+struct __CSI_shadow_record {
+  uint64_t function;  /* address of the instrumented function */
+  uint64_t layout;    /* address of "name=offset+bytes;..." for each variable */
+  uint64_t size;      /* bytes in the record, including this header */
+};
+
+extern __thread char *__CSI_shadow_top;
+extern __thread char *__CSI_shadow_limit;
+
+/* Allocates a record of the given size when it does not fit below
+   __CSI_shadow_limit (including this thread's first record).  All of the
+   record but its header is zero, so instrumented code does not clear it. */
+void *__CSI_shadow_grow(uint64_t size);
+
+typedef void (*__CSI_shadow_visitor)(const struct __CSI_shadow_record *,
+                                     void *data);
+
+/* Calls visit for each record on the calling thread's shadow stack, oldest
+   first.  Async-signal-safe, so it may be used from a crash handler.  A
+   frame that was unwound without returning (by longjmp or an exception) may
+   leave stale records above its caller's until that caller returns. */
+void __CSI_shadow_walk(__CSI_shadow_visitor visit, void *data);
+
+
+/*
+ * Per-thread tail call buffer (-preserve-tail-calls)
+ *
+ * A path traced function about to make a call in tail position appends a
+ * pair to the calling thread's buffer: the address of the function, then
+ * the path it completed.  __CSI_pt_tail_count counts the pairs ever
+ * appended, so the newest pair is at index
+ * (__CSI_pt_tail_count - 1) mod CSI_PT_TAIL_SIZE.  Instrumented code defines
+ * both weakly, as programs need not link the runtime library to use them.
+ */
+
+/* pairs kept per thread (a power of two; the instrumentor reads it here) */
+#define CSI_PT_TAIL_SIZE 16
+
+extern __thread uint64_t __CSI_pt_tail_paths[2 * CSI_PT_TAIL_SIZE];
+extern __thread uint64_t __CSI_pt_tail_count;
+
+
+/*
+ * Per-thread path ring (-path-ring)
+ *
+ * Each instrumented function appends a pair to the calling thread's ring
+ * whenever it completes an acyclic path: the address of the function, then
+ * the path number.  __CSI_pt_ring_count counts the pairs ever appended, so
+ * the newest pair is at index (__CSI_pt_ring_count - 1) mod CSI_PT_RING_SIZE.
+ */
+
+/* pairs kept per thread (a power of two; the instrumentor reads it here) */
+#define CSI_PT_RING_SIZE 256
+
+extern __thread uint64_t __CSI_pt_ring[2 * CSI_PT_RING_SIZE];
+extern __thread uint64_t __CSI_pt_ring_count;
+
+/* function is the address of the instrumented function, whose symbol names
+   its entry in the .debug_PT metadata */
+typedef void (*__CSI_pt_ring_visitor)(uint64_t function, uint64_t path,
+                                      void *data);
+
+/* Calls visit for each complete pair in the calling thread's ring, newest
+   first.  Async-signal-safe.  The oldest slot may be half overwritten when
+   a signal arrives, so at most CSI_PT_RING_SIZE - 1 pairs are visited. */
+void __CSI_pt_ring_walk(__CSI_pt_ring_visitor visit, void *data);
+
+
+/* Sections holding the global coverage arrays (-coverage-layout) */
+#define CSI_COV_SECTION 0      /* __CSI_cov */
+#define CSI_COV_HOT_SECTION 1  /* __CSI_cov_hot */
+
+
+/*
+ * Live coverage (-live-coverage)
+ *
+ * At startup, the global coverage arrays in sections __CSI_cov and
+ * __CSI_cov_hot are moved onto the file $CSI_LIVE_DIR/csi-<pid>.cov (or
+ * /tmp/csi-<pid>.cov), which other processes may read or map while the
+ * program runs.  The file must not already exist, and is removed when the
+ * program exits.  The file's first page holds this header; each section's
+ * contents follow at the offset it gives.  A child process made by fork
+ * gets a file of its own, starting from its parent's coverage.
+ */
+
+#define CSI_LIVE_MAGIC "CSI-LIVE"
+#define CSI_LIVE_VERSION 1
+#define CSI_LIVE_SECTIONS 2  /* CSI_COV_SECTION, CSI_COV_HOT_SECTION */
+
+struct __CSI_live_header {
+  char magic[8];              /* CSI_LIVE_MAGIC, without its terminator */
+  uint32_t version;           /* CSI_LIVE_VERSION */
+  uint32_t pid;               /* the process writing this file */
+  uint64_t pageSize;          /* bytes in the header, and in each page */
+  struct {
+    uint64_t offset;          /* where the section starts in the file */
+    uint64_t size;            /* bytes in the section (a multiple of pages) */
+  } sections[CSI_LIVE_SECTIONS];
+  char executable[];          /* path of the program, NUL terminated */
+};
+
+/* Returns the path of the calling process's live coverage file, or NULL if
+   coverage could not be made live. */
+const char *__CSI_live_path(void);
+
+
+/*
+ * Coverage snapshots (-coverage-snapshots)
+ *
+ * A snapshot copies the __CSI_cov section, then the __CSI_cov_hot section,
+ * into one buffer of __CSI_cov_size(CSI_COV_ALL_SECTIONS) bytes.  Offsets
+ * into a snapshot are offsets into the first section, and then into the
+ * second.  Resetting coverage while taking a snapshot exchanges each word
+ * for zero atomically, so every coverage write lands in exactly one
+ * snapshot.  A call that is running during a reset may record some of its
+ * coverage on each side.
+ */
+
+#define CSI_COV_ALL_SECTIONS (-1)
+
+/* Returns the bytes of coverage in the given section, or in all sections */
+uint64_t __CSI_cov_size(int section);
+
+/* Copies all global coverage into buffer, clearing it if reset is set */
+void __CSI_cov_snapshot(unsigned char *buffer, int reset);
+
+/* A byte of coverage that gained bits between two snapshots */
+struct __CSI_cov_change {
+  uint32_t offset;  /* offset of the byte in each snapshot */
+  uint8_t bits;     /* bits set in the later snapshot only */
+  uint8_t reserved[3];
+};
+
+/* Stores a change for each byte of current that has bits not set in
+   previous, and returns the number stored.  changes must have room for
+   one per byte of a snapshot. */
+uint64_t __CSI_cov_delta(const unsigned char *previous,
+                         const unsigned char *current,
+                         struct __CSI_cov_change *changes);
+
+#define CSI_COV_DELTA_MAGIC "CSI-DLTA"
+#define CSI_COV_DELTA_VERSION 1
+
+/* Precedes the changes written by each __CSI_cov_emit */
+struct __CSI_cov_delta_header {
+  char magic[8];        /* CSI_COV_DELTA_MAGIC, without its terminator */
+  uint32_t version;     /* CSI_COV_DELTA_VERSION */
+  uint32_t reset;       /* whether coverage was cleared by this snapshot */
+  uint64_t sequence;    /* emits before this one, counting from 0 */
+  uint64_t sizes[CSI_LIVE_SECTIONS];  /* bytes in each section */
+  uint64_t count;       /* struct __CSI_cov_change records that follow */
+};
+
+/* Snapshots coverage (clearing it if reset is set), and writes to fd a
+   header and the changes since the previous emit.  Async-signal-safe.
+   Returns 0 on success, or -1 if the write failed or another emit was
+   running.  If CSI_COV_SIGNAL names a signal number at startup, that
+   signal emits to $CSI_COV_DIR/csi-<pid>.delta (or /tmp/csi-<pid>.delta),
+   which is created at startup and must not already exist, resetting
+   coverage unless CSI_COV_RESET is 0. */
+int __CSI_cov_emit(int fd, int reset);
+
+
+/*
+ * Crash reports (-crash-report)
+ *
+ * When the program is killed by SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT,
+ * or SIGTRAP, and does not handle that signal itself, the CSI runtime
+ * library writes $CSI_CRASH_DIR/csi-<pid>.crash (or /tmp/csi-<pid>.crash)
+ * before the signal's default action, unless CSI_CRASH_REPORT is 0, and
+ * unless a file of that name already exists.  The report is this header
+ * followed by chunks, each a struct __CSI_crash_chunk and then its data.
+ * Only the crashing thread's frames are reported, and only when compiled
+ * with -shadow-stack: otherwise their instrumentation variables live in
+ * stack frames that the runtime library cannot find.
+ * The build ID chunk, present when the executable was linked with a GNU
+ * build ID (as -crash-report asks the linker for), identifies the build
+ * whose .debug_* metadata describes the report.
+ */
+
+#define CSI_CRASH_MAGIC "CSI-CRSH"
+#define CSI_CRASH_VERSION 1
+
+struct __CSI_crash_header {
+  char magic[8];        /* CSI_CRASH_MAGIC, without its terminator */
+  uint32_t version;     /* CSI_CRASH_VERSION */
+  uint32_t signal;      /* the fatal signal */
+  uint64_t pid;         /* the crashing process */
+  uint64_t address;     /* the faulting address, if any */
+  uint64_t anchor;      /* run-time address of __CSI_crash_write, which
+                           less its symbol's value is the load offset */
+};
+
+enum __CSI_crash_kind {
+  CSI_CRASH_EXECUTABLE = 1,  /* path of the program, not NUL terminated */
+  CSI_CRASH_COVERAGE,        /* contents of section __CSI_cov */
+  CSI_CRASH_COVERAGE_HOT,    /* contents of section __CSI_cov_hot */
+  CSI_CRASH_SHADOW_RECORD,   /* a shadow stack record, oldest first, then
+                                its layout string, NUL terminated */
+  CSI_CRASH_PATH,            /* a path ring pair, newest first */
+  CSI_CRASH_BUILD_ID,        /* the executable's GNU build ID */
+  CSI_CRASH_TAIL_PATH        /* a tail call buffer pair, newest first */
+};
+
+struct __CSI_crash_chunk {
+  uint32_t kind;        /* an enum __CSI_crash_kind */
+  uint32_t reserved;
+  uint64_t size;        /* bytes of data that follow */
+};
+
+/* Writes a crash report for the calling thread to fd, for a program's own
+   fatal signal handler.  address may be NULL.  Async-signal-safe.  Returns
+   0 on success, or -1 if a write failed. */
+int __CSI_crash_write(int fd, int signal, const void *address);
+
+/* Gives the calling thread an alternate signal stack, so that a crash from
+   overflowing its stack is still reported.  The main thread gets one at
+   startup; other threads must call this themselves.  Returns 0 on success,
+   or -1 if the stack could not be allocated or installed. */
+int __CSI_crash_thread_init(void);
+
+
+/*
+ * Run-time variant selection (-runtime-variants)
+ *
+ * Each function with several instrumentation variants has a switcher
+ * (__CSI_inst_<function>) whose value chooses the variant run by each
+ * call.  Section __CSI_variants describes each switcher that may be changed
+ * while the program runs.  At startup, the rules in the file named by
+ * CSI_VARIANTS_FILE, and then those in CSI_VARIANTS, are applied.
+ */
+
+struct __CSI_variant {
+  int32_t *switcher;    /* the function's switcher */
+  const char *function; /* the function's name, as matched by a schema */
+  const char *schemes;  /* the scheme selected by each switcher value,
+                           such as "{};{CC};{CC,PT}", separated by
+                           semicolons, and empty for unused values */
+  uint64_t *calls;      /* calls to the function so far, approximately, or
+                           NULL unless compiled with -overhead-governor;
+                           see __CSI_governor_tick */
+};
+
+/* Makes each function named function (or every function, if "*") that has
+   the given scheme, such as "{CC}" or "{}", run that variant.  Returns the
+   number of switchers changed, or -1 if scheme is not a scheme or the
+   change cannot take effect. */
+int __CSI_set_variant(const char *function, const char *scheme);
+
+/* Applies rules of the form "function;{scheme}", one per line, with the
+   first rule that names a function deciding its variant, as in a tracing
+   schema.  Functions without that rule's scheme keep their variants.  Lines
+   starting with '#' are ignored.  Returns the number of switchers changed,
+   or -1 if the rules are malformed or the changes cannot take effect. */
+int __CSI_apply_variants(const char *rules);
+
+
+/*
+ * Overhead governor (-overhead-governor)
+ *
+ * If CSI_GOVERNOR_BUDGET gives a fraction of one CPU (such as 0.02) at
+ * startup, a thread wakes every CSI_GOVERNOR_INTERVAL milliseconds (100 by
+ * default) and estimates the instrumentation overhead since it last woke,
+ * from the calls to each function with a counter and the estimated cost of
+ * each call to its current variant.  While the estimate exceeds the budget,
+ * the function costing the most is switched to its next cheaper variant.
+ * Functions are never switched back; __CSI_apply_variants can do so.
+ * CSI_GOVERNOR_COSTS overrides the estimated nanoseconds per call of each
+ * instrumentation type (PT 4, BBC 2, CC 2, and FC 1 by default: guesses,
+ * not measurements), as in "PT=8,BBC=3".
+ */
+
+/* Returns the number of times the governor has switched a function to a
+   cheaper variant */
+uint64_t __CSI_governor_demotions(void);
+
+/* Runs the governor once, now, on the calls counted since it last ran (or
+   since startup), with a budget of limit nanoseconds for their estimated
+   cost; returns the number of functions it switched.  This works whether or
+   not CSI_GOVERNOR_BUDGET started a governor thread, so programs (and tests)
+   may govern at points of their own choosing. */
+uint64_t __CSI_governor_step(double limit);
+
+/* Calls are counted in samples: each thread counts down from
+   __CSI_calls_period (64 by default), and the function it
+   is calling when the countdown expires is credited with the whole period,
+   then calls this.  A period of 0 or less counts every call. */
+extern int32_t __CSI_calls_period;
+void __CSI_governor_tick(void);
+
+
+/*
+ * Patchable entry sleds (--indirect-style=patch)
+ *
+ * Each function with several instrumentation variants starts with one
+ * direct jump to the variant its switcher selected when the program was
+ * compiled, instead of testing its switcher on every call.  Section
+ * __CSI_sleds describes each such jump.  A changed switcher takes effect
+ * only once the jumps are retargeted, which __CSI_set_variant and
+ * __CSI_apply_variants do themselves.
+ */
+
+struct __CSI_sled {
+  unsigned char *sled;   /* the function: a jump with a 32-bit displacement */
+  int32_t *switcher;     /* the function's switcher */
+  uint64_t count;        /* the number of switcher values */
+  void * const *targets; /* the variant for each switcher value, or NULL */
+};
+
+/* Retargets each jump to the variant its switcher now selects.  Returns 0
+   on success, or -1 if any jump could not be made writable. */
+int __CSI_patch_sleds(void);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !CSI_RT_H */
@@ -0,0 +1,340 @@
+/*===------------------------------ governor.c -----------------------------===*
+ *
+ * Keeps the estimated instrumentation overhead of programs compiled with
+ * -overhead-governor within a budget, by switching the functions that cost
+ * the most to cheaper variants.
+ *
+ *===-----------------------------------------------------------------------===*
+ *
+ * Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *===-----------------------------------------------------------------------===*/
+#include "csi-rt.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_INTERVAL_MS 100
+
+extern const struct __CSI_variant __start___CSI_variants[]
+  __attribute__((weak));
+extern const struct __CSI_variant __stop___CSI_variants[]
+  __attribute__((weak));
+
+/* Estimated nanoseconds per call that each instrumentation type adds.  These
+   are rough guesses from the work each type does on a typical call (path
+   tracing updates a path number on most edges and commits it, coverage sets
+   a byte per site, function coverage one byte per call), not measurements;
+   CSI_GOVERNOR_COSTS overrides them for a given machine and program. */
+struct typeCost {
+  const char *type;
+  double cost;
+};
+
+static struct typeCost typeCosts[] = {
+  { "BBC", 2 },
+  { "CC", 2 },
+  { "FC", 1 },
+  { "PT", 4 },
+};
+
+/* The cost of any type not listed above */
+#define DEFAULT_TYPE_COST 1
+
+/* What the governor knows of each function with a counter */
+struct governed {
+  const struct __CSI_variant *variant;
+  uint64_t lastCalls;
+  double cost;          /* estimated nanoseconds in the last interval */
+};
+
+static pthread_mutex_t governLock = PTHREAD_MUTEX_INITIALIZER;
+static struct governed *functions;
+static size_t functionCount;
+static int collected;
+static double budget;
+static long intervalMs;
+static uint64_t demotions;
+static int governing;      /* whether a governor thread is wanted */
+static int running;        /* whether this process has started one */
+
+
+static double typeCost(const char *type, size_t length)
+{
+  size_t i;
+  for (i = 0; i < sizeof(typeCosts) / sizeof(typeCosts[0]); ++i)
+    if (strlen(typeCosts[i].type) == length &&
+        memcmp(typeCosts[i].type, type, length) == 0)
+      return typeCosts[i].cost;
+  return DEFAULT_TYPE_COST;
+}
+
+
+/* Returns the estimated cost per call of the variant selected by value, or
+   a negative number if no variant is */
+static double variantCost(const struct __CSI_variant *variant, int value)
+{
+  const char *slot = variant->schemes;
+  double cost = 0;
+
+  for (; value > 0; --value) {
+    slot = strchr(slot, ';');
+    if (!slot)
+      return -1;
+    ++slot;
+  }
+  if (*slot != '{')
+    return -1;
+
+  /* types are separated by commas, between braces */
+  for (++slot; *slot && *slot != '}'; ) {
+    const size_t length = strcspn(slot, ",}");
+    if (length)
+      cost += typeCost(slot, length);
+    slot += length;
+    if (*slot == ',')
+      ++slot;
+  }
+  return cost;
+}
+
+
+/* Returns the value selecting the most expensive variant cheaper than the
+   current one, or -1 if there is none */
+static int cheaperValue(const struct __CSI_variant *variant, double current)
+{
+  double best = -1;
+  int result = -1, value;
+  const char *slot;
+
+  for (value = 0, slot = variant->schemes; slot; ++value) {
+    const double cost = variantCost(variant, value);
+    if (cost >= 0 && cost < current && cost > best) {
+      best = cost;
+      result = value;
+    }
+    slot = strchr(slot, ';');
+    if (slot)
+      ++slot;
+  }
+  return result;
+}
+
+
+/* Switches functions to cheaper variants until the estimated cost of their
+   calls since the last run is within limit nanoseconds, returning the number
+   of switches */
+static uint64_t govern(double limit)
+{
+  uint64_t switches = 0;
+  double total = 0;
+  size_t i;
+
+  for (i = 0; i < functionCount; ++i) {
+    struct governed * const function = &functions[i];
+    const uint64_t calls =
+      __atomic_load_n(function->variant->calls, __ATOMIC_RELAXED);
+    const int value =
+      __atomic_load_n(function->variant->switcher, __ATOMIC_RELAXED);
+    const double perCall = variantCost(function->variant, value);
+    function->cost =
+      (calls - function->lastCalls) * (perCall > 0 ? perCall : 0);
+    function->lastCalls = calls;
+    total += function->cost;
+  }
+
+  while (total > limit) {
+    struct governed *costliest = NULL;
+    double perCall;
+    uint64_t calls;
+    int value;
+
+    for (i = 0; i < functionCount; ++i)
+      if (functions[i].cost > 0 &&
+          (!costliest || functions[i].cost > costliest->cost))
+        costliest = &functions[i];
+    if (!costliest)
+      break;
+
+    /* a function with no cheaper variant is left as it is */
+    perCall = variantCost(costliest->variant,
+                          __atomic_load_n(costliest->variant->switcher,
+                                          __ATOMIC_RELAXED));
+    value = cheaperValue(costliest->variant, perCall);
+    total -= costliest->cost;
+    if (value < 0) {
+      costliest->cost = 0;
+      continue;
+    }
+    calls = (uint64_t) (costliest->cost / perCall + 0.5);
+    costliest->cost = calls * variantCost(costliest->variant, value);
+    total += costliest->cost;
+    __atomic_store_n(costliest->variant->switcher, value, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&demotions, 1, __ATOMIC_RELAXED);
+    ++switches;
+  }
+  return switches;
+}
+
+
+/* Lists the functions with counters, once, returning nonzero if there are
+   any */
+static int collectFunctions(void)
+{
+  const struct __CSI_variant *variant;
+  size_t count = 0;
+
+  if (collected)
+    return functionCount != 0;
+  collected = 1;
+
+  for (variant = __start___CSI_variants; variant < __stop___CSI_variants;
+       ++variant)
+    count += variant->calls != NULL;
+  if (!count)
+    return 0;
+  functions = calloc(count, sizeof(*functions));
+  if (!functions)
+    return 0;
+  for (variant = __start___CSI_variants; variant < __stop___CSI_variants;
+       ++variant)
+    if (variant->calls)
+      functions[functionCount++].variant = variant;
+  return 1;
+}
+
+
+static void *runGovernor(void *unused)
+{
+  const struct timespec interval = {
+    intervalMs / 1000, (intervalMs % 1000) * 1000000,
+  };
+  (void) unused;
+
+  for (;;) {
+    nanosleep(&interval, NULL);
+    pthread_mutex_lock(&governLock);
+    govern(budget * intervalMs * 1e6);
+    pthread_mutex_unlock(&governLock);
+  }
+  return NULL;
+}
+
+
+static void startGovernor(void)
+{
+  pthread_t thread;
+  pthread_attr_t attributes;
+
+  pthread_attr_init(&attributes);
+  pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+  if (pthread_create(&thread, &attributes, runGovernor, NULL))
+    fprintf(stderr, "CSI: cannot start overhead governor\n");
+  pthread_attr_destroy(&attributes);
+}
+
+
+/* Parses "TYPE=cost,..." into typeCosts */
+static void readCosts(const char *setting)
+{
+  while (*setting) {
+    const size_t length = strcspn(setting, "=,");
+    size_t i;
+    if (setting[length] == '=')
+      for (i = 0; i < sizeof(typeCosts) / sizeof(typeCosts[0]); ++i)
+        if (strlen(typeCosts[i].type) == length &&
+            memcmp(typeCosts[i].type, setting, length) == 0)
+          typeCosts[i].cost = strtod(setting + length + 1, NULL);
+    setting += strcspn(setting, ",");
+    if (*setting)
+      ++setting;
+  }
+}
+
+
+/* The lock is held across fork, so that no run is caught halfway */
+static void lockGovernor(void)
+{
+  pthread_mutex_lock(&governLock);
+}
+
+
+static void unlockGovernor(void)
+{
+  pthread_mutex_unlock(&governLock);
+}
+
+
+/* A thread does not survive fork, and a child must not start one from a
+   fork handler, so the child's next __CSI_governor_tick starts it instead */
+static void forgetGovernor(void)
+{
+  running = 0;
+  unlockGovernor();
+}
+
+
+void __CSI_governor_tick(void)
+{
+  if (governing && !__atomic_load_n(&running, __ATOMIC_RELAXED) &&
+      !__atomic_exchange_n(&running, 1, __ATOMIC_ACQUIRE))
+    startGovernor();
+}
+
+
+uint64_t __CSI_governor_demotions(void)
+{
+  return __atomic_load_n(&demotions, __ATOMIC_RELAXED);
+}
+
+
+uint64_t __CSI_governor_step(double limit)
+{
+  uint64_t switches = 0;
+
+  pthread_mutex_lock(&governLock);
+  if (collectFunctions())
+    switches = govern(limit);
+  pthread_mutex_unlock(&governLock);
+  return switches;
+}
+
+
+__attribute__((constructor))
+static void initGovernor(void)
+{
+  const char * const budgetSetting = getenv("CSI_GOVERNOR_BUDGET");
+  const char * const intervalSetting = getenv("CSI_GOVERNOR_INTERVAL");
+  const char * const costsSetting = getenv("CSI_GOVERNOR_COSTS");
+
+  /* costs also apply to __CSI_governor_step, which any thread may call */
+  if (costsSetting)
+    readCosts(costsSetting);
+  pthread_atfork(lockGovernor, unlockGovernor, forgetGovernor);
+
+  budget = budgetSetting ? strtod(budgetSetting, NULL) : 0;
+  if (budget <= 0)
+    return;
+  intervalMs = intervalSetting ? strtol(intervalSetting, NULL, 0) : 0;
+  if (intervalMs <= 0)
+    intervalMs = DEFAULT_INTERVAL_MS;
+  if (!collectFunctions())
+    return;
+
+  governing = 1;
+  __CSI_governor_tick();
+}
@@ -0,0 +1,193 @@
+/*===--------------------------- live-coverage.c ---------------------------===*
+ *
+ * Moves the global coverage arrays of programs compiled with -live-coverage
+ * onto a per-process file at startup, so that other processes can read
+ * coverage while the program runs.
+ *
+ *===-----------------------------------------------------------------------===*
+ *
+ * Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *===-----------------------------------------------------------------------===*/
+#include "csi-rt.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+#ifndef O_NOFOLLOW
+#define O_NOFOLLOW 0
+#endif
+
+/* The largest page size this file's section padding allows for */
+#define MAX_PAGE_SIZE 4096
+
+/* This file's contribution to each coverage section is empty but page
+   aligned, which aligns the start of the whole section to a page.  The
+   runtime library is linked after all instrumented objects, so the same
+   contribution also ends the section on a page boundary.  Mapping the
+   section's pages then touches no other data. */
+static char covPad[0]
+  __attribute__((section("__CSI_cov"), aligned(MAX_PAGE_SIZE), used));
+static char hotPad[0]
+  __attribute__((section("__CSI_cov_hot"), aligned(MAX_PAGE_SIZE), used));
+
+extern char __start___CSI_cov[] __attribute__((weak));
+extern char __stop___CSI_cov[] __attribute__((weak));
+extern char __start___CSI_cov_hot[] __attribute__((weak));
+extern char __stop___CSI_cov_hot[] __attribute__((weak));
+
+static char livePath[PATH_MAX];
+
+
+static void liveFail(const char *message)
+{
+  ssize_t ignored = write(STDERR_FILENO, message, strlen(message));
+  (void) ignored;
+  abort();
+}
+
+
+static void liveWarn(const char *message)
+{
+  ssize_t ignored = write(STDERR_FILENO, message, strlen(message));
+  (void) ignored;
+}
+
+
+/* Creates this process's file, copies the current contents of each section
+   into it, and maps the file over the sections.  Returns 0 on success. */
+static int mapSections(void)
+{
+  char * const starts[CSI_LIVE_SECTIONS] = {
+    __start___CSI_cov, __start___CSI_cov_hot,
+  };
+  char * const stops[CSI_LIVE_SECTIONS] = {
+    __stop___CSI_cov, __stop___CSI_cov_hot,
+  };
+  const long page = sysconf(_SC_PAGESIZE);
+  const char *dir = getenv("CSI_LIVE_DIR");
+  struct __CSI_live_header *header;
+  uint64_t offset;
+  ssize_t length;
+  int fd, i;
+
+  livePath[0] = '\0';
+  if (page <= 0 || page > MAX_PAGE_SIZE) {
+    liveWarn("CSI: page size not supported; coverage is not live\n");
+    return -1;
+  }
+  for (i = 0; i < CSI_LIVE_SECTIONS; ++i)
+    if (((uintptr_t) starts[i] | (uintptr_t) stops[i]) % page) {
+      liveWarn("CSI: coverage sections are not page aligned; coverage is not live\n");
+      return -1;
+    }
+
+  if (!dir || !*dir)
+    dir = "/tmp";
+  if (snprintf(livePath, sizeof(livePath), "%s/csi-%ld.cov", dir,
+               (long) getpid()) >= (int) sizeof(livePath)) {
+    livePath[0] = '\0';
+    liveWarn("CSI: CSI_LIVE_DIR is too long; coverage is not live\n");
+    return -1;
+  }
+  /* the directory may be shared with other users: never follow or reuse a
+     file that is already there */
+  fd = open(livePath, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+            0644);
+  if (fd < 0) {
+    livePath[0] = '\0';
+    liveWarn("CSI: cannot create live coverage file; coverage is not live\n");
+    return -1;
+  }
+
+  /* the header fills the first page */
+  header = calloc(1, page);
+  if (!header)
+    liveFail("CSI: cannot allocate live coverage header\n");
+  memcpy(header->magic, CSI_LIVE_MAGIC, sizeof(header->magic));
+  header->version = CSI_LIVE_VERSION;
+  header->pid = getpid();
+  header->pageSize = page;
+  length = readlink("/proc/self/exe", header->executable,
+                    page - sizeof(*header) - 1);
+  if (length < 0)
+    length = 0;
+  header->executable[length] = '\0';
+
+  offset = page;
+  for (i = 0; i < CSI_LIVE_SECTIONS; ++i) {
+    header->sections[i].offset = offset;
+    header->sections[i].size = stops[i] - starts[i];
+    offset += header->sections[i].size;
+  }
+  if (ftruncate(fd, offset) || pwrite(fd, header, page, 0) != page)
+    liveFail("CSI: cannot write live coverage file\n");
+
+  /* keep coverage recorded so far, then share the pages with the file */
+  for (i = 0; i < CSI_LIVE_SECTIONS; ++i) {
+    const uint64_t size = header->sections[i].size;
+    if (!size)
+      continue;
+    if (pwrite(fd, starts[i], size, header->sections[i].offset) != (ssize_t) size)
+      liveFail("CSI: cannot write live coverage file\n");
+    if (mmap(starts[i], size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             fd, header->sections[i].offset) == MAP_FAILED)
+      liveFail("CSI: cannot map live coverage file\n");
+  }
+
+  free(header);
+  close(fd);
+  return 0;
+}
+
+
+/* A child process must not write to its parent's file */
+static void remapInChild(void)
+{
+  if (livePath[0])
+    mapSections();
+}
+
+
+/* Each process removes its own file (a child's livePath names the child's) */
+static void removeLiveFile(void)
+{
+  if (livePath[0])
+    unlink(livePath);
+}
+
+
+__attribute__((constructor(101)))
+static void initLiveCoverage(void)
+{
+  if (mapSections() == 0) {
+    pthread_atfork(NULL, NULL, remapInChild);
+    atexit(removeLiveFile);
+  }
+}
+
+
+const char *__CSI_live_path(void)
+{
+  return livePath[0] ? livePath : NULL;
+}
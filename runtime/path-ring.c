@@ -0,0 +1,44 @@
+/*===----------------------------- path-ring.c -----------------------------===*
+ *
+ * Per-thread rings of (function, path) pairs committed by functions compiled
+ * with -path-ring.  Instrumented code appends pairs itself; this file only
+ * defines each thread's ring and reads it back.
+ *
+ *===-----------------------------------------------------------------------===*
+ *
+ * Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *===-----------------------------------------------------------------------===*/
+#include "csi-rt.h"
+
+#if CSI_PT_RING_SIZE & (CSI_PT_RING_SIZE - 1)
+#error "CSI_PT_RING_SIZE must be a power of two"
+#endif
+
+__thread uint64_t __CSI_pt_ring[2 * CSI_PT_RING_SIZE];
+__thread uint64_t __CSI_pt_ring_count;
+
+void __CSI_pt_ring_walk(__CSI_pt_ring_visitor visit, void *data)
+{
+  const uint64_t count = *(volatile uint64_t *) &__CSI_pt_ring_count;
+  const uint64_t pairs =
+    count < CSI_PT_RING_SIZE ? count : CSI_PT_RING_SIZE - 1;
+  uint64_t i;
+
+  for (i = 1; i <= pairs; ++i) {
+    const volatile uint64_t * const pair =
+      __CSI_pt_ring + 2 * ((count - i) & (CSI_PT_RING_SIZE - 1));
+    visit(pair[0], pair[1], data);
+  }
+}
@@ -0,0 +1,125 @@
+/*===---------------------------- shadow-stack.c ---------------------------===*
+ *
+ * Per-thread shadow stacks holding the instrumentation variables of frames
+ * compiled with -shadow-stack.  Instrumented code pushes and pops records
+ * itself; this file only allocates each thread's stack and walks it.
+ *
+ *===-----------------------------------------------------------------------===*
+ *
+ * Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *===-----------------------------------------------------------------------===*/
+#include "csi-rt.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+/* Address space reserved for each thread's shadow stack, unless overridden
+   by CSI_SHADOW_STACK_SIZE (in bytes).  Pages are only committed as they
+   are touched. */
+#define DEFAULT_SHADOW_STACK_SIZE (64UL << 20)
+
+__thread char *__CSI_shadow_top;
+__thread char *__CSI_shadow_limit;
+static __thread char *shadowBase;
+
+static size_t shadowStackSize;
+static pthread_key_t shadowKey;
+static pthread_once_t shadowOnce = PTHREAD_ONCE_INIT;
+
+
+static void shadowFail(const char *message)
+{
+  ssize_t ignored = write(STDERR_FILENO, message, strlen(message));
+  (void) ignored;
+  abort();
+}
+
+
+static void releaseShadowStack(void *base)
+{
+  munmap(base, shadowStackSize);
+}
+
+
+static void initShadowStacks(void)
+{
+  const char * const setting = getenv("CSI_SHADOW_STACK_SIZE");
+  shadowStackSize = setting ? strtoul(setting, NULL, 0) : 0;
+  if (shadowStackSize == 0)
+    shadowStackSize = DEFAULT_SHADOW_STACK_SIZE;
+
+  if (pthread_key_create(&shadowKey, releaseShadowStack))
+    shadowFail("CSI: cannot create shadow stack key\n");
+}
+
+
+void *__CSI_shadow_grow(uint64_t size)
+{
+  char *record;
+
+  if (!shadowBase) {
+    void *base;
+    pthread_once(&shadowOnce, initShadowStacks);
+    base = mmap(NULL, shadowStackSize, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+      shadowFail("CSI: cannot allocate shadow stack\n");
+    pthread_setspecific(shadowKey, base);
+
+    shadowBase = base;
+    __CSI_shadow_top = shadowBase;
+    __CSI_shadow_limit = shadowBase + shadowStackSize;
+  }
+
+  if (size > (uint64_t) (__CSI_shadow_limit - __CSI_shadow_top))
+    shadowFail("CSI: shadow stack overflow; "
+               "try increasing CSI_SHADOW_STACK_SIZE\n");
+
+  /* a walker must not trust this record until its header is filled in */
+  record = __CSI_shadow_top;
+  ((volatile struct __CSI_shadow_record *) record)->size = 0;
+  __CSI_shadow_top = record + size;
+  return record;
+}
+
+
+void __CSI_shadow_walk(__CSI_shadow_visitor visit, void *data)
+{
+  const char *record = shadowBase;
+  const char * const top = __CSI_shadow_top;
+
+  if (!record)
+    return;
+
+  while (record < top) {
+    const struct __CSI_shadow_record * const header =
+      (const struct __CSI_shadow_record *) record;
+
+    /* stop at a record whose push was interrupted */
+    if (header->size < sizeof(*header) ||
+        header->size > (uint64_t) (top - record))
+      break;
+
+    visit(header, data);
+    record += header->size;
+  }
+}
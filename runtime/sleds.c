@@ -0,0 +1,87 @@
+/*===------------------------------- sleds.c -------------------------------===*
+ *
+ * Retargets the entry jumps of functions compiled with --indirect-style=patch
+ * to the variants that their switchers select.
+ *
+ *===-----------------------------------------------------------------------===*
+ *
+ * Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *===-----------------------------------------------------------------------===*/
+#include "csi-rt.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Each jump is one opcode byte and a displacement from its own end */
+#define SLED_SIZE 5
+
+extern const struct __CSI_sled __start___CSI_sleds[] __attribute__((weak));
+extern const struct __CSI_sled __stop___CSI_sleds[] __attribute__((weak));
+
+static pthread_mutex_t patchLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Makes the pages holding size bytes at address writable, or (if writable
+   is zero) no longer so.  Returns 0 on success. */
+static int protect(unsigned char *address, size_t size, int writable)
+{
+  const uintptr_t page = sysconf(_SC_PAGESIZE);
+  const uintptr_t start = (uintptr_t) address & ~(page - 1);
+  const uintptr_t end = (uintptr_t) address + size;
+  return mprotect((void *) start, end - start,
+                  PROT_READ | PROT_EXEC | (writable ? PROT_WRITE : 0));
+}
+
+
+/* Rewrites the displacement of one jump.  Each jump starts a function, so
+   it is aligned to 16 bytes and lies within the aligned word written here:
+   a thread calling the function meanwhile runs either the old jump or the
+   new one. */
+static int retarget(unsigned char *sled, const void *target)
+{
+  const int32_t displacement =
+    (int32_t) ((uintptr_t) target - (uintptr_t) (sled + SLED_SIZE));
+  uint64_t * const word = (uint64_t *) sled;
+  uint64_t value = __atomic_load_n(word, __ATOMIC_RELAXED);
+
+  if (memcmp((unsigned char *) &value + 1, &displacement,
+             sizeof(displacement)) == 0)
+    return 0;
+  if (protect(sled, sizeof(*word), 1))
+    return -1;
+  memcpy((unsigned char *) &value + 1, &displacement, sizeof(displacement));
+  __atomic_store_n(word, value, __ATOMIC_RELEASE);
+  return protect(sled, sizeof(*word), 0);
+}
+
+
+int __CSI_patch_sleds(void)
+{
+  const struct __CSI_sled *sled;
+  int result = 0;
+
+  pthread_mutex_lock(&patchLock);
+  for (sled = __start___CSI_sleds; sled < __stop___CSI_sleds; ++sled) {
+    const int32_t value = __atomic_load_n(sled->switcher, __ATOMIC_RELAXED);
+    if (value < 0 || (uint64_t) value >= sled->count || !sled->targets[value])
+      continue;
+    if (retarget(sled->sled, sled->targets[value]))
+      result = -1;
+  }
+  pthread_mutex_unlock(&patchLock);
+  return result;
+}
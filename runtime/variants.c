@@ -0,0 +1,290 @@
+/*===------------------------------ variants.c -----------------------------===*
+ *
+ * Chooses among the instrumentation variants of each function while a
+ * program compiled with -runtime-variants runs, by writing the function
+ * switchers described in section __CSI_variants.
+ *
+ *===-----------------------------------------------------------------------===*
+ *
+ * Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *===-----------------------------------------------------------------------===*/
+#include "csi-rt.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* The longest scheme this file compares, such as "{BBC,CC,FC,PT}" */
+#define MAX_SCHEME 256
+
+/* The most instrumentation types in one scheme */
+#define MAX_TYPES 16
+
+extern const struct __CSI_variant __start___CSI_variants[]
+  __attribute__((weak));
+extern const struct __CSI_variant __stop___CSI_variants[]
+  __attribute__((weak));
+
+/* Linked in only when instrumented code uses patchable entry sleds */
+int __CSI_patch_sleds(void) __attribute__((weak));
+
+
+/* Returns the first occurrence of delimiter in text, or its terminator */
+static const char *findEnd(const char *text, char delimiter)
+{
+  while (*text && *text != delimiter)
+    ++text;
+  return text;
+}
+
+
+static int compareTypes(const void *a, const void *b)
+{
+  return strcmp(*(const char * const *) a, *(const char * const *) b);
+}
+
+
+/* Writes the length bytes of scheme at text to out as "{A,B}", with the
+   types sorted and without spaces, so that equal schemes compare equal.
+   Returns 0 on success, or -1 if text is not a scheme. */
+static int normalizeScheme(const char *text, size_t length, char *out)
+{
+  char copy[MAX_SCHEME];
+  const char *types[MAX_TYPES];
+  size_t count = 0, used = 0, i;
+  char *next, *type;
+
+  while (length && isspace((unsigned char) *text)) {
+    ++text;
+    --length;
+  }
+  while (length && isspace((unsigned char) text[length - 1]))
+    --length;
+  if (length < 2 || length >= MAX_SCHEME || text[0] != '{' ||
+      text[length - 1] != '}')
+    return -1;
+  memcpy(copy, text + 1, length - 2);
+  copy[length - 2] = '\0';
+
+  for (next = copy; (type = strsep(&next, ",")); ) {
+    char *end;
+    while (isspace((unsigned char) *type))
+      ++type;
+    end = type + strlen(type);
+    while (end > type && isspace((unsigned char) end[-1]))
+      *--end = '\0';
+    if (!*type)
+      continue;
+    if (count == MAX_TYPES)
+      return -1;
+    types[count++] = type;
+  }
+  qsort(types, count, sizeof(types[0]), compareTypes);
+
+  out[used++] = '{';
+  for (i = 0; i < count; ++i) {
+    if (i)
+      out[used++] = ',';
+    memcpy(out + used, types[i], strlen(types[i]));
+    used += strlen(types[i]);
+  }
+  out[used++] = '}';
+  out[used] = '\0';
+  return 0;
+}
+
+
+/* Returns the switcher value that selects scheme (already normalized) for
+   variant, or -1 if the function has no such variant */
+static int findScheme(const struct __CSI_variant *variant, const char *scheme)
+{
+  const char *slot = variant->schemes;
+  int value = 0;
+
+  for (;;) {
+    const char * const end = findEnd(slot, ';');
+    char normal[MAX_SCHEME];
+    if (end != slot && normalizeScheme(slot, end - slot, normal) == 0 &&
+        strcmp(normal, scheme) == 0)
+      return value;
+    if (!*end)
+      return -1;
+    slot = end + 1;
+    ++value;
+  }
+}
+
+
+static int matches(const struct __CSI_variant *variant, const char *function,
+                   size_t length)
+{
+  return (length == 1 && function[0] == '*') ||
+    (strlen(variant->function) == length &&
+     memcmp(variant->function, function, length) == 0);
+}
+
+
+/* Makes changed switchers take effect in functions that have entry sleds,
+   returning changed, or -1 if they cannot */
+static int settle(int changed)
+{
+  if (changed && __CSI_patch_sleds && __CSI_patch_sleds())
+    return -1;
+  return changed;
+}
+
+
+int __CSI_set_variant(const char *function, const char *scheme)
+{
+  char normal[MAX_SCHEME];
+  const struct __CSI_variant *variant;
+  int changed = 0;
+
+  if (normalizeScheme(scheme, strlen(scheme), normal))
+    return -1;
+
+  for (variant = __start___CSI_variants; variant < __stop___CSI_variants;
+       ++variant)
+    if (matches(variant, function, strlen(function))) {
+      const int value = findScheme(variant, normal);
+      if (value >= 0) {
+        __atomic_store_n(variant->switcher, value, __ATOMIC_RELAXED);
+        ++changed;
+      }
+    }
+  return settle(changed);
+}
+
+
+/* A rule in the text given to __CSI_apply_variants */
+struct rule {
+  const char *function;
+  size_t functionLength;
+  char scheme[MAX_SCHEME];
+};
+
+
+int __CSI_apply_variants(const char *rules)
+{
+  const struct __CSI_variant *variant;
+  struct rule *parsed;
+  size_t count = 0, capacity = 0, i;
+  const char *line = rules;
+  int changed = 0;
+
+  /* one rule per line, as in a tracing schema, but only one scheme each */
+  for (i = 0; rules[i]; ++i)
+    capacity += rules[i] == '\n';
+  parsed = malloc((capacity + 1) * sizeof(*parsed));
+  if (!parsed)
+    return -1;
+
+  while (*line) {
+    const char * const end = findEnd(line, '\n');
+    const char * const separator = memchr(line, ';', end - line);
+    const char *function = line;
+    size_t length;
+
+    while (function < end && isspace((unsigned char) *function))
+      ++function;
+    if (function == end || *function == '#') {
+      line = *end ? end + 1 : end;
+      continue;
+    }
+    if (!separator) {
+      free(parsed);
+      return -1;
+    }
+    length = separator - function;
+    while (length && isspace((unsigned char) function[length - 1]))
+      --length;
+    parsed[count].function = function;
+    parsed[count].functionLength = length;
+    if (normalizeScheme(separator + 1, end - separator - 1,
+                        parsed[count].scheme)) {
+      free(parsed);
+      return -1;
+    }
+    ++count;
+    line = *end ? end + 1 : end;
+  }
+
+  /* as in a schema, the first rule naming a function decides its variant;
+     a function without the rule's scheme keeps its current variant */
+  for (variant = __start___CSI_variants; variant < __stop___CSI_variants;
+       ++variant)
+    for (i = 0; i < count; ++i)
+      if (matches(variant, parsed[i].function, parsed[i].functionLength)) {
+        const int value = findScheme(variant, parsed[i].scheme);
+        if (value >= 0) {
+          __atomic_store_n(variant->switcher, value, __ATOMIC_RELAXED);
+          ++changed;
+        }
+        break;
+      }
+
+  free(parsed);
+  return settle(changed);
+}
+
+
+/* Reads a whole file into a string, which the caller must free */
+static char *readFile(const char *path)
+{
+  const int fd = open(path, O_RDONLY);
+  size_t size = 0, capacity = 4096;
+  char *text = malloc(capacity);
+  ssize_t got;
+
+  if (fd < 0 || !text) {
+    if (fd >= 0)
+      close(fd);
+    free(text);
+    return NULL;
+  }
+  while ((got = read(fd, text + size, capacity - size - 1)) > 0) {
+    size += got;
+    if (capacity - size == 1) {
+      char * const larger = realloc(text, capacity * 2);
+      if (!larger)
+        break;
+      text = larger;
+      capacity *= 2;
+    }
+  }
+  close(fd);
+  text[size] = '\0';
+  return text;
+}
+
+
+__attribute__((constructor))
+static void initVariants(void)
+{
+  const char * const rules = getenv("CSI_VARIANTS");
+  const char * const path = getenv("CSI_VARIANTS_FILE");
+
+  if (path && *path) {
+    char * const text = readFile(path);
+    if (!text || __CSI_apply_variants(text) < 0)
+      fprintf(stderr, "CSI: cannot apply variants from %s\n", path);
+    free(text);
+  }
+  if (rules && __CSI_apply_variants(rules) < 0)
+    fprintf(stderr, "CSI: cannot apply variants from CSI_VARIANTS\n");
+}
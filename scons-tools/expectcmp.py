@@ -28,11 +28,12 @@ class RTType:
 #end: RTType
 
 class RTData:
-  __slots__ = "_function", "_arrayName", "_entries";
+  __slots__ = "_function", "_arrayName", "_isBits", "_entries";
   
-  def __init__(self, function, arrayName):
+  def __init__(self, function, arrayName, isBits=False):
     self._function = function;
     self._arrayName = arrayName;
+    self._isBits = isBits;
     self._entries = [];
   #end: __init__
   
@@ -44,8 +45,10 @@ class RTData:
     if(not isinstance(other, RTData)):
       raise TypeError("Innapropriate comparison of " + str(other) + \
                       " to RTData");
-    myValue = (self._function, self._arrayName, sorted(self._entries));
-    otherValue = (other._function, other._arrayName, sorted(other._entries));
+    myValue = (self._function, self._arrayName, self._isBits,
+               sorted(self._entries));
+    otherValue = (other._function, other._arrayName, other._isBits,
+                  sorted(other._entries));
     if(myValue < otherValue):
       return(-1);
     elif(myValue > otherValue):
@@ -56,16 +59,25 @@ class RTData:
 #end: RTData
 
 class PTData:
-  __slots__ = "_function", "_nodes", "_edges", "_entries", "_exits";
+  __slots__ = "_function", "_attributes", "_nodes", "_edges", "_entries", \
+              "_exits";
   
   def __init__(self, function):
     self._function = function;
+    self._attributes = {};
     self._nodes = {};
     self._edges = set([]);
     self._entry = None;
     self._exits = set([]);
   #end: __init__
   
+  def setAttribute(self, key, value):
+    if(key in self._attributes):
+      raise KeyError("Attribute '" + str(key) + "' already set for function '" + \
+                     str(self._function) + "'");
+    self._attributes[key] = value;
+  #end: setAttribute
+  
   def addNode(self, num, entries):
     if(num in self._nodes):
       raise KeyError("Node '" + str(num) + "' already exists for function '" + \
@@ -108,10 +120,10 @@ class PTData:
     if(not isinstance(other, PTData)):
       raise TypeError("Innapropriate comparison of " + str(other) + \
                       " to PTData");
-    myValue = (self._function, self._nodes, self._edges,
+    myValue = (self._function, self._attributes, self._nodes, self._edges,
                self._entry, self._exits);
-    otherValue = (other._function, other._nodes, other._edges,
-                  other._entry, other._exits);
+    otherValue = (other._function, other._attributes, other._nodes,
+                  other._edges, other._entry, other._exits);
     if(myValue < otherValue):
       return(-1);
     elif(myValue > otherValue):
@@ -164,12 +176,17 @@ def read_rt(f, rtType):
           print >> stderr, ("ERROR 1: incorrect formatting in rt file " + f);
           exit(1);
         
+        # arrays packed as bits (-pack-global-coverage) carry a third part
         lineParts = line[1:].strip().split('|');
-        if(len(lineParts) != 2):
+        if(len(lineParts) == 3 and lineParts[2] == "bits"):
+          isBits = True;
+        elif(len(lineParts) == 2):
+          isBits = False;
+        else:
           print >> stderr, ("ERROR 2: incorrect formatting in rt file " + f);
           exit(2);
         
-        funcData = RTData(lineParts[0], lineParts[1]);
+        funcData = RTData(lineParts[0], lineParts[1], isBits);
         
         # read the data entries for this function
         uniqueIds = set([]);
@@ -235,9 +252,19 @@ def read_pt(f):
         
         cfg = PTData(funcName);
         
+        # read any storage attributes for this function
+        line = fp.readline();
+        while(line and line[0] == "@"):
+          lineParts = [x.strip() for x in line[1:].split("|")];
+          if(len(lineParts) != 2):
+            print >> stderr, ("ERROR 10: incorrect formatting in pt file " + f);
+            exit(10);
+          cfg.setAttribute(lineParts[0], lineParts[1]);
+          line = fp.readline();
+        #end while
+        
         # read the basic blocks for this function
         bbs = {};
-        line = fp.readline();
         while(line):
           if(not line or not line[0].isdigit()):
             break;
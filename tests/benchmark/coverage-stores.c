@@ -0,0 +1,158 @@
+/*===--------------------------- coverage-stores.c -------------------------===*
+ *
+ * Times the stores that mark global coverage, as instrumented code performs
+ * them, with several threads covering the same sites at once.
+ *
+ * usage: coverage-stores [sites [iterations]]
+ *
+ * "bytes" is the default scheme: an unordered store of 1 to the site's byte
+ * on every execution.  "bits" is the scheme of -pack-global-coverage: load
+ * the site's byte and only set its bit, with an atomic "or", when it is not
+ * set yet, so covered sites are only read.  Each line gives nanoseconds per
+ * site executed, for 1, 2, 4, and 8 threads.  Thread t is pinned to CPU t
+ * modulo the number of CPUs available, so that with more than one CPU the
+ * threads really do contend for the coverage cache lines.  On a single CPU
+ * the numbers show only the cost of the instructions, not of coherence.
+ *
+ *===-----------------------------------------------------------------------===*
+ *
+ * Copyright (c) 2023 Peter J. Ohmann and Benjamin R. Liblit
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *===-----------------------------------------------------------------------===*/
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX_THREADS 8
+
+static unsigned sites = 64;
+static unsigned long iterations = 4000000;
+static unsigned char *coverage;
+static cpu_set_t available;
+
+
+static void *bytes(void *unused)
+{
+  unsigned long i;
+  unsigned site;
+
+  (void) unused;
+  for (i = 0; i < iterations; ++i)
+    for (site = 0; site < sites; ++site)
+      __atomic_store_n(&coverage[site], 1, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+
+static void *bits(void *unused)
+{
+  unsigned long i;
+  unsigned site;
+
+  (void) unused;
+  for (i = 0; i < iterations; ++i)
+    for (site = 0; site < sites; ++site) {
+      unsigned char * const entry = &coverage[site / 8];
+      const unsigned char bit = 1 << (site % 8);
+      const unsigned char old = __atomic_load_n(entry, __ATOMIC_RELAXED);
+      if ((old | bit) != old)
+        __atomic_fetch_or(entry, bit, __ATOMIC_RELAXED);
+    }
+  return NULL;
+}
+
+
+static double run(void *(*scheme)(void *), unsigned threads)
+{
+  pthread_t workers[MAX_THREADS];
+  struct timespec start, stop;
+  unsigned t;
+
+  for (t = 0; t < sites; ++t)
+    coverage[t] = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (t = 0; t < threads; ++t) {
+    pthread_attr_t attr;
+    cpu_set_t cpu;
+    unsigned skip = t % CPU_COUNT(&available), c = 0;
+
+    while (!CPU_ISSET(c, &available) || skip--)
+      ++c;
+    CPU_ZERO(&cpu);
+    CPU_SET(c, &cpu);
+    pthread_attr_init(&attr);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpu), &cpu);
+    if (pthread_create(&workers[t], &attr, scheme, NULL)) {
+      perror("pthread_create");
+      exit(1);
+    }
+    pthread_attr_destroy(&attr);
+  }
+  for (t = 0; t < threads; ++t)
+    pthread_join(workers[t], NULL);
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+
+  return ((stop.tv_sec - start.tv_sec) * 1e9 +
+          (stop.tv_nsec - start.tv_nsec)) /
+    ((double) threads * iterations * sites);
+}
+
+
+int main(int argc, char *argv[])
+{
+  static const struct {
+    const char *name;
+    void *(*scheme)(void *);
+  } schemes[] = {
+    { "bytes", bytes },
+    { "bits", bits },
+  };
+  unsigned s, threads;
+
+  if (argc > 1)
+    sites = strtoul(argv[1], NULL, 0);
+  if (argc > 2)
+    iterations = strtoul(argv[2], NULL, 0);
+  if (!sites || !iterations) {
+    fprintf(stderr, "usage: %s [sites [iterations]]\n", argv[0]);
+    return 2;
+  }
+
+  if (sched_getaffinity(0, sizeof(available), &available)) {
+    perror("sched_getaffinity");
+    return 1;
+  }
+  printf("%d CPUs\n", CPU_COUNT(&available));
+
+  /* one array for both schemes, so both see the same cache lines */
+  coverage = aligned_alloc(64, (sites + 63) & ~63U);
+  if (!coverage) {
+    perror("aligned_alloc");
+    return 1;
+  }
+
+  for (s = 0; s < sizeof(schemes) / sizeof(schemes[0]); ++s) {
+    printf("%-6s", schemes[s].name);
+    for (threads = 1; threads <= MAX_THREADS; threads *= 2)
+      printf(" %8.3f", run(schemes[s].scheme, threads));
+    printf("\n");
+  }
+
+  free(coverage);
+  return 0;
+}
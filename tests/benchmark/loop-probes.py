@@ -0,0 +1,92 @@
+#!/usr/bin/env python
+
+"""Compare statement coverage probes with and without -loop-aware-probes.
+
+usage: loop-probes.py csi-cc extract_section.py [pi-iterations]
+
+The loop and pi regression tests are compiled with statement coverage at
+CSI optimization level 2, once with the default placement and once with
+-loop-aware-probes, and once with function coverage only as a baseline.
+For each build, the first column counts the blocks given probes, as listed
+in the executable's statement coverage metadata, and the second gives the
+best of five run times (pi estimates pi from the given number of
+iterations; loop reads nothing).
+"""
+
+from __future__ import print_function
+
+from os import path
+from platform import system
+from re import match
+from shutil import rmtree
+from subprocess import PIPE, Popen, check_call
+from sys import argv, exit, stderr
+from tempfile import mkdtemp
+from time import time
+
+
+DEFAULT_ITERATIONS = 20000000
+RUNS = 5
+TESTS = path.join(path.dirname(path.abspath(__file__)), path.pardir)
+BUILDS = (
+    ('baseline', 'FC', ()),
+    ('default', 'BBC', ()),
+    ('loop-aware', 'BBC', ('-loop-aware-probes',)),
+)
+
+
+def countProbes(extractor, executable):
+    # each probed block has a line "index|BBCindex|lines"; the others have
+    # negative indices
+    section = ('__CSI' if 'darwin' in system().lower() else '') + '.debug_BBC'
+    process = Popen((extractor, '--require', section, executable), stdout=PIPE)
+    metadata = process.communicate()[0].decode()
+    return sum(1 for line in metadata.splitlines() if match(r'\d+\|BBC', line))
+
+
+def bestTime(executable, stdin):
+    best = None
+    for _ in range(RUNS):
+        start = time()
+        process = Popen((executable,), stdin=PIPE, stdout=PIPE)
+        process.communicate(stdin)
+        elapsed = time() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+
+def main():
+    if len(argv) < 3:
+        print(__doc__.strip(), file=stderr)
+        exit(1)
+    csiCC = argv[1]
+    extractor = argv[2]
+    iterations = int(argv[3]) if len(argv) > 3 else DEFAULT_ITERATIONS
+
+    programs = (
+        ('loop', path.join(TESTS, 'loop', 'loop.c'), b''),
+        ('pi', path.join(TESTS, 'pi', 'pi.c'), ('%d\n' % iterations).encode()),
+    )
+
+    work = mkdtemp()
+    try:
+        schemas = {}
+        for scheme in ('FC', 'BBC'):
+            schemas[scheme] = path.join(work, scheme + '.schema')
+            with open(schemas[scheme], 'w') as out:
+                out.write('*;{%s}\n' % scheme)
+
+        print('%-6s %-12s %8s %10s' % ('test', 'build', 'probes', 'time (s)'))
+        for name, source, stdin in programs:
+            for build, scheme, flags in BUILDS:
+                executable = path.join(work, '%s-%s' % (name, build))
+                check_call((csiCC, '--trace=' + schemas[scheme], '-no-filter', '-csi-opt=2', '-O2',
+                            source, '-o', executable) + flags)
+                probes = countProbes(extractor, executable)
+                print('%-6s %-12s %8d %10.3f' % (name, build, probes, bestTime(executable, stdin)))
+    finally:
+        rmtree(work)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,77 @@
+#!/usr/bin/env python
+
+"""Count instructions executed with and without -select-path-increments.
+
+usage: pt-increments.py csi-cc
+
+The lotsofifs, loop, and pi regression tests are compiled three times at
+the default optimization level: with function coverage only (the
+baseline), with path tracing, and with path tracing using
+-select-path-increments.  Each build is run on its test's input under
+"perf stat", which must be installed.  For each build, the first column
+gives the user-space instructions executed, and the second gives the
+instructions beyond the baseline.
+"""
+
+from __future__ import print_function
+
+from os import path
+from shutil import rmtree
+from subprocess import PIPE, Popen, check_call
+from sys import argv, exit, stderr
+from tempfile import mkdtemp
+
+
+TESTS = path.join(path.dirname(path.abspath(__file__)), path.pardir)
+BUILDS = (
+    ('baseline', 'FC', ()),
+    ('split', 'PT', ()),
+    ('select', 'PT', ('-select-path-increments',)),
+)
+
+
+def countInstructions(executable, stdin):
+    with open(stdin) as inputs:
+        process = Popen(('perf', 'stat', '-x,', '-e', 'instructions:u', executable),
+                        stdin=inputs, stdout=PIPE, stderr=PIPE)
+        _, report = process.communicate()
+    for line in report.decode().splitlines():
+        fields = line.split(',')
+        if len(fields) > 2 and fields[2].startswith('instructions'):
+            return int(fields[0])
+    raise RuntimeError('no instruction count from perf for %s' % executable)
+
+
+def main():
+    if len(argv) < 2:
+        print(__doc__.strip(), file=stderr)
+        exit(1)
+    csiCC = argv[1]
+
+    work = mkdtemp()
+    try:
+        schemas = {}
+        for scheme in ('FC', 'PT'):
+            schemas[scheme] = path.join(work, scheme + '.schema')
+            with open(schemas[scheme], 'w') as out:
+                out.write('*;{%s}\n' % scheme)
+
+        print('%-10s %-9s %14s %12s' % ('test', 'build', 'instructions', 'beyond base'))
+        for name in ('lotsofifs', 'loop', 'pi'):
+            source = path.join(TESTS, name, name + '.c')
+            stdin = path.join(TESTS, name, name + '.in')
+            baseline = None
+            for build, scheme, flags in BUILDS:
+                executable = path.join(work, '%s-%s' % (name, build))
+                check_call((csiCC, '--trace=' + schemas[scheme], '-no-filter',
+                            source, '-o', executable) + flags)
+                count = countInstructions(executable, stdin)
+                if baseline is None:
+                    baseline = count
+                print('%-10s %-9s %14d %12d' % (name, build, count, count - baseline))
+    finally:
+        rmtree(work)
+
+
+if __name__ == '__main__':
+    main()
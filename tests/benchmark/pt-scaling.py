@@ -0,0 +1,76 @@
+#!/usr/bin/env python
+
+"""Time path tracing instrumentation on generated functions of growing size.
+
+usage: pt-scaling.py csi-cc [blocks ...]
+
+Each generated function is a chain of if/else diamonds with a small loop
+after every 64 of them, so its acyclic path count grows exponentially and
+path tracing must cut it into regions (-cut-path-regions; without it, path
+tracing skips the function).  Every size is compiled twice: once
+with function coverage only (the baseline) and once with path tracing.  The
+last column gives the path tracing time beyond the baseline per thousand
+blocks; it would stay constant if path tracing took linear time.
+"""
+
+from __future__ import print_function
+
+from os import path
+from shutil import rmtree
+from subprocess import check_call
+from sys import argv, exit, stderr
+from tempfile import mkdtemp
+from time import time
+
+
+DEFAULT_BLOCKS = (1000, 10000, 100000)
+
+
+def generate(blocks, out):
+    out.write('int work(int x)\n{\n  int y = 0;\n')
+    # each diamond contributes three blocks
+    for i in range(blocks // 3):
+        out.write('  if (x & %d) y += %d; else y -= %d;\n' % (1 << (i % 30), i, i))
+        if i % 64 == 63:
+            out.write('  while (y & 1) y >>= 1;\n')
+    out.write('  return y;\n}\n')
+
+
+def compileTime(csiCC, schema, source, obj):
+    start = time()
+    check_call((csiCC, '--trace=' + schema, '-no-filter', '-cut-path-regions',
+                '-c', source, '-o', obj))
+    return time() - start
+
+
+def main():
+    if len(argv) < 2:
+        print(__doc__.strip(), file=stderr)
+        exit(1)
+    csiCC = argv[1]
+    sizes = [int(arg) for arg in argv[2:]] or DEFAULT_BLOCKS
+
+    work = mkdtemp()
+    try:
+        schemas = {}
+        for scheme in ('FC', 'PT'):
+            schemas[scheme] = path.join(work, scheme + '.schema')
+            with open(schemas[scheme], 'w') as out:
+                out.write('*;{%s}\n' % scheme)
+
+        print('%10s %12s %12s %16s' % ('blocks', 'baseline (s)', 'PT (s)', 'PT ms/1k blocks'))
+        for blocks in sizes:
+            source = path.join(work, 'work%d.c' % blocks)
+            obj = path.join(work, 'work%d.o' % blocks)
+            with open(source, 'w') as out:
+                generate(blocks, out)
+            baseline = compileTime(csiCC, schemas['FC'], source, obj)
+            traced = compileTime(csiCC, schemas['PT'], source, obj)
+            print('%10d %12.2f %12.2f %16.2f' % (blocks, baseline, traced,
+                                                 (traced - baseline) * 1e6 / blocks))
+    finally:
+        rmtree(work)
+
+
+if __name__ == '__main__':
+    main()
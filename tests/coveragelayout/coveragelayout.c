@@ -0,0 +1,29 @@
+#include <stdint.h>
+#include <stdio.h>
+
+extern char __start___CSI_cov[] __attribute__((weak));
+extern char __stop___CSI_cov[] __attribute__((weak));
+
+int calls;
+
+int covered(){
+  const char *c;
+  int bytes = 0;
+  for(c = __start___CSI_cov; c < __stop___CSI_cov; ++c)
+    bytes += *c != 0;
+  return bytes;
+}
+
+__attribute__((noinline)) void later(){
+  ++calls;
+}
+
+int main(){
+  int before = covered();
+  later();
+  printf("coverage arrays start a cache line: %d\n",
+         __start___CSI_cov != NULL && (uintptr_t) __start___CSI_cov % 64 == 0);
+  printf("calling later %s the coverage arrays\n",
+         covered() > before ? "changed" : "did not change");
+  return 0;
+}
@@ -0,0 +1,37 @@
+#include <signal.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "csi-rt.h"
+
+int crash(int n){
+  if(n == 0)
+    raise(SIGSEGV);
+  return crash(n - 1);
+}
+
+int main(){
+  char path[64];
+  struct __CSI_crash_header header;
+  struct __CSI_crash_chunk chunk;
+  int records = 0, paths = 0, status;
+  FILE *report;
+  pid_t child = fork();
+  if(child == 0)
+    return crash(3);
+  waitpid(child, &status, 0);
+  printf("child killed by signal %d\n", WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+  sprintf(path, "/tmp/csi-%d.crash", (int) child);
+  report = fopen(path, "rb");
+  fread(&header, sizeof(header), 1, report);
+  printf("report of signal %d\n", (int) header.signal);
+  while(fread(&chunk, sizeof(chunk), 1, report) == 1){
+    records += chunk.kind == CSI_CRASH_SHADOW_RECORD;
+    paths += chunk.kind == CSI_CRASH_PATH;
+    fseek(report, chunk.size, SEEK_CUR);
+  }
+  printf("%d shadow records, %d paths\n", records, paths);
+  fclose(report);
+  remove(path);
+  return 0;
+}
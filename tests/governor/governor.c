@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include <string.h>
+#include "csi-rt.h"
+
+extern const struct __CSI_variant __start___CSI_variants[], __stop___CSI_variants[];
+
+int hot(int n){
+  return n % 3;
+}
+
+int main(){
+  const struct __CSI_variant *variant;
+  int n, i, sum = 0;
+  scanf("%d", &n);
+  for(i = 0; i < n; ++i)
+    sum += hot(i);
+  printf("%d switched within a generous budget\n", (int) __CSI_governor_step(1e9));
+  for(i = 0; i < n; ++i)
+    sum += hot(i);
+  printf("%d switched within a tight budget\n", (int) __CSI_governor_step(1));
+  for(variant = __start___CSI_variants; variant < __stop___CSI_variants; ++variant)
+    if(strcmp(variant->function, "hot") == 0)
+      printf("hot runs variant %d of %s\n", (int) *variant->switcher, variant->schemes);
+  printf("sum: %d\n", sum);
+  return 0;
+}
@@ -0,0 +1,24 @@
+#include <stdio.h>
+
+int foo(){
+  return 3;
+}
+
+int main(){
+  int x = 0, y = 10;
+  int z = foo();
+  if(x < y)
+    x++;
+  if(x < y)
+    x++;
+  if(x < y)
+    x++;
+  if(x < y)
+    x++;
+  if(x < y)
+    x++;
+  if(x < y)
+    x++;
+  x += foo();
+  printf("%d\n", x+z);
+}
@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "csi-rt.h"
+
+static char file[1 << 16];
+
+int covered(const char *path){
+  const struct __CSI_live_header *header = (const struct __CSI_live_header *) file;
+  FILE *live = fopen(path, "rb");
+  size_t size = fread(file, 1, sizeof(file), live);
+  size_t i;
+  int bytes = 0;
+  fclose(live);
+  if(memcmp(header->magic, CSI_LIVE_MAGIC, 8) || header->pid != (uint32_t) getpid())
+    return -1;
+  for(i = header->pageSize; i < size; ++i)
+    bytes += file[i] != 0;
+  return bytes;
+}
+
+int later(){
+  return 1;
+}
+
+int main(){
+  char path[64];
+  int before, status;
+  strcpy(path, __CSI_live_path());
+  before = covered(path);
+  later();
+  printf("calling later %s the live file\n", covered(path) > before ? "changed" : "did not change");
+  fflush(stdout);
+  if(fork() == 0){
+    printf("child has its own file: %d\n", strcmp(path, __CSI_live_path()) != 0 && covered(__CSI_live_path()) > 0);
+    return 0;
+  }
+  wait(&status);
+  return 0;
+}
@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include "csi-rt.h"
+
+int main(void);
+
+__attribute__((noinline)) int parity(int n){
+  if(n % 2)
+    return 1;
+  return 0;
+}
+
+static const char *name(uint64_t function){
+  if(function == (uintptr_t) parity)
+    return "parity";
+  if(function == (uintptr_t) main)
+    return "main";
+  return "unknown";
+}
+
+static void show(uint64_t function, uint64_t path, void *data){
+  int *shown = (int *) data;
+  if(*shown < 4)
+    printf("%s path %d\n", name(function), (int) path);
+  ++*shown;
+}
+
+int main(){
+  int n, i, odd = 0, shown = 0;
+  scanf("%d", &n);
+  for(i = 0; i < n; ++i)
+    odd += parity(i);
+  printf("%d of %d odd\n", odd, n);
+  __CSI_pt_ring_walk(show, &shown);
+  printf("%d paths in the ring\n", shown);
+  return 0;
+}
@@ -0,0 +1,22 @@
+#include <stdio.h>
+#include "csi-rt.h"
+
+__attribute__((noinline)) int parity(int n){
+  if(n % 2)
+    return 1;
+  return 0;
+}
+
+int main(){
+  int n, odd;
+  uint64_t before;
+  scanf("%d", &n);
+  before = __CSI_pt_ring_count;
+  odd = parity(n) + parity(n + 1) + parity(n + 2) + parity(n + 3)
+    + parity(n + 4) + parity(n + 5) + parity(n + 6) + parity(n + 7)
+    + parity(n + 8) + parity(n + 9) + parity(n + 10) + parity(n + 11);
+  printf("%d of 12 odd\n", odd);
+  printf("%d of 12 calls to parity traced\n",
+         (int) (__CSI_pt_ring_count - before));
+  return 0;
+}
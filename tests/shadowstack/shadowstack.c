@@ -0,0 +1,28 @@
+#include <stdio.h>
+#include <string.h>
+#include "csi-rt.h"
+
+static void count(const struct __CSI_shadow_record *record, void *data){
+  if(strstr((const char *) record->layout, "__PT_curPath="))
+    ++*(int *) data;
+}
+
+__attribute__((noinline)) int records(){
+  int found = 0;
+  __CSI_shadow_walk(count, &found);
+  return found;
+}
+static volatile int zero;
+__attribute__((noinline)) int depth(int n){
+  if(n == 0)
+    return records();
+  return depth(n - 1) + zero;
+}
+
+int main(){
+  int n;
+  scanf("%d", &n);
+  printf("%d records at depth %d\n", depth(n), n);
+  printf("%d records after returning\n", records());
+  return 0;
+}
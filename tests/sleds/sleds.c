@@ -0,0 +1,27 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "csi-rt.h"
+static volatile int calls;
+__attribute__((noinline)) int later(){
+  return ++calls;
+}
+
+int gained(unsigned char *before, unsigned char *after, struct __CSI_cov_change *changes){
+  __CSI_cov_snapshot(before, 1);
+  __CSI_cov_snapshot(before, 0);
+  later();
+  __CSI_cov_snapshot(after, 0);
+  return (int) __CSI_cov_delta(before, after, changes);
+}
+
+int main(){
+  const uint64_t size = __CSI_cov_size(CSI_COV_ALL_SECTIONS);
+  unsigned char *before = malloc(size), *after = malloc(size);
+  struct __CSI_cov_change *changes = malloc(size * sizeof(*changes));
+  printf("%d bytes gained with later uninstrumented\n", gained(before, after, changes));
+  printf("%d switchers changed\n", __CSI_set_variant("later", "{PT,FC,CC,BBC}"));
+  printf("%d bytes gained with later instrumented\n", gained(before, after, changes));
+  printf("%d switchers changed\n", __CSI_apply_variants("# as in a schema\nlater;{}\n*;{CC}\n"));
+  printf("%d bytes gained with later uninstrumented again\n", gained(before, after, changes));
+  return 0;
+}
@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "csi-rt.h"
+
+int later(){
+  return 1;
+}
+
+int main(){
+  const uint64_t size = __CSI_cov_size(CSI_COV_ALL_SECTIONS);
+  unsigned char *before = malloc(size), *after = malloc(size);
+  struct __CSI_cov_change *changes = malloc(size * sizeof(*changes));
+  struct __CSI_cov_delta_header header;
+  FILE *emitted = tmpfile();
+
+  __CSI_cov_snapshot(before, 1);
+  __CSI_cov_snapshot(before, 0);
+  later();
+  __CSI_cov_snapshot(after, 0);
+  printf("%d bytes gained by calling later\n", (int) __CSI_cov_delta(before, after, changes));
+
+  __CSI_cov_emit(fileno(emitted), 0);
+  __CSI_cov_emit(fileno(emitted), 1);
+  rewind(emitted);
+  while(fread(&header, sizeof(header), 1, emitted) == 1){
+    printf("emit %d: %d changes\n", (int) header.sequence, (int) header.count);
+    fseek(emitted, header.count * sizeof(*changes), SEEK_CUR);
+  }
+  return 0;
+}
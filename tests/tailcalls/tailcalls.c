@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include "csi-rt.h"
+
+/* called through a pointer, so that clang cannot turn the recursion into a
+   loop before it is instrumented */
+static int countdown(int n);
+static int (*volatile next)(int) = countdown;
+
+static int countdown(int n){
+  if(n == 0)
+    return 0;
+  return next(n - 1);
+}
+
+int main(){
+  struct __CSI_crash_header header;
+  struct __CSI_crash_chunk chunk;
+  uint64_t pair[2];
+  int n, pairs = 0, newest = 0;
+  FILE *report = tmpfile();
+
+  scanf("%d", &n);
+  /* without tail calls, this many frames would overflow the stack */
+  printf("counted down from %d to %d\n", n, countdown(n));
+
+  __CSI_crash_write(fileno(report), 0, NULL);
+  rewind(report);
+  fread(&header, sizeof(header), 1, report);
+  while(fread(&chunk, sizeof(chunk), 1, report) == 1){
+    if(chunk.kind == CSI_CRASH_TAIL_PATH){
+      fread(pair, sizeof(pair), 1, report);
+      if(!pairs++)
+        newest = pair[0] == (uintptr_t) countdown;
+    }
+    else
+      fseek(report, chunk.size, SEEK_CUR);
+  }
+  printf("%d tail call paths reported\n", pairs);
+  printf("newest from %s\n", newest ? "countdown" : "elsewhere");
+  fclose(report);
+  return 0;
+}
@@ -0,0 +1,15 @@
+#include <stdio.h>
+
+static int values[1024];
+
+int main(){
+  int n, i, sum = 0;
+  if(scanf("%d", &n) != 1 || n < 0 || n > 1024)
+    return(1);
+  for(i = 0; i < n; ++i)
+    values[i] = i * 3;
+  for(i = 0; i < n; ++i)
+    sum += values[i];
+  printf("SUM: %d\n", sum);
+  return(0);
+}